@@ -22,6 +22,7 @@
 #include "handlers/dns/DnsStreamHandler.h"
 #include "handlers/net/NetStreamHandler.h"
 #include "inputs/dnstap/DnstapInputStream.h"
+#include "inputs/flow/FlowInputStream.h"
 #include "inputs/pcap/PcapInputStream.h"
 #include "inputs/sflow/SflowInputStream.h"
 
@@ -36,7 +37,7 @@ static const char USAGE[] =
     to stderr.
 
     Options:
-      -i INPUT              Input type (pcap|dnstap|sflow). If not set, default is pcap input
+      -i INPUT              Input type (pcap|dnstap|sflow|flow). If not set, default is pcap input
       --max-deep-sample N   Never deep sample more than N% of streams (an int between 0 and 100) [default: 100]
       --periods P           Hold this many 60 second time periods of history in memory. Use 1 to summarize all data. [default: 5]
       -h --help             Show this screen
@@ -63,13 +64,15 @@ using namespace visor;
 enum InputType {
     PCAP = 0,
     DNSTAP = 1,
-    SFLOW = 2
+    SFLOW = 2,
+    FLOW = 3
 };
 
 static const std::map<std::string, InputType> input_map = {
     {"pcap", PCAP},
     {"dnstap", DNSTAP},
-    {"sflow", SFLOW}};
+    {"sflow", SFLOW},
+    {"flow", FLOW}};
 
 void initialize_geo(const docopt::value &city, const docopt::value &asn)
 {
@@ -153,6 +156,11 @@ int main(int argc, char *argv[])
             new_input_stream = std::make_unique<input::sflow::SflowInputStream>(input_text);
             new_input_stream->config_set("pcap_file", args["FILE"].asString());
             break;
+        case FLOW:
+            input_text = "flow";
+            new_input_stream = std::make_unique<input::flow::FlowInputStream>(input_text);
+            new_input_stream->config_set("pcap_file", args["FILE"].asString());
+            break;
         case PCAP:
         default:
             new_input_stream = std::make_unique<input::pcap::PcapInputStream>(input_text);
@@ -65,6 +65,12 @@ static const char USAGE[] =
     Geo Options:
       --geo-city FILE             GeoLite2 City database to use for IP to Geo mapping
       --geo-asn FILE              GeoLite2 ASN database to use for IP to ASN mapping
+      --geo-compiled              Flatten the Geo databases into in-memory prefix tables at startup. Lookups are
+                                  faster at the cost of a slower startup and more memory: with full GeoLite2 databases
+                                  the tables can reach tens of MB each (the net handler info reports their size).
+                                  IPv6 networks longer than /48 are still looked up in the database file.
+      --geo-watch N               Check the Geo databases for updates every N seconds, hot reloading them when they
+                                  change. With --admin-api, POST /api/v1/geo/reload reloads them on demand.
     Configuration:
       --config FILE               Use specified YAML configuration to configure options, Taps, and Collection Policies
                                   Please see https://pktvisor.dev for more information
@@ -108,6 +114,8 @@ struct CmdOptions {
     std::pair<bool, std::string> prom_instance{false, ""};
     std::pair<bool, std::string> geo_city{false, ""};
     std::pair<bool, std::string> geo_asn{false, ""};
+    bool geo_compiled{false};
+    std::pair<bool, unsigned int> geo_watch{false, 0};
     std::pair<bool, unsigned int> max_deep_sample{false, 0};
     std::pair<bool, unsigned int> periods{false, 0};
     std::pair<bool, YAML::Node> config;
@@ -193,6 +201,14 @@ void fill_cmd_options(std::map<std::string, docopt::value> args, CmdOptions &opt
         options.geo_asn = {true, config["geo_asn"].as<std::string>()};
     }
 
+    options.geo_compiled = (config["geo_compiled"] && config["geo_compiled"].as<bool>()) || args["--geo-compiled"].asBool();
+
+    if (args["--geo-watch"]) {
+        options.geo_watch = {true, static_cast<unsigned int>(args["--geo-watch"].asLong())};
+    } else if (config["geo_watch"]) {
+        options.geo_watch = {true, config["geo_watch"].as<unsigned int>()};
+    }
+
     if (args["--max-deep-sample"]) {
         options.max_deep_sample = {true, static_cast<unsigned int>(args["--max-deep-sample"].asLong())};
     } else if (config["max_deep_sample"]) {
@@ -249,13 +265,15 @@ void fill_cmd_options(std::map<std::string, docopt::value> args, CmdOptions &opt
     }
 }
 
-void initialize_geo(const std::string &city, const std::string &asn)
+void initialize_geo(const std::string &city, const std::string &asn, bool compiled, unsigned int watch)
 {
     if (!city.empty()) {
-        geo::GeoIP().enable(city);
+        geo::GeoIP().enable(city, compiled);
+        geo::GeoIP().watch(std::chrono::seconds(watch));
     }
     if (!asn.empty()) {
-        geo::GeoASN().enable(asn);
+        geo::GeoASN().enable(asn, compiled);
+        geo::GeoASN().watch(std::chrono::seconds(watch));
     }
 }
 
@@ -504,7 +522,7 @@ int main(int argc, char *argv[])
     unsigned int periods = options.periods.second;
 
     try {
-        initialize_geo(options.geo_city.second, options.geo_asn.second);
+        initialize_geo(options.geo_city.second, options.geo_asn.second, options.geo_compiled, options.geo_watch.second);
     } catch (const std::exception &e) {
         logger->error("Fatal error: {}", e.what());
         exit(EXIT_FAILURE);
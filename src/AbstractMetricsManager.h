@@ -15,9 +15,11 @@
 #pragma GCC diagnostic pop
 #include "Configurable.h"
 #include "Metrics.h"
+#include <mutex>
 #include <shared_mutex>
 #include <sstream>
 #include <sys/time.h>
+#include <thread>
 #include <unordered_map>
 
 namespace visor {
@@ -136,6 +138,8 @@ public:
     {
         std::unique_lock w_lock(_base_mutex);
         _recorded_stream = true;
+        // recorded streams are processed faster than real time, so rates come from the event time stamps
+        _rate_events.set_event_time();
     }
 
     void set_event_rate_info(std::string schema_key, std::initializer_list<std::string> names, const std::string &desc)
@@ -184,14 +188,15 @@ public:
         specialized_merge(other);
     }
 
-    void new_event(bool deep)
+    // weight is the number of events this one stands for, e.g. the sampling rate of a sampled packet
+    void new_event(bool deep, timespec stamp, uint64_t weight = 1)
     {
         // note, currently not enforcing _read_only
-        ++_rate_events;
+        _rate_events.update(stamp, weight);
         std::unique_lock lock(_base_mutex);
-        ++_num_events;
+        _num_events += weight;
         if (deep) {
-            ++_num_samples;
+            _num_samples += weight;
         }
     }
 
@@ -219,12 +224,16 @@ private:
     /**
      * sampling
      */
-    jsf32 _rng;
     uint32_t _deep_sample_rate{100};
 
-protected:
-    std::atomic_bool _deep_sampling_now; // atomic so we can reference without mutex
+    // events may arrive from more than one input thread, so each has its own generator
+    static jsf32 &_rng()
+    {
+        thread_local jsf32 rng(static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id())));
+        return rng;
+    }
 
+protected:
     /**
      * indicates if the stream we are processing was pre recorded, not live
      */
@@ -236,6 +245,8 @@ private:
      */
     timespec _last_shift_tstamp;
     timespec _next_shift_tstamp;
+    // serializes period shifts when events arrive from more than one thread
+    std::mutex _shift_mutex;
 
     /**
      * simple cache for json results
@@ -248,6 +259,14 @@ private:
      */
     void _period_shift(timespec stamp)
     {
+        std::unique_lock sl(_shift_mutex);
+        {
+            // another thread may have shifted while we waited
+            std::shared_lock rlb(_base_mutex);
+            if (stamp.tv_sec < _next_shift_tstamp.tv_sec) {
+                return;
+            }
+        }
         // ensure access to the buckets is locked while we period shift
         std::unique_lock wl(_bucket_mutex);
         std::unique_ptr<MetricsBucketClass> expiring_bucket;
@@ -257,6 +276,7 @@ private:
         if (_recorded_stream) {
             _metric_buckets[0]->set_recorded_stream();
         }
+        on_new_bucket(*_metric_buckets[0]);
         // notify second most recent bucket that it is now read only, save end time
         _metric_buckets[1]->set_read_only(stamp);
         // if we're at our period history length max, pop the oldest
@@ -285,13 +305,15 @@ protected:
      * (optionally) chosen, and the time window will be maintained
      *
      * @param stamp time stamp of the event
+     * @param sample whether to (optionally) choose deep sampling for this event
+     * @param weight number of events this one stands for, e.g. the packets summarized by a flow record
+     * @return whether this event was chosen for deep sampling. events may arrive from more than one thread, so the
+     * caller should pass this on rather than keep it in shared state
      */
-    void new_event(timespec stamp, bool sample = true)
+    bool new_event(timespec stamp, bool sample = true, uint64_t weight = 1)
     {
         // CRITICAL EVENT PATH
-        if (sample && _deep_sample_rate != 100) {
-            _deep_sampling_now.store((_rng() % 100U < _deep_sample_rate), std::memory_order_relaxed);
-        }
+        bool deep = _deep_sample_rate == 100 || (sample && _rng()() % 100U < _deep_sample_rate);
         std::shared_lock rlb(_base_mutex);
         bool will_shift = _num_periods > 1 && stamp.tv_sec >= _next_shift_tstamp.tv_sec;
         rlb.unlock();
@@ -300,7 +322,8 @@ protected:
         }
         std::shared_lock rl(_bucket_mutex);
         // bucket base event
-        _metric_buckets[0]->new_event(_deep_sampling_now);
+        _metric_buckets[0]->new_event(deep, stamp, weight);
+        return deep;
     }
 
     /**
@@ -313,10 +336,31 @@ protected:
     {
     }
 
+    /**
+     * call back on each bucket the manager creates after construction (the live bucket at a period shift, and the bucket
+     * a window is merged into), before it is in use, so handler settings can be passed on to it. the first live bucket
+     * is created by the constructor, so it must be set up directly.
+     *
+     * @param bucket the new bucket
+     */
+    virtual void on_new_bucket([[maybe_unused]] MetricsBucketClass &bucket) const
+    {
+    }
+
+    /**
+     * writable access to a bucket other than the live one, e.g. so that on_period_shift can report into the period
+     * which just closed (bucket 1). the bucket's own locking still applies.
+     */
+    MetricsBucketClass *writable_bucket(uint64_t period)
+    {
+        std::shared_lock rl(_bucket_mutex);
+        // bounds checked
+        return _metric_buckets.at(period).get();
+    }
+
 public:
     AbstractMetricsManager(const Configurable *window_config)
         : _metric_buckets{}
-        , _deep_sampling_now{true}
         , _last_shift_tstamp{0, 0}
         , _next_shift_tstamp{0, 0}
     {
@@ -483,6 +527,7 @@ public:
         if (_recorded_stream) {
             merged.set_recorded_stream();
         }
+        on_new_bucket(merged);
 
         auto p = period;
         for (auto &m : _metric_buckets) {
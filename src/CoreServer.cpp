@@ -3,6 +3,7 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
 #include "CoreServer.h"
+#include "GeoDB.h"
 #include "HandlerManager.h"
 #include "Metrics.h"
 #include "Policies.h"
@@ -185,6 +186,31 @@ void CoreServer::_setup_routes(const PrometheusConfig &prom_config)
             }
         });
     }
+    // Geo databases
+    _svr.Post(R"(/api/v1/geo/reload)", [&](const httplib::Request &req, httplib::Response &res) {
+        json j = json::object();
+        try {
+            // optionally switch to new files: {"city": FILE, "asn": FILE}
+            auto files = req.body.empty() ? json::object() : json::parse(req.body);
+            auto reload = [&files, &j](geo::MaxmindDB &db, const std::string &key) {
+                if (files.contains(key)) {
+                    db.enable(files[key].get<std::string>(), db.compiled());
+                } else if (db.enabled()) {
+                    db.reload();
+                } else {
+                    return;
+                }
+                db.info_json(j[key]);
+            };
+            reload(geo::GeoIP(), "city");
+            reload(geo::GeoASN(), "asn");
+            res.set_content(j.dump(), "text/json");
+        } catch (const std::exception &e) {
+            res.status = 500;
+            j["error"] = e.what();
+            res.set_content(j.dump(), "text/json");
+        }
+    });
     // Taps
     _svr.Get(R"(/api/v1/taps)", [&]([[maybe_unused]] const httplib::Request &req, httplib::Response &res) {
         json j;
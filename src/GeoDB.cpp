@@ -3,11 +3,140 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
 #include "GeoDB.h"
+#include <algorithm>
 #include <cstring>
+#include <functional>
+#include <memory>
+#include <netinet/in.h>
+#include <spdlog/spdlog.h>
 #include <stdexcept>
 
 namespace visor::geo {
 
+namespace {
+
+// direct mapped, per thread cache of lookup result ids keyed by address
+struct CacheEntry {
+    uint64_t generation{0};
+    std::array<uint8_t, 16> addr{};
+    uint32_t id{0};
+    sa_family_t family{0};
+};
+
+constexpr uint32_t CACHE_BITS = 12;
+using LookupCache = std::array<CacheEntry, 1 << CACHE_BITS>;
+
+// result ids by the offset of the data record an address resolved to
+struct RecordEntry {
+    uint64_t generation{0};
+    uint32_t offset{0};
+    uint32_t id{0};
+};
+
+constexpr uint32_t RECORD_CACHE_BITS = 14;
+using RecordCache = std::array<RecordEntry, 1 << RECORD_CACHE_BITS>;
+
+std::atomic<uint64_t> next_generation{0};
+std::atomic<uint64_t> next_instance{0};
+
+}
+
+struct MaxmindDB::Reader {
+    // held by the owning thread for the length of a lookup, and by _release_readers()
+    std::mutex mutex;
+    std::shared_ptr<const Database> db;
+    std::array<std::unique_ptr<LookupCache>, 2> caches;
+    std::array<std::unique_ptr<RecordCache>, 2> records;
+};
+
+struct MaxmindDB::Watcher {
+    // held for the length of a reload check. db is cleared under it, after which no check touches the database
+    std::mutex mutex;
+    MaxmindDB *db;
+    std::shared_ptr<timer::interval_handle> handle;
+};
+
+using namespace std::chrono_literals;
+
+StringTable::StringTable()
+{
+    intern("");
+    intern("Unknown");
+}
+
+StringTable::~StringTable()
+{
+    for (auto &chunk : _chunks) {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+}
+
+uint32_t StringTable::intern(std::string_view name)
+{
+    std::lock_guard lock(_mutex);
+    if (auto it = _ids.find(name); it != _ids.end()) {
+        return it->second;
+    }
+    if (_size == CHUNK_SIZE * MAX_CHUNKS) {
+        // full: stop distinguishing new results rather than grow without bound
+        return UNKNOWN;
+    }
+    auto &chunk = _chunks[_size >> CHUNK_BITS];
+    auto storage = chunk.load(std::memory_order_relaxed);
+    if (!storage) {
+        storage = new std::string[CHUNK_SIZE];
+        chunk.store(storage, std::memory_order_release);
+    }
+    auto &slot = storage[_size & (CHUNK_SIZE - 1)];
+    slot = name;
+    _ids.emplace(slot, _size);
+    return _size++;
+}
+
+StringTable &LookupNames()
+{
+    static StringTable names;
+    return names;
+}
+
+PrefixTable::PrefixTable()
+    : _root(1 << ROOT_BITS, 0)
+{
+}
+
+void PrefixTable::insert(const uint8_t *addr, unsigned prefix_len, uint32_t value)
+{
+    // chunk holding the current stride, or none for the root
+    constexpr uint32_t ROOT = ~0u;
+    auto entries = [this](uint32_t chunk) {
+        return (chunk == ROOT) ? _root.data() : _chunks[chunk].data();
+    };
+
+    uint32_t chunk = ROOT;
+    unsigned index = (addr[0] << 8) | addr[1];
+    unsigned stride_end = ROOT_BITS;
+    unsigned byte = 2;
+    while (prefix_len > stride_end) {
+        auto entry = entries(chunk)[index];
+        if (!(entry & CHILD)) {
+            // push the value covering this entry down into a new chunk
+            Chunk child;
+            child.fill(entry);
+            _chunks.push_back(child);
+            entry = CHILD | static_cast<uint32_t>(_chunks.size() - 1);
+            entries(chunk)[index] = entry;
+        }
+        chunk = entry & ~CHILD;
+        index = addr[byte++];
+        stride_end += 8;
+    }
+
+    // expand the prefix over every entry of this stride it covers
+    auto span = 1u << (stride_end - prefix_len);
+    auto first = entries(chunk) + (index & ~(span - 1));
+    std::fill(first, first + span, value);
+}
+
 MaxmindDB &GeoIP()
 {
     static MaxmindDB ip_db;
@@ -25,50 +154,391 @@ bool enabled()
     return (GeoIP().enabled() || GeoASN().enabled());
 }
 
-void MaxmindDB::enable(const std::string &database_filename)
+MaxmindDB::Database::~Database()
 {
-    auto status = MMDB_open(database_filename.c_str(), MMDB_MODE_MMAP, &_mmdb);
+    if (open) {
+        MMDB_close(&mmdb);
+    }
+}
+
+void MaxmindDB::enable(const std::string &database_filename, bool compiled)
+{
+    auto db = std::make_shared<Database>();
+    auto status = MMDB_open(database_filename.c_str(), MMDB_MODE_MMAP, &db->mmdb);
     if (status != MMDB_SUCCESS) {
         std::string msg = database_filename + ": " + MMDB_strerror(status);
         throw std::runtime_error(msg);
     }
-    _enabled = true;
+    db->open = true;
+    db->filename = database_filename;
+    std::error_code ec;
+    db->mtime = std::filesystem::last_write_time(database_filename, ec);
+    if (compiled) {
+        try {
+            db->tables = _compile(db->mmdb);
+        } catch (const std::exception &e) {
+            throw std::runtime_error(database_filename + ": " + e.what());
+        }
+        db->compiled = true;
+    }
+
+    std::lock_guard lock(_reload_mutex);
+    db->generation = ++next_generation;
+    auto generation = db->generation;
+    std::atomic_store(&_db, std::shared_ptr<const Database>(std::move(db)));
+    _generation.store(generation, std::memory_order_release);
+    _release_readers(generation);
 }
 
-MaxmindDB::~MaxmindDB()
+void MaxmindDB::_release_readers(uint64_t generation)
 {
-    if (_enabled) {
-        MMDB_close(&_mmdb);
+    std::lock_guard lock(_readers_mutex);
+    for (auto &weak : _readers) {
+        if (auto reader = weak.lock()) {
+            std::lock_guard r_lock(reader->mutex);
+            if (reader->db && reader->db->generation != generation) {
+                reader->db.reset();
+            }
+        }
     }
 }
 
-std::string MaxmindDB::getGeoLocString(const struct sockaddr *sa) const
+bool MaxmindDB::compiled() const
 {
+    auto db = std::atomic_load(&_db);
+    return db && db->compiled;
+}
 
-    if (!_enabled) {
-        return "";
+bool MaxmindDB::reload(bool force)
+{
+    auto db = std::atomic_load(&_db);
+    if (!db) {
+        return false;
     }
+    if (!force) {
+        std::error_code ec;
+        auto mtime = std::filesystem::last_write_time(db->filename, ec);
+        if (ec || mtime == db->mtime) {
+            // unchanged, or missing while it is being replaced
+            return false;
+        }
+    }
+    enable(db->filename, db->compiled);
+    return true;
+}
 
-    int mmdb_error;
+void MaxmindDB::watch(std::chrono::seconds interval)
+{
+    _stop_watch();
+    if (interval.count() == 0) {
+        return;
+    }
+    // its own thread, since loading a compiled database can take seconds
+    static timer timer_thread{1s};
+    auto watcher = std::make_shared<Watcher>();
+    watcher->db = this;
+    // the check may still fire once after _stop_watch(), so it only holds the watcher weakly and checks db
+    watcher->handle = timer_thread.set_interval(interval, [watcher = std::weak_ptr<Watcher>(watcher)] {
+        auto w = watcher.lock();
+        if (!w) {
+            return;
+        }
+        std::lock_guard lock(w->mutex);
+        if (!w->db) {
+            return;
+        }
+        auto logger = spdlog::get("visor");
+        try {
+            if (w->db->reload(false) && logger) {
+                logger->info("reloaded updated geo database {}", std::atomic_load(&w->db->_db)->filename);
+            }
+        } catch (const std::exception &e) {
+            // keep serving from the database already loaded
+            if (logger) {
+                logger->error("geo database reload failed: {}", e.what());
+            }
+        }
+    });
+    _watcher = std::move(watcher);
+}
 
-    MMDB_lookup_result_s lookup = MMDB_lookup_sockaddr(&_mmdb, sa, &mmdb_error);
-    if (mmdb_error != MMDB_SUCCESS || !lookup.found_entry) {
-        return "Unknown";
+void MaxmindDB::_stop_watch()
+{
+    if (!_watcher) {
+        return;
     }
+    {
+        // waits out a check already running
+        std::lock_guard lock(_watcher->mutex);
+        _watcher->db = nullptr;
+    }
+    _watcher->handle->cancel();
+    _watcher.reset();
+}
 
-    return _getGeoLocString(&lookup);
+MaxmindDB::Compiled MaxmindDB::_compile(const MMDB_s &mmdb)
+{
+    Compiled tables;
+    tables.records.push_back({StringTable::UNKNOWN, StringTable::UNKNOWN});
+    // networks sharing a data record share its index
+    std::unordered_map<uint32_t, uint32_t> record_index;
+    std::array<uint8_t, 16> addr{};
+    auto node_count = mmdb.metadata.node_count;
+
+    // the IPv4 subtree of an IPv6 database is found at ::/96
+    uint64_t ipv4_start = 0;
+    if (mmdb.metadata.ip_version == 6) {
+        for (unsigned depth = 0; depth < 96 && ipv4_start < node_count; depth++) {
+            MMDB_search_node_s node;
+            auto status = MMDB_read_node(&mmdb, static_cast<uint32_t>(ipv4_start), &node);
+            if (status != MMDB_SUCCESS) {
+                throw std::runtime_error(MMDB_strerror(status));
+            }
+            ipv4_start = node.left_record;
+        }
+    }
+
+    // whether addr, up to depth, is still on the path to the IPv4 subtree at ::/96 or to ::ffff:0:0/96, which
+    // databases alias to it. these paths are followed past the IPv6 limit, so IPv4 compatible and mapped
+    // addresses resolve through the IPv4 table
+    auto ipv4_path = [&addr](unsigned depth) {
+        if (depth > 96 || std::any_of(addr.begin(), addr.begin() + 10, [](uint8_t b) { return b != 0; })
+            || std::any_of(addr.begin() + 12, addr.end(), [](uint8_t b) { return b != 0; })) {
+            return false;
+        }
+        uint16_t mapped = (addr[10] << 8) | addr[11];
+        return mapped == 0 || (depth > 80 && mapped == static_cast<uint16_t>(0xffff << (96 - depth)));
+    };
+
+    // depth first walk of the search tree, filling table with each data record found
+    std::function<void(uint64_t, unsigned, PrefixTable &, bool)> walk = [&](uint64_t record, unsigned depth, PrefixTable &table, bool redirect_v4) {
+        if (record < node_count) {
+            if (redirect_v4 && depth && record == ipv4_start) {
+                // an alias of the IPv4 subtree: finish the lookup in the IPv4 table
+                table.insert(addr.data(), depth, PrefixTable::IPV4_AT | depth);
+                return;
+            }
+            if (redirect_v4 && depth >= MAX_COMPILED_IPV6_PREFIX && !ipv4_path(depth)) {
+                table.insert(addr.data(), depth, PrefixTable::SEARCH_TREE);
+                tables.v6_search_tree++;
+                return;
+            }
+            MMDB_search_node_s node;
+            auto status = MMDB_read_node(&mmdb, static_cast<uint32_t>(record), &node);
+            if (status != MMDB_SUCCESS) {
+                throw std::runtime_error(MMDB_strerror(status));
+            }
+            walk(node.left_record, depth + 1, table, redirect_v4);
+            addr[depth >> 3] |= (0x80 >> (depth & 7));
+            walk(node.right_record, depth + 1, table, redirect_v4);
+            addr[depth >> 3] &= ~(0x80 >> (depth & 7));
+            return;
+        }
+        if (record == node_count) {
+            // empty network, stays unknown
+            return;
+        }
+        auto offset = record - node_count - 16;
+        if (offset >= mmdb.data_section_size) {
+            throw std::runtime_error("invalid search tree record");
+        }
+        auto [it, inserted] = record_index.try_emplace(static_cast<uint32_t>(offset), static_cast<uint32_t>(tables.records.size()));
+        if (inserted) {
+            MMDB_lookup_result_s lookup{};
+            lookup.found_entry = true;
+            lookup.entry.mmdb = &mmdb;
+            lookup.entry.offset = static_cast<uint32_t>(offset);
+            tables.records.push_back({LookupNames().intern(_getGeoLocString(&lookup)), LookupNames().intern(_getASNString(&lookup))});
+        }
+        table.insert(addr.data(), depth, it->second);
+    };
+
+    if (mmdb.metadata.ip_version == 6) {
+        walk(ipv4_start, 0, tables.v4, false);
+        walk(0, 0, tables.v6, true);
+    } else {
+        walk(0, 0, tables.v4, false);
+    }
+    return tables;
+}
+
+bool MaxmindDB::_compiled_lookup(const Database &db, const struct sockaddr *sa, Lookup kind, uint32_t &id)
+{
+    uint32_t index = 0;
+    if (sa->sa_family == AF_INET) {
+        index = db.tables.v4.find(reinterpret_cast<const uint8_t *>(&reinterpret_cast<const struct sockaddr_in *>(sa)->sin_addr));
+    } else if (sa->sa_family == AF_INET6) {
+        auto addr = reinterpret_cast<const uint8_t *>(&reinterpret_cast<const struct sockaddr_in6 *>(sa)->sin6_addr);
+        index = db.tables.v6.find(addr);
+        if (index & PrefixTable::SEARCH_TREE) {
+            return false;
+        }
+        if (index & PrefixTable::IPV4_AT) {
+            // the 32 bits following the alias prefix are the embedded IPv4 address
+            auto depth = index & ~PrefixTable::IPV4_AT;
+            std::array<uint8_t, 4> v4{};
+            for (unsigned bit = 0; bit < 32 && depth + bit < 128; bit++) {
+                if (addr[(depth + bit) >> 3] & (0x80 >> ((depth + bit) & 7))) {
+                    v4[bit >> 3] |= (0x80 >> (bit & 7));
+                }
+            }
+            index = db.tables.v4.find(v4.data());
+        }
+    }
+    auto &record = db.tables.records[index];
+    id = (kind == Lookup::GeoLoc) ? record.geo_loc : record.asn;
+    return true;
+}
+
+void MaxmindDB::info_json(json &j) const
+{
+    auto db = std::atomic_load(&_db);
+    if (!db) {
+        return;
+    }
+    j["file"] = db->filename;
+    j["compiled"] = db->compiled;
+    j["generation"] = db->generation;
+    if (db->compiled) {
+        const auto &tables = db->tables;
+        j["table_bytes"] = tables.v4.memory_bytes() + tables.v6.memory_bytes() + tables.records.size() * sizeof(CompiledRecord);
+        j["ipv4_table_bytes"] = tables.v4.memory_bytes();
+        j["ipv6_table_bytes"] = tables.v6.memory_bytes();
+        j["records"] = tables.records.size();
+        j["ipv6_max_prefix"] = MAX_COMPILED_IPV6_PREFIX;
+        j["ipv6_search_tree_prefixes"] = tables.v6_search_tree;
+    }
+}
+
+MaxmindDB::MaxmindDB()
+    : _instance(++next_instance)
+{
+}
+
+MaxmindDB::~MaxmindDB()
+{
+    _stop_watch();
+    // let a reload already under way finish
+    std::lock_guard lock(_reload_mutex);
+    // threads may outlive this object, their readers must not keep the database open
+    _release_readers(0);
+}
+
+uint32_t MaxmindDB::_cached_lookup(const struct sockaddr *sa, Lookup kind) const
+{
+    // per thread and database, the snapshot last looked up through and caches of its results. holding a
+    // reference here saves taking the shared_ptr lock of _db on every lookup. enable() drops references to
+    // the snapshot it replaces, so a thread that stops looking up does not keep it alive.
+    thread_local std::vector<std::pair<uint64_t, std::shared_ptr<Reader>>> readers;
+
+    auto current = _generation.load(std::memory_order_acquire);
+    if (!current) {
+        return StringTable::EMPTY;
+    }
+
+    auto it = std::find_if(readers.begin(), readers.end(), [this](const auto &r) { return r.first == _instance; });
+    if (it == readers.end()) {
+        auto reader = std::make_shared<Reader>();
+        {
+            std::lock_guard lock(_readers_mutex);
+            _readers.erase(std::remove_if(_readers.begin(), _readers.end(), [](const auto &weak) { return weak.expired(); }), _readers.end());
+            _readers.push_back(reader);
+        }
+        // readers of destroyed databases are never looked up again
+        readers.erase(std::remove_if(readers.begin(), readers.end(), [](const auto &r) {
+            std::lock_guard r_lock(r.second->mutex);
+            return !r.second->db;
+        }),
+            readers.end());
+        it = readers.emplace(readers.end(), _instance, std::move(reader));
+    }
+    auto &state = *it->second;
+    std::lock_guard lock(state.mutex);
+
+    if (!state.db || state.db->generation != current) {
+        state.db = std::atomic_load(&_db);
+        if (!state.db) {
+            return StringTable::EMPTY;
+        }
+    }
+    const auto &db = *state.db;
+
+    if (db.compiled) {
+        // already as cheap as a cache hit, unless the network is too long for the tables
+        uint32_t id;
+        if (_compiled_lookup(db, sa, kind, id)) {
+            return id;
+        }
+    }
+
+    auto &cache = state.caches[static_cast<size_t>(kind)];
+    if (!cache) {
+        cache = std::make_unique<LookupCache>();
+    }
+
+    std::array<uint8_t, 16> addr{};
+    size_t slot;
+    if (sa->sa_family == AF_INET) {
+        uint32_t a = reinterpret_cast<const struct sockaddr_in *>(sa)->sin_addr.s_addr;
+        std::memcpy(addr.data(), &a, sizeof(a));
+        slot = (a * 0x9E3779B1u) >> (32 - CACHE_BITS);
+    } else if (sa->sa_family == AF_INET6) {
+        std::memcpy(addr.data(), &reinterpret_cast<const struct sockaddr_in6 *>(sa)->sin6_addr, addr.size());
+        uint64_t hi, lo;
+        std::memcpy(&hi, addr.data(), sizeof(hi));
+        std::memcpy(&lo, addr.data() + sizeof(hi), sizeof(lo));
+        slot = ((hi ^ lo) * 0x9E3779B97F4A7C15ull) >> (64 - CACHE_BITS);
+    } else {
+        return StringTable::UNKNOWN;
+    }
+
+    auto &entry = (*cache)[slot];
+    if (entry.generation == db.generation && entry.family == sa->sa_family && entry.addr == addr) {
+        return entry.id;
+    }
+
+    int mmdb_error;
+    uint32_t id = StringTable::UNKNOWN;
+    MMDB_lookup_result_s lookup = MMDB_lookup_sockaddr(&db.mmdb, sa, &mmdb_error);
+    if (mmdb_error == MMDB_SUCCESS && lookup.found_entry) {
+        // many networks share a data record, so only the first sighting of a record on this thread builds the result
+        // string and takes the lock of LookupNames(), even when addresses miss the cache above
+        auto &records = state.records[static_cast<size_t>(kind)];
+        if (!records) {
+            records = std::make_unique<RecordCache>();
+        }
+        auto offset = lookup.entry.offset;
+        auto &record = (*records)[(offset * 0x9E3779B1u) >> (32 - RECORD_CACHE_BITS)];
+        if (record.generation != db.generation || record.offset != offset) {
+            record = RecordEntry{db.generation, offset, LookupNames().intern(kind == Lookup::GeoLoc ? _getGeoLocString(&lookup) : _getASNString(&lookup))};
+        }
+        id = record.id;
+    }
+    entry = CacheEntry{db.generation, addr, id, sa->sa_family};
+    return id;
+}
+
+uint32_t MaxmindDB::getGeoLocId(const struct sockaddr *sa) const
+{
+    return _cached_lookup(sa, Lookup::GeoLoc);
+}
+
+std::string MaxmindDB::getGeoLocString(const struct sockaddr *sa) const
+{
+    return LookupNames().name(getGeoLocId(sa));
 }
 
 std::string MaxmindDB::getGeoLocString(const char *ip_address) const
 {
 
-    if (!_enabled) {
+    auto db = std::atomic_load(&_db);
+    if (!db) {
         return "";
     }
 
     int gai_error, mmdb_error;
 
-    MMDB_lookup_result_s lookup = MMDB_lookup_string(&_mmdb, ip_address, &gai_error, &mmdb_error);
+    MMDB_lookup_result_s lookup = MMDB_lookup_string(&db->mmdb, ip_address, &gai_error, &mmdb_error);
     if (0 != gai_error || MMDB_SUCCESS != mmdb_error || !lookup.found_entry) {
         return "Unknown";
     }
@@ -76,7 +546,7 @@ std::string MaxmindDB::getGeoLocString(const char *ip_address) const
     return _getGeoLocString(&lookup);
 }
 
-std::string MaxmindDB::_getGeoLocString(MMDB_lookup_result_s *lookup) const
+std::string MaxmindDB::_getGeoLocString(MMDB_lookup_result_s *lookup)
 {
 
     std::string geoString;
@@ -127,33 +597,27 @@ std::string MaxmindDB::_getGeoLocString(MMDB_lookup_result_s *lookup) const
     return geoString;
 }
 
-std::string MaxmindDB::getASNString(const struct sockaddr *sa) const
+uint32_t MaxmindDB::getASNId(const struct sockaddr *sa) const
 {
+    return _cached_lookup(sa, Lookup::ASN);
+}
 
-    if (!_enabled) {
-        return "";
-    }
-
-    int mmdb_error;
-
-    MMDB_lookup_result_s lookup = MMDB_lookup_sockaddr(&_mmdb, sa, &mmdb_error);
-    if (mmdb_error != MMDB_SUCCESS || !lookup.found_entry) {
-        return "Unknown";
-    }
-
-    return _getASNString(&lookup);
+std::string MaxmindDB::getASNString(const struct sockaddr *sa) const
+{
+    return LookupNames().name(getASNId(sa));
 }
 
 std::string MaxmindDB::getASNString(const char *ip_address) const
 {
 
-    if (!_enabled) {
+    auto db = std::atomic_load(&_db);
+    if (!db) {
         return "";
     }
 
     int gai_error, mmdb_error;
 
-    MMDB_lookup_result_s lookup = MMDB_lookup_string(&_mmdb, ip_address, &gai_error, &mmdb_error);
+    MMDB_lookup_result_s lookup = MMDB_lookup_string(&db->mmdb, ip_address, &gai_error, &mmdb_error);
     if (0 != gai_error || MMDB_SUCCESS != mmdb_error || !lookup.found_entry) {
         return "Unknown";
     }
@@ -161,7 +625,7 @@ std::string MaxmindDB::getASNString(const char *ip_address) const
     return _getASNString(&lookup);
 }
 
-std::string MaxmindDB::_getASNString(MMDB_lookup_result_s *lookup) const
+std::string MaxmindDB::_getASNString(MMDB_lookup_result_s *lookup)
 {
 
     std::string geoString;
@@ -8,20 +8,131 @@
 #pragma GCC diagnostic ignored "-Wpedantic"
 #include <maxminddb.h>
 #pragma GCC diagnostic pop
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
 #include <string>
+#include <string_view>
+#include <timer.hpp>
+#include <unordered_map>
+#include <vector>
 
 namespace visor::geo {
 
+using json = nlohmann::json;
+
+/*
+ * Process wide, append only table of lookup result strings. An id stays valid for the life of the process,
+ * so ids can be cached and stored in place of the strings they name. Reading a name takes no lock.
+ */
+class StringTable
+{
+    static constexpr uint32_t CHUNK_BITS = 12;
+    static constexpr uint32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    static constexpr uint32_t MAX_CHUNKS = 1024;
+
+    std::array<std::atomic<std::string *>, MAX_CHUNKS> _chunks{};
+    // views into the chunk storage, which never moves
+    std::unordered_map<std::string_view, uint32_t> _ids;
+    uint32_t _size{0};
+    std::mutex _mutex;
+
+public:
+    // ids reserved for the results of a disabled database and a failed lookup
+    static constexpr uint32_t EMPTY = 0;
+    static constexpr uint32_t UNKNOWN = 1;
+
+    StringTable();
+    ~StringTable();
+
+    uint32_t intern(std::string_view name);
+
+    const std::string &name(uint32_t id) const
+    {
+        return _chunks[id >> CHUNK_BITS].load(std::memory_order_acquire)[id & (CHUNK_SIZE - 1)];
+    }
+};
+
+StringTable &LookupNames();
+
+/*
+ * Multibit trie flattened from an MMDB search tree: a 16 bit root stride followed by 8 bit strides,
+ * so an IPv4 lookup touches at most three entries. An entry holds a value, a child chunk, or (IPv6 only)
+ * a redirect into the IPv4 table for networks the database aliases to its IPv4 subtree, or a marker for
+ * networks longer than the table holds, which are looked up in the search tree instead.
+ */
+class PrefixTable
+{
+public:
+    static constexpr uint32_t CHILD = 1u << 31;
+    static constexpr uint32_t IPV4_AT = 1u << 30;
+    static constexpr uint32_t SEARCH_TREE = 1u << 29;
+
+    PrefixTable();
+
+    void insert(const uint8_t *addr, unsigned prefix_len, uint32_t value);
+
+    uint32_t find(const uint8_t *addr) const
+    {
+        auto entry = _root[(addr[0] << 8) | addr[1]];
+        for (unsigned byte = 2; entry & CHILD; byte++) {
+            entry = _chunks[entry & ~CHILD][addr[byte]];
+        }
+        return entry;
+    }
+
+    size_t memory_bytes() const
+    {
+        return _root.size() * sizeof(uint32_t) + _chunks.size() * sizeof(Chunk);
+    }
+
+private:
+    static constexpr unsigned ROOT_BITS = 16;
+    using Chunk = std::array<uint32_t, 256>;
+
+    std::vector<uint32_t> _root;
+    std::vector<Chunk> _chunks;
+};
+
 class MaxmindDB
 {
 public:
+    MaxmindDB();
     ~MaxmindDB();
 
-    void enable(const std::string &database_filename);
+    /*
+     * Opens the database, replacing any database already open. Results cached from the previous
+     * database are invalidated. In compiled mode the networks in the database are flattened into
+     * in memory prefix tables at load time, trading startup time and memory for faster lookups.
+     * IPv6 networks longer than MAX_COMPILED_IPV6_PREFIX are still looked up in the search tree.
+     *
+     * Safe to call while other threads look up: the new database is fully loaded before it is
+     * swapped in. The previous database is freed as soon as no lookup is running through it.
+     */
+    void enable(const std::string &database_filename, bool compiled = false);
     bool enabled() const
     {
-        return _enabled;
+        return _generation.load(std::memory_order_relaxed) != 0;
     }
+    bool compiled() const;
+
+    /*
+     * Reopens the current database file in the same mode. Unless forced, nothing is done when the file
+     * is unchanged since it was opened. Returns whether a new database was swapped in.
+     */
+    bool reload(bool force = true);
+
+    /*
+     * Checks the database file for changes every interval, reloading it in the background when it does.
+     * A zero interval stops watching.
+     */
+    void watch(std::chrono::seconds interval);
+
+    void info_json(json &j) const;
 
     /*
      * These routines accept both IPv4 and IPv6
@@ -32,12 +143,77 @@ public:
     std::string getASNString(const char *ip_address) const;
     std::string getASNString(const struct sockaddr *sa) const;
 
+    /*
+     * As the sockaddr routines above, but return the id of the result in LookupNames(),
+     * which is cheaper to count and compare than the string itself
+     */
+    uint32_t getGeoLocId(const struct sockaddr *sa) const;
+    uint32_t getASNId(const struct sockaddr *sa) const;
+
 private:
-    mutable MMDB_s _mmdb;
-    bool _enabled = false;
+    enum class Lookup {
+        GeoLoc,
+        ASN
+    };
+
+    // lookup results for one data record of a compiled database
+    struct CompiledRecord {
+        uint32_t geo_loc;
+        uint32_t asn;
+    };
+
+    // IPv6 networks longer than this are left to the search tree: every 8 bits past the root stride
+    // costs a 1KB chunk per distinct prefix, and the IPv6 data of real databases is too sparse to pay for it
+    static constexpr unsigned MAX_COMPILED_IPV6_PREFIX = 48;
+
+    // prefix tables map to an index into records, record 0 standing for no result
+    struct Compiled {
+        PrefixTable v4;
+        PrefixTable v6;
+        std::vector<CompiledRecord> records;
+        // IPv6 prefixes marked PrefixTable::SEARCH_TREE
+        size_t v6_search_tree{0};
+    };
+
+    // one opened database, never modified once published
+    struct Database {
+        MMDB_s mmdb;
+        bool open{false};
+        std::string filename;
+        std::filesystem::file_time_type mtime;
+        // globally unique, tags cache entries
+        uint64_t generation{0};
+        bool compiled{false};
+        Compiled tables;
+
+        ~Database();
+    };
+
+    // what one thread keeps between lookups through this database, see _cached_lookup()
+    struct Reader;
+
+    // swapped with std::atomic_load/std::atomic_store. readers keep their own reference, see _cached_lookup()
+    std::shared_ptr<const Database> _db;
+    // generation of _db, 0 while disabled
+    std::atomic<uint64_t> _generation{0};
+    std::mutex _reload_mutex;
+    // state shared with the reload check of watch(), see _stop_watch()
+    struct Watcher;
+    std::shared_ptr<Watcher> _watcher;
+    // unique for the life of the process, unlike the address of this object. keys the per thread readers
+    const uint64_t _instance;
+    mutable std::mutex _readers_mutex;
+    mutable std::vector<std::weak_ptr<Reader>> _readers;
 
-    std::string _getGeoLocString(MMDB_lookup_result_s *lookup) const;
-    std::string _getASNString(MMDB_lookup_result_s *lookup) const;
+    // cancel the reload check, waiting for one already running to finish
+    void _stop_watch();
+    // drop the references readers hold to databases other than generation
+    void _release_readers(uint64_t generation);
+    static Compiled _compile(const MMDB_s &mmdb);
+    static bool _compiled_lookup(const Database &db, const struct sockaddr *sa, Lookup kind, uint32_t &id);
+    uint32_t _cached_lookup(const struct sockaddr *sa, Lookup kind) const;
+    static std::string _getGeoLocString(MMDB_lookup_result_s *lookup);
+    static std::string _getASNString(MMDB_lookup_result_s *lookup);
 };
 
 MaxmindDB &GeoIP();
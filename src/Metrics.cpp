@@ -19,6 +19,164 @@ void Counter::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels)
     out << name_snake({}, add_labels) << ' ' << _value << std::endl;
 }
 
+void ShardedCounter::to_json(json &j) const
+{
+    name_json_assign(j, value());
+}
+
+void ShardedCounter::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels) const
+{
+    out << "# HELP " << base_name_snake() << ' ' << _desc << std::endl;
+    out << "# TYPE " << base_name_snake() << " gauge" << std::endl;
+    out << name_snake({}, add_labels) << ' ' << value() << std::endl;
+}
+
+RateTicker::RateTicker()
+    : _thread([this] { _run(); })
+{
+}
+
+RateTicker::~RateTicker()
+{
+    {
+        std::unique_lock lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+}
+
+RateTicker &RateTicker::instance()
+{
+    static RateTicker ticker;
+    return ticker;
+}
+
+void RateTicker::_run()
+{
+    auto next = steady_clock::now() + 1s;
+    std::unique_lock lock(_mutex);
+    while (!_cv.wait_until(lock, next, [this] { return _stop; })) {
+        lock.unlock();
+        tick();
+        lock.lock();
+        // keep to a one second cadence, but don't try to catch up on ticks missed by a stall
+        next += 1s;
+        auto now = steady_clock::now();
+        if (next < now) {
+            next = now + 1s;
+        }
+    }
+}
+
+void RateTicker::add(Rate *rate)
+{
+    std::unique_lock lock(_mutex);
+    if (rate->_ticking) {
+        return;
+    }
+    rate->_prev = nullptr;
+    rate->_next = _head;
+    if (_head) {
+        _head->_prev = rate;
+    }
+    _head = rate;
+    rate->_ticking = true;
+    ++_size;
+}
+
+void RateTicker::remove(Rate *rate)
+{
+    std::unique_lock lock(_mutex);
+    if (!rate->_ticking) {
+        return;
+    }
+    if (rate->_prev) {
+        rate->_prev->_next = rate->_next;
+    } else {
+        _head = rate->_next;
+    }
+    if (rate->_next) {
+        rate->_next->_prev = rate->_prev;
+    }
+    rate->_prev = rate->_next = nullptr;
+    rate->_ticking = false;
+    --_size;
+    rate->_flush_samples();
+}
+
+size_t RateTicker::size()
+{
+    std::unique_lock lock(_mutex);
+    return _size;
+}
+
+void RateTicker::tick()
+{
+    std::unique_lock lock(_mutex);
+    for (auto rate = _head; rate; rate = rate->_next) {
+        rate->_sample();
+    }
+}
+
+void Rate::_sample()
+{
+    auto rate = _counter.exchange(0, std::memory_order_relaxed);
+    _rate.store(rate, std::memory_order_relaxed);
+    _samples[_sample_count++] = static_cast<int_fast32_t>(rate);
+    if (_sample_count == SAMPLE_BATCH) {
+        _flush_samples();
+    }
+}
+
+void Rate::_flush_samples()
+{
+    if (!_sample_count) {
+        return;
+    }
+    // lock mutex for write
+    std::unique_lock lock(_sketch_mutex);
+    for (size_t i = 0; i < _sample_count; i++) {
+        _quantile.update(_samples[i]);
+    }
+    _sample_count = 0;
+}
+
+void Rate::_advance_bin(int64_t sec)
+{
+    std::unique_lock lock(_sketch_mutex);
+    auto bin = _bin_sec.load(std::memory_order_relaxed);
+    // another thread may have advanced while we waited
+    if (sec <= bin) {
+        return;
+    }
+    if (bin) {
+        auto rate = _counter.exchange(0, std::memory_order_relaxed);
+        _rate.store(rate, std::memory_order_relaxed);
+        _quantile.update(static_cast<int_fast32_t>(rate));
+        auto idle = std::min(static_cast<uint64_t>(sec - bin - 1), MAX_IDLE_SECONDS);
+        for (uint64_t i = 0; i < idle; i++) {
+            _quantile.update(0);
+        }
+    }
+    _bin_sec.store(sec, std::memory_order_relaxed);
+}
+
+void Rate::cancel()
+{
+    RateTicker::instance().remove(this);
+    if (_event_time.load(std::memory_order_relaxed)) {
+        // the last, partial, second still counts
+        std::unique_lock lock(_sketch_mutex);
+        if (_bin_sec.load(std::memory_order_relaxed)) {
+            _quantile.update(static_cast<int_fast32_t>(_counter.load(std::memory_order_relaxed)));
+            _bin_sec.store(0, std::memory_order_relaxed);
+        }
+    }
+    _rate.store(0, std::memory_order_relaxed);
+    _counter.store(0, std::memory_order_relaxed);
+}
+
 void Rate::to_json(json &j, bool include_live) const
 {
     to_json(j);
@@ -88,6 +246,121 @@ void Cardinality::to_prometheus(std::stringstream &out, Metric::LabelMap add_lab
     out << name_snake({}, add_labels) << ' ' << lround(_set.get_estimate()) << std::endl;
 }
 
+void KeyedCardinality::update(const std::string &key, std::string_view member, double score)
+{
+    auto it = std::find_if(_slots.begin(), _slots.end(), [&key](const slot &s) { return s.key == key; });
+    if (it == _slots.end()) {
+        if (_slots.size() >= MAX_KEYS) {
+            return;
+        }
+        it = _slots.emplace(_slots.end(), key, LG_K);
+    }
+    it->set.update(member.data(), static_cast<int>(member.size()));
+    it->score_sum += score;
+    ++it->score_n;
+}
+
+void KeyedCardinality::track(const std::vector<std::string> &keys)
+{
+    std::vector<slot> slots;
+    slots.reserve(MAX_KEYS);
+    for (const auto &key : keys) {
+        if (slots.size() == MAX_KEYS) {
+            break;
+        }
+        auto it = std::find_if(_slots.begin(), _slots.end(), [&key](const slot &s) { return s.key == key; });
+        if (it != _slots.end()) {
+            slots.push_back(std::move(*it));
+            _slots.erase(it);
+        } else {
+            slots.emplace_back(key, LG_K);
+        }
+    }
+    for (auto &s : _slots) {
+        if (slots.size() == MAX_KEYS) {
+            break;
+        }
+        if (s.score_n) {
+            slots.push_back(std::move(s));
+        }
+    }
+    _slots = std::move(slots);
+}
+
+double KeyedCardinality::estimate(const std::string &key) const
+{
+    auto it = std::find_if(_slots.begin(), _slots.end(), [&key](const slot &s) { return s.key == key; });
+    return (it == _slots.end()) ? 0.0 : it->set.get_estimate();
+}
+
+void KeyedCardinality::merge(const KeyedCardinality &other)
+{
+    for (const auto &o : other._slots) {
+        if (!o.score_n) {
+            continue;
+        }
+        auto it = std::find_if(_slots.begin(), _slots.end(), [&o](const slot &s) { return s.key == o.key; });
+        if (it == _slots.end()) {
+            _slots.push_back(o);
+            continue;
+        }
+        datasketches::cpc_union merge_set(LG_K);
+        merge_set.update(it->set);
+        merge_set.update(o.set);
+        it->set = merge_set.get_result();
+        it->score_sum += o.score_sum;
+        it->score_n += o.score_n;
+    }
+    if (_slots.size() > MAX_KEYS) {
+        // keep the keys with the most unique members
+        std::sort(_slots.begin(), _slots.end(), [](const slot &a, const slot &b) { return a.set.get_estimate() > b.set.get_estimate(); });
+        _slots.erase(_slots.begin() + MAX_KEYS, _slots.end());
+    }
+}
+
+std::vector<const KeyedCardinality::slot *> KeyedCardinality::_sorted_slots() const
+{
+    std::vector<const slot *> sorted;
+    for (const auto &s : _slots) {
+        // tracked keys which have not counted anything yet are not reported
+        if (s.score_n) {
+            sorted.push_back(&s);
+        }
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const slot *a, const slot *b) { return a->set.get_estimate() > b->set.get_estimate(); });
+    return sorted;
+}
+
+void KeyedCardinality::to_json(json &j) const
+{
+    auto section = json::array();
+    auto sorted = _sorted_slots();
+    for (uint64_t i = 0; i < sorted.size(); i++) {
+        section[i]["name"] = sorted[i]->key;
+        section[i]["estimate"] = lround(sorted[i]->set.get_estimate());
+        section[i][_score_key] = sorted[i]->score_n ? sorted[i]->score_sum / sorted[i]->score_n : 0.0;
+    }
+    name_json_assign(j, section);
+}
+
+void KeyedCardinality::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels) const
+{
+    LabelMap l(add_labels);
+    auto sorted = _sorted_slots();
+    out << "# HELP " << base_name_snake() << ' ' << _desc << std::endl;
+    out << "# TYPE " << base_name_snake() << " gauge" << std::endl;
+    for (const auto s : sorted) {
+        l[_item_key] = s->key;
+        out << name_snake({}, l) << ' ' << lround(s->set.get_estimate()) << std::endl;
+    }
+    out << "# HELP " << base_name_snake() << '_' << _score_key << ' ' << _desc << " (mean " << _score_key << ')' << std::endl;
+    out << "# TYPE " << base_name_snake() << '_' << _score_key << " gauge" << std::endl;
+    for (const auto s : sorted) {
+        l[_item_key] = s->key;
+        out << name_snake({_score_key}, l) << ' ' << (s->score_n ? s->score_sum / s->score_n : 0.0) << std::endl;
+    }
+}
+
 // static storage for base labels
 Metric::LabelMap Metric::_static_labels;
 
@@ -3,9 +3,9 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
 #pragma once
+#include <arpa/inet.h>
 #include <nlohmann/json.hpp>
 #include <sstream>
-#include <timer.hpp>
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wold-style-cast"
 #pragma GCC diagnostic ignored "-Wunused-function"
@@ -15,9 +15,18 @@
 #include <frequent_items_sketch.hpp>
 #include <kll_sketch.hpp>
 #pragma GCC diagnostic pop
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
 #include <regex>
 #include <shared_mutex>
+#include <thread>
 #include <vector>
 
 namespace visor {
@@ -128,6 +137,79 @@ public:
     void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
 };
 
+/**
+ * A Counter metric class which may be updated from several threads without a lock. Each thread increments its own
+ * cache line sized shard with relaxed atomics; the shards are only summed when the value is read, merged or rendered.
+ * Renders exactly as Counter.
+ */
+class ShardedCounter final : public Metric
+{
+public:
+    static constexpr size_t SHARDS = 16;
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+private:
+    struct alignas(CACHE_LINE_SIZE) shard {
+        std::atomic_uint64_t value{0};
+    };
+    std::array<shard, SHARDS> _shards;
+
+    // threads are assigned shards round robin on first use, so up to SHARDS threads never share a cache line
+    static size_t _shard_index()
+    {
+        static std::atomic_size_t next_index{0};
+        thread_local size_t index = next_index.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return index;
+    }
+
+public:
+    ShardedCounter(std::string schema_key, std::initializer_list<std::string> names, std::string desc)
+        : Metric(schema_key, names, std::move(desc))
+    {
+    }
+
+    // copies are a snapshot of the current value
+    ShardedCounter(const ShardedCounter &other)
+        : Metric(other)
+    {
+        _shards[0].value.store(other.value(), std::memory_order_relaxed);
+    }
+
+    ShardedCounter &operator++()
+    {
+        _shards[_shard_index()].value.fetch_add(1, std::memory_order_relaxed);
+        return *this;
+    }
+
+    void operator+=(uint64_t i)
+    {
+        _shards[_shard_index()].value.fetch_add(i, std::memory_order_relaxed);
+    }
+
+    void operator+=(const ShardedCounter &other)
+    {
+        *this += other.value();
+    }
+
+    void merge(const ShardedCounter &other)
+    {
+        *this += other.value();
+    }
+
+    [[nodiscard]] uint64_t value() const
+    {
+        uint64_t sum{0};
+        for (const auto &s : _shards) {
+            sum += s.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    // Metric
+    void to_json(json &j) const override;
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
+};
+
 /**
  * A Quantile metric class which knows how to render its output into p50, p90, p95, p99
  *
@@ -211,6 +293,73 @@ public:
     }
 };
 
+/**
+ * An IPv6 address held by value, so it can be a sketch item without being formatted to text first
+ */
+struct IPv6Key {
+    std::array<uint8_t, 16> bytes;
+
+    IPv6Key() = default;
+    explicit IPv6Key(const uint8_t *addr)
+    {
+        std::memcpy(bytes.data(), addr, bytes.size());
+    }
+
+    // keep only the leading prefix_len bits, e.g. to aggregate addresses by /48
+    IPv6Key(const uint8_t *addr, uint8_t prefix_len)
+        : bytes{}
+    {
+        prefix_len = std::min<uint8_t>(prefix_len, 128);
+        std::memcpy(bytes.data(), addr, prefix_len / 8);
+        if (prefix_len % 8) {
+            bytes[prefix_len / 8] = addr[prefix_len / 8] & static_cast<uint8_t>(0xFF << (8 - prefix_len % 8));
+        }
+    }
+
+    bool operator==(const IPv6Key &other) const
+    {
+        return bytes == other.bytes;
+    }
+
+    std::string to_string() const
+    {
+        char text[INET6_ADDRSTRLEN];
+        return inet_ntop(AF_INET6, bytes.data(), text, sizeof(text)) ? text : std::string();
+    }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const IPv6Key &key)
+{
+    return out << key.to_string();
+}
+
+inline void to_json(json &j, const IPv6Key &key)
+{
+    j = key.to_string();
+}
+
+}
+
+namespace std {
+template <>
+struct hash<visor::IPv6Key> {
+    size_t operator()(const visor::IPv6Key &key) const noexcept
+    {
+        uint64_t hi, lo;
+        std::memcpy(&hi, key.bytes.data(), sizeof(hi));
+        std::memcpy(&lo, key.bytes.data() + sizeof(hi), sizeof(lo));
+        // fold the halves, then mix so that addresses differing only in the host bits spread out
+        uint64_t h = hi * 0x9E3779B97F4A7C15ull ^ lo;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        return static_cast<size_t>(h);
+    }
+};
+}
+
+namespace visor {
+
 /**
  * A Frequent Item metric class which knows how to render its output into a table of top N
  *
@@ -254,11 +403,32 @@ public:
         _fi.update(value);
     }
 
+    void update(const T &value, uint64_t weight)
+    {
+        _fi.update(value, weight);
+    }
+
     void merge(const TopN &other)
     {
         _fi.merge(other._fi);
     }
 
+    uint64_t get_estimate(const T &value) const
+    {
+        return _fi.get_estimate(value);
+    }
+
+    // the (up to) count heaviest items, heaviest first
+    std::vector<T> top_items(size_t count) const
+    {
+        std::vector<T> top;
+        auto items = _fi.get_frequent_items(datasketches::frequent_items_error_type::NO_FALSE_NEGATIVES);
+        for (uint64_t i = 0; i < std::min(count, items.size()); i++) {
+            top.push_back(items[i].get_item());
+        }
+        return top;
+    }
+
     /**
      * to_json which takes a formater to format the "name"
      * @param j json object
@@ -314,6 +484,122 @@ public:
     }
 };
 
+/**
+ * An exact frequency metric class for small integer domains (e.g. result codes), which knows how to render
+ * its output into a table in the same format as TopN. Values below N are counted in a fixed array, anything
+ * larger falls back to a (normally empty) map. Unlike TopN the full distribution is rendered.
+ *
+ * NOTE: intentionally _not_ thread safe; it should be protected by a mutex
+ */
+template <typename T, size_t N>
+class DenseCounter final : public Metric
+{
+    static_assert(std::is_unsigned_v<T>, "DenseCounter requires an unsigned integer type");
+
+    std::array<uint64_t, N> _counts{};
+    std::map<T, uint64_t> _overflow;
+    std::string _item_key;
+
+    // non zero entries, highest count first
+    std::vector<std::pair<T, uint64_t>> _sorted_items() const
+    {
+        std::vector<std::pair<T, uint64_t>> items;
+        for (size_t i = 0; i < N; i++) {
+            if (_counts[i]) {
+                items.emplace_back(static_cast<T>(i), _counts[i]);
+            }
+        }
+        for (const auto &[value, count] : _overflow) {
+            items.emplace_back(value, count);
+        }
+        std::stable_sort(items.begin(), items.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+        return items;
+    }
+
+public:
+    DenseCounter(std::string schema_key, std::string item_key, std::initializer_list<std::string> names, std::string desc)
+        : Metric(schema_key, names, std::move(desc))
+        , _item_key(item_key)
+    {
+    }
+
+    void update(T value)
+    {
+        if (value < N) {
+            ++_counts[value];
+        } else {
+            ++_overflow[value];
+        }
+    }
+
+    void update(T value, uint64_t weight)
+    {
+        if (value < N) {
+            _counts[value] += weight;
+        } else {
+            _overflow[value] += weight;
+        }
+    }
+
+    uint64_t count(T value) const
+    {
+        if (value < N) {
+            return _counts[value];
+        }
+        auto it = _overflow.find(value);
+        return (it == _overflow.end()) ? 0 : it->second;
+    }
+
+    void merge(const DenseCounter &other)
+    {
+        for (size_t i = 0; i < N; i++) {
+            _counts[i] += other._counts[i];
+        }
+        for (const auto &[value, count] : other._overflow) {
+            _overflow[value] += count;
+        }
+    }
+
+    /**
+     * to_json which takes a formater to format the "name"
+     * @param j json object
+     * @param formatter std::function which takes a T as input and returns a std::string
+     */
+    void to_json(json &j, std::function<std::string(const T &)> formatter) const
+    {
+        auto section = json::array();
+        auto items = _sorted_items();
+        for (uint64_t i = 0; i < items.size(); i++) {
+            section[i]["name"] = formatter(items[i].first);
+            section[i]["estimate"] = items[i].second;
+        }
+        name_json_assign(j, section);
+    }
+
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels, std::function<std::string(const T &)> formatter) const
+    {
+        LabelMap l(add_labels);
+        auto items = _sorted_items();
+        out << "# HELP " << base_name_snake() << ' ' << _desc << std::endl;
+        out << "# TYPE " << base_name_snake() << " gauge" << std::endl;
+        for (const auto &[value, count] : items) {
+            l[_item_key] = formatter(value);
+            out << name_snake({}, l) << ' ' << count << std::endl;
+        }
+    }
+
+    // Metric
+    void to_json(json &j) const override
+    {
+        to_json(j, [](const T &val) { return std::to_string(val); });
+    }
+
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override
+    {
+        to_prometheus(out, add_labels, [](const T &val) { return std::to_string(val); });
+    }
+};
+
 /**
  * A Cardinality metric class which knows how to render its output
  *
@@ -354,32 +640,148 @@ public:
 };
 
 /**
- * A Rate metric class which knows how to render its output. Note that this is only useful for "live" rates,
- * that is, calculating rates in real time and not from pre recorded streams
+ * A per key Cardinality metric class (e.g. unique subdomains per zone) which knows how to render its output.
+ * Sketches are only kept for MAX_KEYS keys, each with a fixed lg_k, so total memory is bounded no matter how many
+ * keys are seen. The owner chooses the tracked keys with track() (e.g. the current top keys of a TopN); slots they
+ * leave free go to the first other keys seen. Each key also keeps a running mean of a score given on update.
+ *
+ * NOTE: intentionally _not_ thread safe; it should be protected by a mutex
+ */
+class KeyedCardinality final : public Metric
+{
+public:
+    static constexpr size_t MAX_KEYS = 10;
+    static constexpr uint8_t LG_K = 10; // ~0.6KB per sketch, ~2.5% error
+
+private:
+    struct slot {
+        std::string key;
+        datasketches::cpc_sketch set;
+        double score_sum{0.0};
+        uint64_t score_n{0};
+
+        slot(std::string key, uint8_t lg_k)
+            : key(std::move(key))
+            , set(lg_k)
+        {
+        }
+    };
+
+    std::vector<slot> _slots;
+    std::string _item_key;
+    std::string _score_key;
+
+    // tracked keys, highest cardinality first
+    std::vector<const slot *> _sorted_slots() const;
+
+public:
+    KeyedCardinality(std::string schema_key, std::string item_key, std::string score_key, std::initializer_list<std::string> names, std::string desc)
+        : Metric(schema_key, names, std::move(desc))
+        , _item_key(std::move(item_key))
+        , _score_key(std::move(score_key))
+    {
+        _slots.reserve(MAX_KEYS);
+    }
+
+    /**
+     * count a member under a key, if the key is tracked or a slot is free
+     * @param key the key
+     * @param member the value to count distinct occurrences of
+     * @param score folded into the running mean score of the key
+     */
+    void update(const std::string &key, std::string_view member, double score);
+
+    /**
+     * track the given keys ahead of any others, up to MAX_KEYS. slots of other keys are kept while there is room,
+     * those which have not counted anything yet are dropped
+     */
+    void track(const std::vector<std::string> &keys);
+
+    double estimate(const std::string &key) const;
+
+    void merge(const KeyedCardinality &other);
+
+    // Metric
+    void to_json(json &j) const override;
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
+};
+
+class Rate;
+
+/**
+ * Samples every live Rate once per second from a single thread. Rates link themselves into an intrusive list when
+ * constructed and unlink when cancelled, so a tick is one pass over the live rates no matter how many buckets have
+ * come and gone, and creating or retiring a Rate does not schedule or cancel any timer job.
+ *
+ * NOTE: this class _is_ thread safe
+ */
+class RateTicker final
+{
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    Rate *_head{nullptr};
+    size_t _size{0};
+    bool _stop{false};
+    std::thread _thread;
+
+    void _run();
+
+public:
+    RateTicker();
+    ~RateTicker();
+
+    // the ticker shared by all rates
+    static RateTicker &instance();
+
+    void add(Rate *rate);
+    void remove(Rate *rate);
+    size_t size();
+
+    // sample all live rates once. normally only called from the ticker thread, once per second
+    void tick();
+};
+
+/**
+ * A Rate metric class which knows how to render its output.
+ *
+ * By default rates are "live", calculated in real time: the per second rates are sampled by RateTicker and added to
+ * the quantile sketch SAMPLE_BATCH at a time, so the quantiles of a live rate may trail by up to SAMPLE_BATCH - 1
+ * seconds; cancel() adds any remaining samples.
+ *
+ * For pre recorded streams, which are usually processed faster than real time, set_event_time() switches to binning
+ * events into per second counts by the time stamp passed to update(), without any involvement of the ticker.
  *
  * NOTE: this class _is_ thread safe, it _does not_ need an additional mutex
  */
 class Rate final : public Metric
 {
+public:
+    static constexpr size_t SAMPLE_BATCH = 4;
+    // in event time, seconds without any events count as zero rates up to this gap between events
+    static constexpr uint64_t MAX_IDLE_SECONDS = 3600;
+
+private:
+    friend class RateTicker;
+
     std::atomic_uint64_t _counter;
     std::atomic_uint64_t _rate;
     mutable std::shared_mutex _sketch_mutex;
     datasketches::kll_sketch<int_fast32_t> _quantile;
 
-    std::shared_ptr<timer::interval_handle> _timer_handle;
+    // owned by RateTicker, protected by its mutex
+    Rate *_prev{nullptr};
+    Rate *_next{nullptr};
+    bool _ticking{false};
+    std::array<int_fast32_t, SAMPLE_BATCH> _samples{};
+    size_t _sample_count{0};
 
-    void _start_timer()
-    {
-        // all rates use a single static timer object which holds its own thread
-        // the tick argument determines the granularity of job running and canceling
-        static timer timer_thread{100ms};
-        _timer_handle = timer_thread.set_interval(1s, [this] {
-            _rate.store(_counter.exchange(0));
-            // lock mutex for write
-            std::unique_lock lock(_sketch_mutex);
-            _quantile.update(_rate);
-        });
-    }
+    // event time mode: the second currently being counted, 0 until the first event
+    std::atomic_bool _event_time{false};
+    std::atomic<int64_t> _bin_sec{0};
+
+    void _sample();
+    void _flush_samples();
+    void _advance_bin(int64_t sec);
 
 public:
     Rate(std::string schema_key, std::initializer_list<std::string> names, std::string desc)
@@ -388,12 +790,12 @@ public:
         , _rate(0)
         , _quantile()
     {
-        _start_timer();
+        RateTicker::instance().add(this);
     }
 
     ~Rate()
     {
-        _timer_handle->cancel();
+        RateTicker::instance().remove(this);
     }
 
     /**
@@ -401,11 +803,32 @@ public:
      * does not affect the quantiles - in effect, it makes the rate read only
      * must be thread safe
      */
-    void cancel()
+    void cancel();
+
+    /**
+     * switch to event time: rates are computed from the time stamps passed to update() instead of the ticker.
+     * must be called before any events are counted
+     */
+    void set_event_time()
     {
-        _timer_handle->cancel();
-        _rate.store(0, std::memory_order_relaxed);
-        _counter.store(0, std::memory_order_relaxed);
+        RateTicker::instance().remove(this);
+        _event_time.store(true, std::memory_order_relaxed);
+    }
+
+    bool event_time() const
+    {
+        return _event_time.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * count events which happened at stamp. stamp is only used in event time, otherwise this is the same as +=
+     */
+    void update(const timespec &stamp, uint64_t i = 1)
+    {
+        if (_event_time.load(std::memory_order_relaxed) && stamp.tv_sec > _bin_sec.load(std::memory_order_relaxed)) {
+            _advance_bin(stamp.tv_sec);
+        }
+        _counter.fetch_add(i, std::memory_order_relaxed);
     }
 
     Rate &operator++()
@@ -414,6 +837,12 @@ public:
         return *this;
     }
 
+    Rate &operator+=(uint64_t i)
+    {
+        _counter.fetch_add(i, std::memory_order_relaxed);
+        return *this;
+    }
+
     uint64_t rate() const
     {
         return _rate.load(std::memory_order_relaxed);
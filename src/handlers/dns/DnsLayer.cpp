@@ -27,6 +27,13 @@ DnsLayer::DnsLayer(uint8_t *data, size_t dataLen, Layer *prevLayer, pcpp::Packet
 
 }
 
+DnsLayer::DnsLayer(const uint8_t *data, size_t dataLen)
+	// parsing never writes to the layer data
+	: DnsLayer(const_cast<uint8_t *>(data), dataLen, nullptr, nullptr)
+{
+	m_BorrowedData = true;
+}
+
 DnsLayer::DnsLayer()
 {
 	const size_t headerLen = sizeof(dnshdr);
@@ -58,6 +65,13 @@ DnsLayer::DnsLayer(const DnsLayer& other) : Layer(other)
 
 DnsLayer& DnsLayer::operator=(const DnsLayer& other)
 {
+	// borrowed data is not ours to free, Layer::operator= allocates a copy we do own
+	if (m_BorrowedData)
+	{
+		m_Data = NULL;
+		m_BorrowedData = false;
+	}
+
 	Layer::operator=(other);
 
 	IDnsResource* curResource = m_ResourceList;
@@ -87,6 +101,10 @@ DnsLayer::~DnsLayer()
 		delete curResource;
 		curResource = nextResource;
 	}
+
+	// keep Layer from freeing data it does not own
+	if (m_BorrowedData)
+		m_Data = NULL;
 }
 
 bool DnsLayer::extendLayer(int offsetInLayer, size_t numOfBytesToExtend, IDnsResource* resource)
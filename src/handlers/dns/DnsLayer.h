@@ -121,6 +121,14 @@ struct dnshdr {
 		 */
 		DnsLayer(uint8_t* data, size_t dataLen, pcpp::Layer* prevLayer, pcpp::Packet* packet);
 
+		/**
+		 * A constructor that creates a read only layer over data owned by the caller (e.g. a dnstap payload), without
+		 * copying it. The data must outlive the layer and the layer must not be edited
+		 * @param[in] data A pointer to the raw data
+		 * @param[in] dataLen Size of the data in bytes
+		 */
+		DnsLayer(const uint8_t* data, size_t dataLen);
+
 		/**
 		 * A constructor that creates an empty DNS layer: all members of dnshdr are set to 0 and layer will contain no records
 		 */
@@ -447,6 +455,7 @@ struct dnshdr {
                 static inline bool isDnsPort(uint16_t port);
 
             private:
+                bool m_BorrowedData{false};
                 bool m_ResourcesParsed{false};
                 bool m_ResourcesParseResult{false};
                 IDnsResource *m_ResourceList;
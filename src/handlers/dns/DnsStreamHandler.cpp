@@ -20,6 +20,11 @@
 
 namespace visor::handler::dns {
 
+static inline uint64_t xact_time_us(const DnsTransaction &xact)
+{
+    return ((xact.totalTS.tv_sec * 1'000'000'000L) + xact.totalTS.tv_nsec) / 1'000; // nanoseconds to microseconds
+}
+
 DnsStreamHandler::DnsStreamHandler(const std::string &name, InputStream *stream, const Configurable *window_config, StreamHandler *handler)
     : visor::StreamMetricsHandler<DnsMetricsManager>(name, window_config)
 {
@@ -32,7 +37,8 @@ DnsStreamHandler::DnsStreamHandler(const std::string &name, InputStream *stream,
     _pcap_stream = dynamic_cast<PcapInputStream *>(stream);
     _mock_stream = dynamic_cast<MockInputStream *>(stream);
     _dnstap_stream = dynamic_cast<DnstapInputStream *>(stream);
-    if (!_pcap_stream && !_mock_stream && !_dnstap_stream) {
+    _sflow_stream = dynamic_cast<SflowInputStream *>(stream);
+    if (!_pcap_stream && !_mock_stream && !_dnstap_stream && !_sflow_stream) {
         throw StreamHandlerException(fmt::format("DnsStreamHandler: unsupported input stream {}", stream->name()));
     }
 }
@@ -85,6 +91,14 @@ void DnsStreamHandler::start()
         }
     }
 
+    if (config_exists("zones")) {
+        try {
+            _metrics->set_zones(std::make_shared<const ZoneTrie>(config_get<StringList>("zones")));
+        } catch (const std::invalid_argument &e) {
+            throw ConfigException(fmt::format("zones error {}", e.what()));
+        }
+    }
+
     if (config_exists("recorded_stream")) {
         _metrics->set_recorded_stream();
     }
@@ -98,6 +112,10 @@ void DnsStreamHandler::start()
         _tcp_message_connection = _pcap_stream->tcp_message_ready_signal.connect(&DnsStreamHandler::tcp_message_ready_cb, this);
     } else if (_dnstap_stream) {
         _dnstap_connection = _dnstap_stream->dnstap_signal.connect(&DnsStreamHandler::process_dnstap_cb, this);
+    } else if (_sflow_stream) {
+        // DNS messages come from the sampled packet headers of flow samples
+        _sflow_stream->require_decode(this, DECODE_FLOW_SAMPLES);
+        _sflow_connection = _sflow_stream->sflow_connect(&DnsStreamHandler::process_sflow_cb, this);
     }
 
     _running = true;
@@ -118,6 +136,9 @@ void DnsStreamHandler::stop()
         _tcp_message_connection.disconnect();
     } else if (_dnstap_stream) {
         _dnstap_connection.disconnect();
+    } else if (_sflow_stream) {
+        _sflow_stream->sflow_disconnect(_sflow_connection);
+        _sflow_stream->release_decode(this);
     }
 
     _running = false;
@@ -135,6 +156,48 @@ void DnsStreamHandler::process_dnstap_cb(const dnstap::Dnstap &d)
     }
 }
 
+// callback from input module
+void DnsStreamHandler::process_sflow_cb(const SFSample &payload)
+{
+    timespec stamp;
+    // sflow carries no packet time stamps, use now()
+    std::timespec_get(&stamp, TIME_UTC);
+
+    for (const auto &sample : payload.elements) {
+        switch (sample.sampleType) {
+        case SFLFLOW_SAMPLE:
+        case SFLFLOW_SAMPLE_EXPANDED:
+            break;
+        default:
+            continue;
+        }
+        // only sampled headers which decoded down to a UDP payload carry a DNS message
+        if ((!sample.gotIPV4 && !sample.gotIPV6) || sample.dcd_ipProtocol != IP_PROTOCOL::UDP || !sample.offsetToPayload) {
+            continue;
+        }
+        uint16_t metric_port{0};
+        if (DnsLayer::isDnsPort(sample.dcd_dport)) {
+            metric_port = sample.dcd_sport;
+        } else if (DnsLayer::isDnsPort(sample.dcd_sport)) {
+            metric_port = sample.dcd_dport;
+        }
+        if (!metric_port || sample.headerLen < sample.offsetToPayload + sizeof(dnshdr)) {
+            continue;
+        }
+
+        // the header is usually truncated (128 bytes by default), so the message may be cut short. DnsLayer borrows
+        // the bytes, which are valid for the duration of the signal
+        DnsLayer dnsLayer(sample.header + sample.offsetToPayload, sample.headerLen - sample.offsetToPayload);
+        size_t wire_size = (sample.udp_pduLen > sizeof(myudphdr)) ? sample.udp_pduLen - sizeof(myudphdr) : 0;
+        auto l3 = sample.gotIPV4 ? pcpp::IPv4 : pcpp::IPv6;
+        // each flow sample stands for meanSkipCount (the sampling rate) packets, whether filtered or not
+        uint64_t weight = sample.meanSkipCount ? sample.meanSkipCount : 1;
+        if (!_filtering(dnsLayer, PacketDirection::unknown, l3, pcpp::UDP, metric_port, stamp, weight)) {
+            _metrics->process_sflow_dns(dnsLayer, l3, metric_port, weight, wire_size, stamp);
+        }
+    }
+}
+
 // callback from input module
 void DnsStreamHandler::process_udp_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, uint32_t flowkey, timespec stamp)
 {
@@ -154,7 +217,13 @@ void DnsStreamHandler::process_udp_packet_cb(pcpp::Packet &payload, PacketDirect
     if (metric_port) {
         DnsLayer dnsLayer(udpLayer, &payload);
         if (!_filtering(dnsLayer, dir, l3, pcpp::UDP, metric_port, stamp)) {
-            _metrics->process_dns_layer(dnsLayer, dir, l3, pcpp::UDP, flowkey, metric_port, stamp);
+            pcpp::IPAddress dst;
+            if (l3 == pcpp::IPv4) {
+                dst = payload.getLayerOfType<pcpp::IPv4Layer>()->getDstIPAddress();
+            } else if (l3 == pcpp::IPv6) {
+                dst = payload.getLayerOfType<pcpp::IPv6Layer>()->getDstIPAddress();
+            }
+            _metrics->process_dns_layer(dnsLayer, dir, l3, pcpp::UDP, flowkey, metric_port, dst, stamp);
             // signal for chained stream handlers, if we have any
             udp_signal(payload, dir, l3, flowkey, stamp);
         }
@@ -227,14 +296,13 @@ void DnsStreamHandler::tcp_message_ready_cb(int8_t side, const pcpp::TcpStreamDa
     // for tcp, endTime is updated by pcpp to represent the time stamp from the latest packet in the stream
     TIMEVAL_TO_TIMESPEC(&tcpData.getConnectionData().endTime, &stamp);
     auto dir = (side == 0) ? PacketDirection::fromHost : PacketDirection::toHost;
+    auto dst = (side == 0) ? tcpData.getConnectionData().dstIP : tcpData.getConnectionData().srcIP;
 
-    auto got_dns_message = [this, port, dir, l3Type, flowKey, stamp](std::unique_ptr<uint8_t[]> data, size_t size) {
-        // this dummy packet prevents DnsLayer from owning and trying to free the data. it is otherwise unused by the DNS layer,
-        // instead using the packet meta data we pass in
-        pcpp::Packet dummy_packet;
-        DnsLayer dnsLayer(data.get(), size, nullptr, &dummy_packet);
+    auto got_dns_message = [this, port, dir, l3Type, flowKey, dst, stamp](std::unique_ptr<uint8_t[]> data, size_t size) {
+        // DnsLayer borrows the data, it does not own or free it
+        DnsLayer dnsLayer(data.get(), size);
         if (!_filtering(dnsLayer, dir, l3Type, pcpp::UDP, port, stamp)) {
-            _metrics->process_dns_layer(dnsLayer, dir, l3Type, pcpp::TCP, flowKey, port, stamp);
+            _metrics->process_dns_layer(dnsLayer, dir, l3Type, pcpp::TCP, flowKey, port, dst, stamp);
         }
         // data is freed upon return
     };
@@ -295,7 +363,7 @@ static inline bool endsWith(std::string_view str, std::string_view suffix)
 {
     return str.size() >= suffix.size() && 0 == str.compare(str.size() - suffix.size(), suffix.size(), suffix);
 }
-bool DnsStreamHandler::_filtering(DnsLayer &payload, [[maybe_unused]] PacketDirection dir, [[maybe_unused]] pcpp::ProtocolType l3, [[maybe_unused]] pcpp::ProtocolType l4, [[maybe_unused]] uint16_t port, timespec stamp)
+bool DnsStreamHandler::_filtering(DnsLayer &payload, [[maybe_unused]] PacketDirection dir, [[maybe_unused]] pcpp::ProtocolType l3, [[maybe_unused]] pcpp::ProtocolType l4, [[maybe_unused]] uint16_t port, timespec stamp, uint64_t weight)
 {
     if (_f_enabled[Filters::ExcludingRCode] && payload.getDnsHeader()->responseCode == _f_rcode) {
         goto will_filter;
@@ -322,7 +390,7 @@ bool DnsStreamHandler::_filtering(DnsLayer &payload, [[maybe_unused]] PacketDire
 will_not_filter:
     return false;
 will_filter:
-    _metrics->process_filtered(stamp);
+    _metrics->process_filtered(stamp, weight);
     return true;
 }
 
@@ -331,9 +399,376 @@ void DnsMetricsBucket::specialized_merge(const AbstractMetricsBucket &o)
     // static because caller guarantees only our own bucket type
     const auto &other = static_cast<const DnsMetricsBucket &>(o);
 
+    other._fold_shards();
+    _fold_shards();
+
     std::shared_lock r_lock(other._mutex);
     std::unique_lock w_lock(_mutex);
 
+    _published.merge(other._published);
+}
+
+void DnsMetricsBucket::_fold_shards() const
+{
+    std::unique_lock f_lock(_fold_mutex);
+    // a live bucket keeps an empty spare per used shard, allocated here on the reading thread, so writers never
+    // allocate after a scrape. a read only bucket is not written to anymore, so its shards are released
+    bool live = !read_only();
+    for (auto &s : _shards) {
+        std::unique_ptr<metrics> folded;
+        {
+            std::unique_lock lock(s.mutex);
+            if (s.dirty) {
+                folded = std::move(s.data);
+                s.data = std::move(s.spare);
+                s.dirty = false;
+            }
+            if (!live) {
+                s.data.reset();
+                s.spare.reset();
+            }
+        }
+        if (folded) {
+            std::unique_lock w_lock(_mutex);
+            _published.merge(*folded);
+        }
+        if (live && folded) {
+            s.spare = std::make_unique<metrics>();
+        }
+    }
+    std::vector<std::string> top;
+    {
+        std::shared_lock r_lock(_mutex);
+        top = _published._dns_topQname2.top_items(KeyedCardinality::MAX_KEYS);
+    }
+    // zones carried over from the previous period stay until this period has enough of its own
+    if (_subdomain_zones) {
+        for (const auto &zone : *_subdomain_zones) {
+            if (top.size() == KeyedCardinality::MAX_KEYS) {
+                break;
+            }
+            if (std::find(top.begin(), top.end(), zone) == top.end()) {
+                top.push_back(zone);
+            }
+        }
+    }
+    auto zones = std::make_shared<const std::vector<std::string>>(std::move(top));
+    if (live) {
+        _track_subdomain_zones(std::move(zones));
+    } else {
+        _subdomain_zones = std::move(zones);
+    }
+}
+
+void DnsMetricsBucket::_track_subdomain_zones(std::shared_ptr<const std::vector<std::string>> zones) const
+{
+    _subdomain_zones = std::move(zones);
+    for (auto &s : _shards) {
+        if (s.spare) {
+            s.spare->_dns_qname2SubdomainCard.track(*_subdomain_zones);
+        }
+        std::unique_lock lock(s.mutex);
+        s.subdomain_zones = _subdomain_zones;
+        if (s.data) {
+            s.data->_dns_qname2SubdomainCard.track(*_subdomain_zones);
+        }
+    }
+}
+
+IPv6Key ServerTiming::key(const pcpp::IPAddress &server)
+{
+    if (server.getType() == pcpp::IPAddress::IPv6AddressType) {
+        return IPv6Key(server.getIPv6().toBytes());
+    }
+    std::array<uint8_t, 16> mapped{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    // network byte order
+    uint32_t addr = server.getIPv4().toInt();
+    std::memcpy(mapped.data() + 12, &addr, sizeof(addr));
+    return IPv6Key(mapped.data());
+}
+
+std::string ServerTiming::_name(const IPv6Key &server)
+{
+    static const std::array<uint8_t, 12> v4_mapped{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (std::equal(v4_mapped.begin(), v4_mapped.end(), server.bytes.begin())) {
+        char text[INET_ADDRSTRLEN];
+        return inet_ntop(AF_INET, server.bytes.data() + 12, text, sizeof(text)) ? text : std::string();
+    }
+    return server.to_string();
+}
+
+ServerTiming::timing &ServerTiming::_timing(const IPv6Key &server)
+{
+    auto it = std::find_if(_servers.begin(), _servers.end(), [&server](const auto &s) { return s.first == server; });
+    if (it != _servers.end()) {
+        return it->second;
+    }
+    if (_servers.size() < MAX_SERVERS) {
+        return _servers.emplace_back(server, timing{}).second;
+    }
+    // take over the quietest tracked server once this one has been seen more often
+    _candidates.update(server);
+    auto quietest = std::min_element(_servers.begin(), _servers.end(), [](const auto &a, const auto &b) { return a.second.total < b.second.total; });
+    if (_candidates.get_estimate(server) > quietest->second.total) {
+        _other.merge(quietest->second);
+        *quietest = {server, timing{}};
+        return quietest->second;
+    }
+    return _other;
+}
+
+void ServerTiming::update(const IPv6Key &server, uint64_t time_us)
+{
+    auto &t = _timing(server);
+    ++t.total;
+    t.time_us.update(time_us);
+}
+
+void ServerTiming::timed_out(const IPv6Key &server)
+{
+    ++_timing(server).timed_out;
+}
+
+void ServerTiming::merge(const ServerTiming &other)
+{
+    for (const auto &[server, t] : other._servers) {
+        auto it = std::find_if(_servers.begin(), _servers.end(), [&server = server](const auto &s) { return s.first == server; });
+        if (it != _servers.end()) {
+            it->second.merge(t);
+        } else {
+            _servers.emplace_back(server, t);
+        }
+    }
+    _other.merge(other._other);
+    _candidates.merge(other._candidates);
+    if (_servers.size() > MAX_SERVERS) {
+        std::sort(_servers.begin(), _servers.end(), [](const auto &a, const auto &b) { return a.second.total > b.second.total; });
+        for (auto it = _servers.begin() + MAX_SERVERS; it != _servers.end(); ++it) {
+            _other.merge(it->second);
+        }
+        _servers.erase(_servers.begin() + MAX_SERVERS, _servers.end());
+    }
+}
+
+void ServerTiming::_timing_json(json &j, const std::string &name, const timing &t) const
+{
+    const double fractions[4]{0.50, 0.90, 0.95, 0.99};
+    j["name"] = name;
+    j["total"] = t.total;
+    j["timed_out"] = t.timed_out;
+    auto quantiles = t.time_us.get_quantiles(fractions, 4);
+    if (quantiles.size()) {
+        j["quantiles_us"]["p50"] = quantiles[0];
+        j["quantiles_us"]["p90"] = quantiles[1];
+        j["quantiles_us"]["p95"] = quantiles[2];
+        j["quantiles_us"]["p99"] = quantiles[3];
+    }
+}
+
+void ServerTiming::to_json(json &j) const
+{
+    std::vector<const std::pair<IPv6Key, timing> *> sorted;
+    for (const auto &s : _servers) {
+        sorted.push_back(&s);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const auto *a, const auto *b) { return a->second.total > b->second.total; });
+    auto section = json::array();
+    for (const auto *s : sorted) {
+        json entry;
+        _timing_json(entry, _name(s->first), s->second);
+        section.push_back(entry);
+    }
+    if (_other.total || _other.timed_out) {
+        json entry;
+        _timing_json(entry, "other", _other);
+        section.push_back(entry);
+    }
+    name_json_assign(j, section);
+}
+
+void ServerTiming::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels) const
+{
+    const double fractions[4]{0.50, 0.90, 0.95, 0.99};
+    const char *fraction_labels[4]{"0.5", "0.9", "0.95", "0.99"};
+
+    std::vector<std::pair<std::string, const timing *>> all;
+    for (const auto &[server, t] : _servers) {
+        all.emplace_back(_name(server), &t);
+    }
+    if (_other.total || _other.timed_out) {
+        all.emplace_back("other", &_other);
+    }
+
+    out << "# HELP " << base_name_snake() << "_quantiles_us " << _desc << std::endl;
+    out << "# TYPE " << base_name_snake() << "_quantiles_us summary" << std::endl;
+    for (const auto &[server, t] : all) {
+        auto quantiles = t->time_us.get_quantiles(fractions, 4);
+        if (!quantiles.size()) {
+            continue;
+        }
+        LabelMap l(add_labels);
+        l["server"] = server;
+        for (size_t i = 0; i < 4; i++) {
+            LabelMap lq(l);
+            lq["quantile"] = fraction_labels[i];
+            out << name_snake({"quantiles_us"}, lq) << ' ' << quantiles[i] << std::endl;
+        }
+        out << name_snake({"quantiles_us", "count"}, l) << ' ' << t->time_us.get_n() << std::endl;
+    }
+    out << "# HELP " << base_name_snake() << "_timed_out " << _desc << " (timed out)" << std::endl;
+    out << "# TYPE " << base_name_snake() << "_timed_out gauge" << std::endl;
+    for (const auto &[server, t] : all) {
+        LabelMap l(add_labels);
+        l["server"] = server;
+        out << name_snake({"timed_out"}, l) << ' ' << t->timed_out << std::endl;
+    }
+}
+
+void ZoneCounters::zone::merge(const zone &other)
+{
+    queries += other.queries;
+    replies += other.replies;
+    for (size_t i = 0; i < rcodes.size(); i++) {
+        rcodes[i] += other.rcodes[i];
+    }
+    if (other.xact_us) {
+        if (xact_us) {
+            xact_us->merge(*other.xact_us);
+        } else {
+            xact_us = other.xact_us;
+        }
+    }
+}
+
+void ZoneCounters::update(const std::shared_ptr<const ZoneTrie> &zones, uint32_t zone_id, bool is_response, uint8_t rcode, uint64_t weight)
+{
+    if (!_zones) {
+        _zones = zones;
+    }
+    auto &z = _counts[zone_id];
+    if (is_response) {
+        z.replies += weight;
+        z.rcodes[rcode & 0x0F] += weight;
+    } else {
+        z.queries += weight;
+    }
+}
+
+void ZoneCounters::update_xact(const std::shared_ptr<const ZoneTrie> &zones, uint32_t zone_id, uint64_t time_us)
+{
+    if (!_zones) {
+        _zones = zones;
+    }
+    auto &z = _counts[zone_id];
+    if (!z.xact_us) {
+        z.xact_us.emplace(XACT_SKETCH_K);
+    }
+    z.xact_us->update(time_us);
+}
+
+void ZoneCounters::merge(const ZoneCounters &other)
+{
+    if (!_zones) {
+        _zones = other._zones;
+    }
+    for (const auto &[id, z] : other._counts) {
+        _counts[id].merge(z);
+    }
+}
+
+static std::string rcode_name(uint16_t rcode)
+{
+    auto it = RCodeNames.find(rcode);
+    return (it != RCodeNames.end()) ? it->second : std::to_string(rcode);
+}
+
+void ZoneCounters::to_json(json &j) const
+{
+    if (_counts.empty()) {
+        return;
+    }
+    const double fractions[4]{0.50, 0.90, 0.95, 0.99};
+    json section;
+    for (const auto &[id, z] : _counts) {
+        auto &entry = section[_zones->name(id)];
+        entry["queries"] = z.queries;
+        entry["replies"] = z.replies;
+        entry["rcode"] = json::object();
+        for (uint16_t rcode = 0; rcode < z.rcodes.size(); rcode++) {
+            if (z.rcodes[rcode]) {
+                entry["rcode"][rcode_name(rcode)] = z.rcodes[rcode];
+            }
+        }
+        if (z.xact_us) {
+            auto quantiles = z.xact_us->get_quantiles(fractions, 4);
+            if (quantiles.size()) {
+                entry["xact"]["quantiles_us"]["p50"] = quantiles[0];
+                entry["xact"]["quantiles_us"]["p90"] = quantiles[1];
+                entry["xact"]["quantiles_us"]["p95"] = quantiles[2];
+                entry["xact"]["quantiles_us"]["p99"] = quantiles[3];
+            }
+        }
+    }
+    name_json_assign(j, section);
+}
+
+void ZoneCounters::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels) const
+{
+    if (_counts.empty()) {
+        return;
+    }
+    const double fractions[4]{0.50, 0.90, 0.95, 0.99};
+    const char *fraction_labels[4]{"0.5", "0.9", "0.95", "0.99"};
+
+    out << "# HELP " << base_name_snake() << "_queries " << _desc << " (queries)" << std::endl;
+    out << "# TYPE " << base_name_snake() << "_queries gauge" << std::endl;
+    for (const auto &[id, z] : _counts) {
+        LabelMap l(add_labels);
+        l["zone"] = _zones->name(id);
+        out << name_snake({"queries"}, l) << ' ' << z.queries << std::endl;
+    }
+    out << "# HELP " << base_name_snake() << "_replies " << _desc << " (replies)" << std::endl;
+    out << "# TYPE " << base_name_snake() << "_replies gauge" << std::endl;
+    for (const auto &[id, z] : _counts) {
+        LabelMap l(add_labels);
+        l["zone"] = _zones->name(id);
+        out << name_snake({"replies"}, l) << ' ' << z.replies << std::endl;
+    }
+    out << "# HELP " << base_name_snake() << "_rcode " << _desc << " (result codes)" << std::endl;
+    out << "# TYPE " << base_name_snake() << "_rcode gauge" << std::endl;
+    for (const auto &[id, z] : _counts) {
+        LabelMap l(add_labels);
+        l["zone"] = _zones->name(id);
+        for (uint16_t rcode = 0; rcode < z.rcodes.size(); rcode++) {
+            if (z.rcodes[rcode]) {
+                l["rcode"] = rcode_name(rcode);
+                out << name_snake({"rcode"}, l) << ' ' << z.rcodes[rcode] << std::endl;
+            }
+        }
+    }
+    out << "# HELP " << base_name_snake() << "_xact_quantiles_us " << _desc << " (transaction timing)" << std::endl;
+    out << "# TYPE " << base_name_snake() << "_xact_quantiles_us summary" << std::endl;
+    for (const auto &[id, z] : _counts) {
+        if (!z.xact_us) {
+            continue;
+        }
+        auto quantiles = z.xact_us->get_quantiles(fractions, 4);
+        if (!quantiles.size()) {
+            continue;
+        }
+        LabelMap l(add_labels);
+        l["zone"] = _zones->name(id);
+        for (size_t i = 0; i < 4; i++) {
+            LabelMap lq(l);
+            lq["quantile"] = fraction_labels[i];
+            out << name_snake({"xact", "quantiles_us"}, lq) << ' ' << quantiles[i] << std::endl;
+        }
+        out << name_snake({"xact", "quantiles_us", "count"}, l) << ' ' << z.xact_us->get_n() << std::endl;
+    }
+}
+
+void DnsMetricsBucket::metrics::merge(const metrics &other)
+{
     _counters.xacts_total += other._counters.xacts_total;
     _counters.xacts_in += other._counters.xacts_in;
     _counters.xacts_out += other._counters.xacts_out;
@@ -348,13 +783,18 @@ void DnsMetricsBucket::specialized_merge(const AbstractMetricsBucket &o)
     _counters.REFUSED += other._counters.REFUSED;
     _counters.SRVFAIL += other._counters.SRVFAIL;
     _counters.NOERROR += other._counters.NOERROR;
+    _counters.TC += other._counters.TC;
+    _counters.EDNS += other._counters.EDNS;
+    _counters.EDNS_DO += other._counters.EDNS_DO;
 
     _counters.filtered += other._counters.filtered;
 
     _dnsXactFromTimeUs.merge(other._dnsXactFromTimeUs);
     _dnsXactToTimeUs.merge(other._dnsXactToTimeUs);
+    _dnsResponseBytes.merge(other._dnsResponseBytes);
 
     _dns_qnameCard.merge(other._dns_qnameCard);
+    _dns_qname2SubdomainCard.merge(other._dns_qname2SubdomainCard);
 
     _dns_topQname2.merge(other._dns_topQname2);
     _dns_topQname3.merge(other._dns_topQname3);
@@ -366,6 +806,10 @@ void DnsMetricsBucket::specialized_merge(const AbstractMetricsBucket &o)
     _dns_topRCode.merge(other._dns_topRCode);
     _dns_slowXactIn.merge(other._dns_slowXactIn);
     _dns_slowXactOut.merge(other._dns_slowXactOut);
+    _dns_xactOutServers.merge(other._dns_xactOutServers);
+    _dns_zones.merge(other._dns_zones);
+    _dns_topQnameByRespBytes.merge(other._dns_topQnameByRespBytes);
+    _dns_topEdnsUDPSize.merge(other._dns_topEdnsUDPSize);
 }
 
 void DnsMetricsBucket::to_json(json &j) const
@@ -381,48 +825,60 @@ void DnsMetricsBucket::to_json(json &j) const
         num_samples->to_json(j);
     }
 
-    std::shared_lock r_lock(_mutex);
+    _fold_shards();
 
-    _counters.queries.to_json(j);
-    _counters.replies.to_json(j);
-    _counters.TCP.to_json(j);
-    _counters.UDP.to_json(j);
-    _counters.IPv4.to_json(j);
-    _counters.IPv6.to_json(j);
-    _counters.NX.to_json(j);
-    _counters.REFUSED.to_json(j);
-    _counters.SRVFAIL.to_json(j);
-    _counters.NOERROR.to_json(j);
-
-    _counters.filtered.to_json(j);
-
-    _dns_qnameCard.to_json(j);
-    _counters.xacts_total.to_json(j);
-    _counters.xacts_timed_out.to_json(j);
-
-    _counters.xacts_in.to_json(j);
-    _dns_slowXactIn.to_json(j);
-
-    _dnsXactFromTimeUs.to_json(j);
-    _dnsXactToTimeUs.to_json(j);
-
-    _counters.xacts_out.to_json(j);
-    _dns_slowXactOut.to_json(j);
-
-    _dns_topUDPPort.to_json(j, [](const uint16_t &val) { return std::to_string(val); });
-    _dns_topQname2.to_json(j);
-    _dns_topQname3.to_json(j);
-    _dns_topNX.to_json(j);
-    _dns_topREFUSED.to_json(j);
-    _dns_topSRVFAIL.to_json(j);
-    _dns_topRCode.to_json(j, [](const uint16_t &val) {
+    std::shared_lock r_lock(_mutex);
+    const auto &m = _published;
+
+    m._counters.queries.to_json(j);
+    m._counters.replies.to_json(j);
+    m._counters.TCP.to_json(j);
+    m._counters.UDP.to_json(j);
+    m._counters.IPv4.to_json(j);
+    m._counters.IPv6.to_json(j);
+    m._counters.NX.to_json(j);
+    m._counters.REFUSED.to_json(j);
+    m._counters.SRVFAIL.to_json(j);
+    m._counters.NOERROR.to_json(j);
+    m._counters.TC.to_json(j);
+    m._counters.EDNS.to_json(j);
+    m._counters.EDNS_DO.to_json(j);
+
+    m._counters.filtered.to_json(j);
+
+    m._dns_qnameCard.to_json(j);
+    m._dns_qname2SubdomainCard.to_json(j);
+    m._counters.xacts_total.to_json(j);
+    m._counters.xacts_timed_out.to_json(j);
+
+    m._counters.xacts_in.to_json(j);
+    m._dns_slowXactIn.to_json(j);
+
+    m._dnsXactFromTimeUs.to_json(j);
+    m._dnsXactToTimeUs.to_json(j);
+    m._dnsResponseBytes.to_json(j);
+
+    m._counters.xacts_out.to_json(j);
+    m._dns_slowXactOut.to_json(j);
+    m._dns_xactOutServers.to_json(j);
+    m._dns_zones.to_json(j);
+
+    m._dns_topUDPPort.to_json(j, [](const uint16_t &val) { return std::to_string(val); });
+    m._dns_topQname2.to_json(j);
+    m._dns_topQname3.to_json(j);
+    m._dns_topNX.to_json(j);
+    m._dns_topREFUSED.to_json(j);
+    m._dns_topSRVFAIL.to_json(j);
+    m._dns_topQnameByRespBytes.to_json(j);
+    m._dns_topEdnsUDPSize.to_json(j, [](const uint16_t &val) { return std::to_string(val); });
+    m._dns_topRCode.to_json(j, [](const uint16_t &val) {
         if (RCodeNames.find(val) != RCodeNames.end()) {
             return RCodeNames[val];
         } else {
             return std::to_string(val);
         }
     });
-    _dns_topQType.to_json(j, [](const uint16_t &val) {
+    m._dns_topQType.to_json(j, [](const uint16_t &val) {
         if (QTypeNames.find(val) != QTypeNames.end()) {
             return QTypeNames[val];
         } else {
@@ -432,46 +888,53 @@ void DnsMetricsBucket::to_json(json &j) const
 }
 
 // the main bucket analysis
-void DnsMetricsBucket::process_dnstap(bool deep, const dnstap::Dnstap &payload)
+void DnsMetricsBucket::process_dnstap(bool deep, float to90th, float from90th, const dnstap::Dnstap &payload, const std::shared_ptr<const ZoneTrie> &zones)
 {
-    std::unique_lock lock(_mutex);
+    auto [m, lock] = _shard_locked();
 
     if (payload.message().has_socket_family()) {
         if (payload.message().socket_family() == dnstap::INET6) {
-            ++_counters.IPv6;
+            ++m._counters.IPv6;
         } else if (payload.message().socket_family() == dnstap::INET) {
-            ++_counters.IPv4;
+            ++m._counters.IPv4;
         }
     }
 
     if (payload.message().has_socket_protocol()) {
         switch (payload.message().socket_protocol()) {
         case dnstap::UDP:
-            ++_counters.UDP;
+            ++m._counters.UDP;
             break;
         case dnstap::TCP:
-            ++_counters.TCP;
+            ++m._counters.TCP;
             break;
         case dnstap::DOT:
-            ++_counters.DOT;
+            ++m._counters.DOT;
             break;
         case dnstap::DOH:
-            ++_counters.DOH;
+            ++m._counters.DOH;
             break;
         }
     }
 
     QR side{QR::query};
+    // direction of the reply, as in new_dns_transaction: from host when the host is the server
+    PacketDirection xact_dir{PacketDirection::unknown};
     switch (payload.message().type()) {
     case dnstap::Message_Type_FORWARDER_RESPONSE:
     case dnstap::Message_Type_STUB_RESPONSE:
     case dnstap::Message_Type_TOOL_RESPONSE:
+    case dnstap::Message_Type_RESOLVER_RESPONSE:
+        side = QR::response;
+        xact_dir = PacketDirection::toHost;
+        ++m._counters.replies;
+        break;
     case dnstap::Message_Type_UPDATE_RESPONSE:
     case dnstap::Message_Type_CLIENT_RESPONSE:
     case dnstap::Message_Type_AUTH_RESPONSE:
-    case dnstap::Message_Type_RESOLVER_RESPONSE:
         side = QR::response;
-        ++_counters.replies;
+        xact_dir = PacketDirection::fromHost;
+        ++m._counters.replies;
         break;
     case dnstap::Message_Type_FORWARDER_QUERY:
     case dnstap::Message_Type_STUB_QUERY:
@@ -481,79 +944,122 @@ void DnsMetricsBucket::process_dnstap(bool deep, const dnstap::Dnstap &payload)
     case dnstap::Message_Type_AUTH_QUERY:
     case dnstap::Message_Type_RESOLVER_QUERY:
         side = QR::query;
-        ++_counters.queries;
+        ++m._counters.queries;
         break;
     }
 
     if (payload.message().has_query_port()) {
-        _dns_topUDPPort.update(payload.message().query_port());
+        m._dns_topUDPPort.update(payload.message().query_port());
     }
 
     if (payload.message().has_query_zone()) {
         // TODO decode wire name, use in top_qname
     }
 
-    if (!deep || (!payload.message().has_query_message() && !payload.message().has_response_message())) {
+    // responses which carry the query time as well give us the transaction time directly, without pair tracking
+    bool timed = side == QR::response && payload.message().has_query_time_sec() && payload.message().has_response_time_sec();
+
+    if ((!deep && !timed && !zones) || (!payload.message().has_query_message() && !payload.message().has_response_message())) {
         return;
     }
 
+    const std::string *wire{nullptr};
     if (side == QR::query && payload.message().has_query_message()) {
-        auto query = payload.message().query_message();
-        uint8_t *buf = new uint8_t[query.size()];
-        std::memcpy(buf, query.c_str(), query.size());
-        // DnsLayer takes ownership of buf
-        DnsLayer dpayload(buf, query.size(), nullptr, nullptr);
-        lock.unlock();
-        process_dns_layer(deep, dpayload, true, pcpp::UnknownProtocol, pcpp::UnknownProtocol, 0);
+        wire = &payload.message().query_message();
     } else if (side == QR::response && payload.message().has_response_message()) {
-        auto query = payload.message().response_message();
-        uint8_t *buf = new uint8_t[query.size()];
-        std::memcpy(buf, query.c_str(), query.size());
-        // DnsLayer takes ownership of buf
-        DnsLayer dpayload(buf, query.size(), nullptr, nullptr);
-        lock.unlock();
+        wire = &payload.message().response_message();
+    }
+    if (!wire || wire->size() < sizeof(dnshdr)) {
+        return;
+    }
+
+    // DnsLayer reads directly from the protobuf buffer, which outlives it
+    DnsLayer dpayload(reinterpret_cast<const uint8_t *>(wire->data()), wire->size());
+    lock.unlock();
+    if (deep) {
         process_dns_layer(deep, dpayload, true, pcpp::UnknownProtocol, pcpp::UnknownProtocol, 0);
     }
+
+    DnsTransaction xact{{static_cast<time_t>(payload.message().query_time_sec()), static_cast<long>(payload.message().query_time_nsec())}, {0, 0}};
+    if (timed) {
+        xact.totalTS.tv_sec = payload.message().response_time_sec() - payload.message().query_time_sec();
+        xact.totalTS.tv_nsec = static_cast<long>(payload.message().response_time_nsec()) - xact.queryTS.tv_nsec;
+        if (xact.totalTS.tv_nsec < 0) {
+            --xact.totalTS.tv_sec;
+            xact.totalTS.tv_nsec += 1000000000L;
+        }
+        // ignore clock skew between the two stamps
+        timed = xact.totalTS.tv_sec >= 0;
+        if (timed) {
+            new_dns_transaction(deep, to90th, from90th, dpayload, xact_dir, xact);
+        }
+    }
+
+    if (zones) {
+        auto zone = zones->match_wire(dpayload.getData(), dpayload.getDataLen());
+        if (zone != ZoneTrie::NO_ZONE) {
+            process_zone(zones, zone, deep, dpayload, timed ? &xact : nullptr);
+        }
+    }
 }
-void DnsMetricsBucket::process_dns_layer(bool deep, DnsLayer &payload, bool dnstapped, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint16_t port)
+
+void DnsMetricsBucket::process_zone(const std::shared_ptr<const ZoneTrie> &zones, uint32_t zone, bool deep, DnsLayer &payload, const DnsTransaction *xact, uint64_t weight)
+{
+    auto [m, lock] = _shard_locked();
+    auto hdr = payload.getDnsHeader();
+    m._dns_zones.update(zones, zone, hdr->queryOrResponse == QR::response, hdr->responseCode, weight);
+    if (deep && xact) {
+        m._dns_zones.update_xact(zones, zone, xact_time_us(*xact));
+    }
+}
+void DnsMetricsBucket::process_dns_layer(bool deep, DnsLayer &payload, bool dnstapped, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint16_t port, uint64_t weight, size_t wire_size)
 {
 
-    std::unique_lock lock(_mutex);
+    auto [m, lock] = _shard_locked();
 
     // if dnstapped is true, then dnstap already processeed so we skip some metrics so as not
     // to double count
 
+    // weight is the number of messages this one stands for (the sampling rate for sflow), and wire_size the message
+    // size when the payload was truncated by the capture
+    size_t msg_size = wire_size ? wire_size : payload.getDataLen();
+
     if (l3 == pcpp::IPv6) {
-        ++_counters.IPv6;
+        m._counters.IPv6 += weight;
     } else if (l3 == pcpp::IPv4) {
-        ++_counters.IPv4;
+        m._counters.IPv4 += weight;
     }
 
     if (l4 == pcpp::TCP) {
-        ++_counters.TCP;
+        m._counters.TCP += weight;
     } else if (l4 == pcpp::UDP) {
-        ++_counters.UDP;
+        m._counters.UDP += weight;
     }
 
     // only count response codes on responses (not queries)
     if (!dnstapped && payload.getDnsHeader()->queryOrResponse == QR::response) {
-        ++_counters.replies;
+        m._counters.replies += weight;
         switch (payload.getDnsHeader()->responseCode) {
         case NoError:
-            ++_counters.NOERROR;
+            m._counters.NOERROR += weight;
             break;
         case SrvFail:
-            ++_counters.SRVFAIL;
+            m._counters.SRVFAIL += weight;
             break;
         case NXDomain:
-            ++_counters.NX;
+            m._counters.NX += weight;
             break;
         case Refused:
-            ++_counters.REFUSED;
+            m._counters.REFUSED += weight;
             break;
         }
     } else if (!dnstapped) {
-        ++_counters.queries;
+        m._counters.queries += weight;
+    }
+
+    bool is_response = payload.getDnsHeader()->queryOrResponse == QR::response;
+    if (is_response && payload.getDnsHeader()->truncation) {
+        m._counters.TC += weight;
     }
 
     if (!deep) {
@@ -561,16 +1067,36 @@ void DnsMetricsBucket::process_dns_layer(bool deep, DnsLayer &payload, bool dnst
     }
 
     if (port) {
-        _dns_topUDPPort.update(port);
+        m._dns_topUDPPort.update(port, weight);
+    }
+
+    // message size and EDNS come from the wire directly, this is much cheaper than a full resource parse
+    if (is_response) {
+        m._dnsResponseBytes.update(msg_size);
+    }
+    EdnsInfo edns;
+    if (scanEdns(payload.getData(), payload.getDataLen(), edns)) {
+        m._counters.EDNS += weight;
+        if (edns.do_bit) {
+            m._counters.EDNS_DO += weight;
+        }
+        m._dns_topEdnsUDPSize.update(edns.udp_size, weight);
+    }
+    if (is_response) {
+        thread_local std::string qname;
+        if (wireQname(payload.getData(), payload.getDataLen(), qname)) {
+            m._dns_topQnameByRespBytes.update(qname, msg_size * weight);
+        }
     }
 
+    // the remaining qname metrics still use the full resource parse
     auto success = payload.parseResources(true);
     if (!success) {
         return;
     }
 
     if (payload.getDnsHeader()->queryOrResponse == response) {
-        _dns_topRCode.update(payload.getDnsHeader()->responseCode);
+        m._dns_topRCode.update(payload.getDnsHeader()->responseCode, weight);
     }
 
     auto query = payload.getFirstQuery();
@@ -580,27 +1106,34 @@ void DnsMetricsBucket::process_dns_layer(bool deep, DnsLayer &payload, bool dnst
         std::transform(name.begin(), name.end(), name.begin(),
             [](unsigned char c) { return std::tolower(c); });
 
-        _dns_qnameCard.update(name);
-        _dns_topQType.update(query->getDnsType());
+        m._dns_qnameCard.update(name);
+        m._dns_topQType.update(query->getDnsType(), weight);
 
         if (payload.getDnsHeader()->queryOrResponse == response) {
             switch (payload.getDnsHeader()->responseCode) {
             case SrvFail:
-                _dns_topSRVFAIL.update(name);
+                m._dns_topSRVFAIL.update(name, weight);
                 break;
             case NXDomain:
-                _dns_topNX.update(name);
+                m._dns_topNX.update(name, weight);
                 break;
             case Refused:
-                _dns_topREFUSED.update(name);
+                m._dns_topREFUSED.update(name, weight);
                 break;
             }
         }
 
         auto aggDomain = aggregateDomain(name);
-        _dns_topQname2.update(std::string(aggDomain.first));
+        std::string qname2(aggDomain.first);
+        m._dns_topQname2.update(qname2, weight);
+        // random subdomain (water torture) detection: unique names below each heavy zone. the shard counts under the
+        // top zones of the bucket as of the last fold
+        std::string_view subdomain(name.data(), name.size() - aggDomain.first.size());
+        if (subdomain.size()) {
+            m._dns_qname2SubdomainCard.update(qname2, subdomain, nameEntropy(subdomain));
+        }
         if (aggDomain.second.size()) {
-            _dns_topQname3.update(std::string(aggDomain.second));
+            m._dns_topQname3.update(std::string(aggDomain.second), weight);
         }
     }
 }
@@ -608,22 +1141,26 @@ void DnsMetricsBucket::process_dns_layer(bool deep, DnsLayer &payload, bool dnst
 void DnsMetricsBucket::new_dns_transaction(bool deep, float to90th, float from90th, DnsLayer &dns, PacketDirection dir, DnsTransaction xact)
 {
 
-    uint64_t xactTime = ((xact.totalTS.tv_sec * 1'000'000'000L) + xact.totalTS.tv_nsec) / 1'000; // nanoseconds to microseconds
+    uint64_t xactTime = xact_time_us(xact);
 
-    // lock for write
-    std::unique_lock lock(_mutex);
+    // lock this thread's shard for write
+    auto [m, lock] = _shard_locked();
 
-    ++_counters.xacts_total;
+    ++m._counters.xacts_total;
 
     if (dir == PacketDirection::toHost) {
-        ++_counters.xacts_out;
+        ++m._counters.xacts_out;
         if (deep) {
-            _dnsXactFromTimeUs.update(xactTime);
+            m._dnsXactFromTimeUs.update(xactTime);
+        }
+        // the server is only recorded for queries that were deep sampled, the same decision timeouts are counted under
+        if (xact.server) {
+            m._dns_xactOutServers.update(ServerTiming::key(*xact.server), xactTime);
         }
     } else if (dir == PacketDirection::fromHost) {
-        ++_counters.xacts_in;
+        ++m._counters.xacts_in;
         if (deep) {
-            _dnsXactToTimeUs.update(xactTime);
+            m._dnsXactToTimeUs.update(xactTime);
         }
     }
 
@@ -634,9 +1171,9 @@ void DnsMetricsBucket::new_dns_transaction(bool deep, float to90th, float from90
             // dir is the direction of the last packet, meaning the reply so from a transaction perspective
             // we look at it from the direction of the query, so the opposite side than we have here
             if (dir == PacketDirection::toHost && from90th > 0 && xactTime >= from90th) {
-                _dns_slowXactOut.update(name);
+                m._dns_slowXactOut.update(name);
             } else if (dir == PacketDirection::fromHost && to90th > 0 && xactTime >= to90th) {
-                _dns_slowXactIn.update(name);
+                m._dns_slowXactIn.update(name);
             }
         }
     }
@@ -652,48 +1189,60 @@ void DnsMetricsBucket::to_prometheus(std::stringstream &out, Metric::LabelMap ad
         num_samples->to_prometheus(out, add_labels);
     }
 
-    std::shared_lock r_lock(_mutex);
+    _fold_shards();
 
-    _counters.queries.to_prometheus(out, add_labels);
-    _counters.replies.to_prometheus(out, add_labels);
-    _counters.TCP.to_prometheus(out, add_labels);
-    _counters.UDP.to_prometheus(out, add_labels);
-    _counters.IPv4.to_prometheus(out, add_labels);
-    _counters.IPv6.to_prometheus(out, add_labels);
-    _counters.NX.to_prometheus(out, add_labels);
-    _counters.REFUSED.to_prometheus(out, add_labels);
-    _counters.SRVFAIL.to_prometheus(out, add_labels);
-    _counters.NOERROR.to_prometheus(out, add_labels);
-
-    _counters.filtered.to_prometheus(out, add_labels);
-
-    _dns_qnameCard.to_prometheus(out, add_labels);
-    _counters.xacts_total.to_prometheus(out, add_labels);
-    _counters.xacts_timed_out.to_prometheus(out, add_labels);
-
-    _counters.xacts_in.to_prometheus(out, add_labels);
-    _dns_slowXactIn.to_prometheus(out, add_labels);
-
-    _dnsXactFromTimeUs.to_prometheus(out, add_labels);
-    _dnsXactToTimeUs.to_prometheus(out, add_labels);
-
-    _counters.xacts_out.to_prometheus(out, add_labels);
-    _dns_slowXactOut.to_prometheus(out, add_labels);
-
-    _dns_topUDPPort.to_prometheus(out, add_labels, [](const uint16_t &val) { return std::to_string(val); });
-    _dns_topQname2.to_prometheus(out, add_labels);
-    _dns_topQname3.to_prometheus(out, add_labels);
-    _dns_topNX.to_prometheus(out, add_labels);
-    _dns_topREFUSED.to_prometheus(out, add_labels);
-    _dns_topSRVFAIL.to_prometheus(out, add_labels);
-    _dns_topRCode.to_prometheus(out, add_labels, [](const uint16_t &val) {
+    std::shared_lock r_lock(_mutex);
+    const auto &m = _published;
+
+    m._counters.queries.to_prometheus(out, add_labels);
+    m._counters.replies.to_prometheus(out, add_labels);
+    m._counters.TCP.to_prometheus(out, add_labels);
+    m._counters.UDP.to_prometheus(out, add_labels);
+    m._counters.IPv4.to_prometheus(out, add_labels);
+    m._counters.IPv6.to_prometheus(out, add_labels);
+    m._counters.NX.to_prometheus(out, add_labels);
+    m._counters.REFUSED.to_prometheus(out, add_labels);
+    m._counters.SRVFAIL.to_prometheus(out, add_labels);
+    m._counters.NOERROR.to_prometheus(out, add_labels);
+    m._counters.TC.to_prometheus(out, add_labels);
+    m._counters.EDNS.to_prometheus(out, add_labels);
+    m._counters.EDNS_DO.to_prometheus(out, add_labels);
+
+    m._counters.filtered.to_prometheus(out, add_labels);
+
+    m._dns_qnameCard.to_prometheus(out, add_labels);
+    m._dns_qname2SubdomainCard.to_prometheus(out, add_labels);
+    m._counters.xacts_total.to_prometheus(out, add_labels);
+    m._counters.xacts_timed_out.to_prometheus(out, add_labels);
+
+    m._counters.xacts_in.to_prometheus(out, add_labels);
+    m._dns_slowXactIn.to_prometheus(out, add_labels);
+
+    m._dnsXactFromTimeUs.to_prometheus(out, add_labels);
+    m._dnsXactToTimeUs.to_prometheus(out, add_labels);
+    m._dnsResponseBytes.to_prometheus(out, add_labels);
+
+    m._counters.xacts_out.to_prometheus(out, add_labels);
+    m._dns_slowXactOut.to_prometheus(out, add_labels);
+    m._dns_xactOutServers.to_prometheus(out, add_labels);
+    m._dns_zones.to_prometheus(out, add_labels);
+
+    m._dns_topUDPPort.to_prometheus(out, add_labels, [](const uint16_t &val) { return std::to_string(val); });
+    m._dns_topQname2.to_prometheus(out, add_labels);
+    m._dns_topQname3.to_prometheus(out, add_labels);
+    m._dns_topNX.to_prometheus(out, add_labels);
+    m._dns_topREFUSED.to_prometheus(out, add_labels);
+    m._dns_topSRVFAIL.to_prometheus(out, add_labels);
+    m._dns_topQnameByRespBytes.to_prometheus(out, add_labels);
+    m._dns_topEdnsUDPSize.to_prometheus(out, add_labels, [](const uint16_t &val) { return std::to_string(val); });
+    m._dns_topRCode.to_prometheus(out, add_labels, [](const uint16_t &val) {
         if (RCodeNames.find(val) != RCodeNames.end()) {
             return RCodeNames[val];
         } else {
             return std::to_string(val);
         }
     });
-    _dns_topQType.to_prometheus(out, add_labels, [](const uint16_t &val) {
+    m._dns_topQType.to_prometheus(out, add_labels, [](const uint16_t &val) {
         if (QTypeNames.find(val) != QTypeNames.end()) {
             return QTypeNames[val];
         } else {
@@ -701,34 +1250,63 @@ void DnsMetricsBucket::to_prometheus(std::stringstream &out, Metric::LabelMap ad
         }
     });
 }
-void DnsMetricsBucket::process_filtered()
+void DnsMetricsBucket::process_filtered(uint64_t weight)
 {
-    std::unique_lock lock(_mutex);
-    ++_counters.filtered;
+    auto [m, lock] = _shard_locked();
+    m._counters.filtered += weight;
 }
 
 // the general metrics manager entry point (both UDP and TCP)
-void DnsMetricsManager::process_dns_layer(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, uint16_t port, timespec stamp)
+void DnsMetricsManager::process_dns_layer(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, uint16_t port, const pcpp::IPAddress &dst, timespec stamp)
 {
     // base event
-    new_event(stamp);
+    auto deep = new_event(stamp);
     // process in the "live" bucket. this will parse the resources if we are deep sampling
-    live_bucket()->process_dns_layer(_deep_sampling_now, payload, false, l3, l4, port);
+    live_bucket()->process_dns_layer(deep, payload, false, l3, l4, port);
     // handle dns transactions (query/response pairs)
+    std::pair<bool, DnsTransaction> xact{false, {}};
     if (payload.getDnsHeader()->queryOrResponse == QR::response) {
-        auto xact = _qr_pair_manager.maybe_end_transaction(flowkey, payload.getDnsHeader()->transactionID, stamp);
+        xact = _qr_pair_manager.maybe_end_transaction(flowkey, payload.getDnsHeader()->transactionID, stamp);
         if (xact.first) {
-            live_bucket()->new_dns_transaction(_deep_sampling_now, _to90th, _from90th, payload, dir, xact.second);
+            live_bucket()->new_dns_transaction(deep, _to90th, _from90th, payload, dir, xact.second);
+        }
+    } else if (dir == PacketDirection::fromHost) {
+        // host is the client, so remember which server it asked. per server timing is deep sampled, and the query
+        // decides for both the completed transaction and its timeout
+        if (deep) {
+            _qr_pair_manager.start_transaction(flowkey, payload.getDnsHeader()->transactionID, stamp, dst);
+        } else {
+            _qr_pair_manager.start_transaction(flowkey, payload.getDnsHeader()->transactionID, stamp);
         }
     } else {
         _qr_pair_manager.start_transaction(flowkey, payload.getDnsHeader()->transactionID, stamp);
     }
+    // per zone counters, matched on the wire question so they don't need a resource parse
+    if (_zones) {
+        auto zone = _zones->match_wire(payload.getData(), payload.getDataLen());
+        if (zone != ZoneTrie::NO_ZONE) {
+            live_bucket()->process_zone(_zones, zone, deep, payload, xact.first ? &xact.second : nullptr);
+        }
+    }
+}
+void DnsMetricsManager::process_sflow_dns(DnsLayer &payload, pcpp::ProtocolType l3, uint16_t port, uint64_t weight, size_t wire_size, timespec stamp)
+{
+    // base event, counting the messages this sampled one stands for
+    auto deep = new_event(stamp, true, weight);
+    // sampled messages can't be paired into transactions, so there is no transaction tracking
+    live_bucket()->process_dns_layer(deep, payload, false, l3, pcpp::UDP, port, weight, wire_size);
+    if (_zones) {
+        auto zone = _zones->match_wire(payload.getData(), payload.getDataLen());
+        if (zone != ZoneTrie::NO_ZONE) {
+            live_bucket()->process_zone(_zones, zone, deep, payload, nullptr, weight);
+        }
+    }
 }
-void DnsMetricsManager::process_filtered(timespec stamp)
+void DnsMetricsManager::process_filtered(timespec stamp, uint64_t weight)
 {
     // base event, no sample
-    new_event(stamp, false);
-    live_bucket()->process_filtered();
+    new_event(stamp, false, weight);
+    live_bucket()->process_filtered(weight);
 }
 void DnsMetricsManager::process_dnstap(const dnstap::Dnstap &payload, bool filtered)
 {
@@ -758,11 +1336,11 @@ void DnsMetricsManager::process_dnstap(const dnstap::Dnstap &payload, bool filte
         std::timespec_get(&stamp, TIME_UTC);
     }
     // base event
-    new_event(stamp);
+    auto deep = new_event(stamp);
     // process in the "live" bucket. this will parse the resources if we are deep sampling
     if (filtered) {
         live_bucket()->process_filtered();
     }
-    live_bucket()->process_dnstap(_deep_sampling_now, payload);
+    live_bucket()->process_dnstap(deep, _to90th, _from90th, payload, _zones);
 }
 }
\ No newline at end of file
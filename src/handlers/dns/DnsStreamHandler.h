@@ -7,13 +7,19 @@
 #include "AbstractMetricsManager.h"
 #include "MockInputStream.h"
 #include "PcapInputStream.h"
+#include "SflowInputStream.h"
 #include "StreamHandler.h"
 #include "dns.h"
 #include "dnstap.pb.h"
 #include "querypairmgr.h"
 #include <Corrade/Utility/Debug.h>
+#include <array>
+#include <atomic>
 #include <bitset>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 
 namespace visor::input::dnstap {
@@ -25,28 +31,110 @@ namespace visor::handler::dns {
 using namespace visor::input::pcap;
 using namespace visor::input::dnstap;
 using namespace visor::input::mock;
+using namespace visor::input::sflow;
+
+/**
+ * Transaction timing and timeouts keyed by server address, for the MAX_SERVERS busiest servers. Everything else
+ * is folded into a single "other" entry so memory stays bounded. A server which is not tracked takes over the
+ * quietest tracked entry once it has been seen more often, and the evicted entry is folded into "other".
+ * Addresses are held by value and only formatted when rendered.
+ *
+ * The ranking is approximate when instances are merged, e.g. the per thread shards of a DNS bucket which each only
+ * see the transactions since the last scrape: a server which went to "other" in one instance stays there.
+ *
+ * NOTE: intentionally _not_ thread safe; it should be protected by a mutex
+ */
+class ServerTiming final : public Metric
+{
+public:
+    static constexpr size_t MAX_SERVERS = 10;
+    // small map for ranking untracked servers, 2^6 entries
+    static constexpr uint8_t CANDIDATE_MAP_SIZE = 6;
 
-class DnsMetricsBucket final : public visor::AbstractMetricsBucket
+private:
+    struct timing {
+        uint64_t total{0};
+        uint64_t timed_out{0};
+        datasketches::kll_sketch<uint64_t> time_us;
+
+        void merge(const timing &other)
+        {
+            total += other.total;
+            timed_out += other.timed_out;
+            time_us.merge(other.time_us);
+        }
+    };
+
+    std::vector<std::pair<IPv6Key, timing>> _servers;
+    timing _other;
+    datasketches::frequent_items_sketch<IPv6Key> _candidates;
+
+    timing &_timing(const IPv6Key &server);
+    void _timing_json(json &j, const std::string &name, const timing &t) const;
+    static std::string _name(const IPv6Key &server);
+
+public:
+    ServerTiming(std::string schema_key, std::initializer_list<std::string> names, std::string desc)
+        : Metric(schema_key, names, std::move(desc))
+        , _candidates(CANDIDATE_MAP_SIZE, CANDIDATE_MAP_SIZE)
+    {
+    }
+
+    // IPv4 servers are keyed by their IPv4 mapped IPv6 address, and rendered as IPv4
+    static IPv6Key key(const pcpp::IPAddress &server);
+
+    void update(const IPv6Key &server, uint64_t time_us);
+    void timed_out(const IPv6Key &server);
+    void merge(const ServerTiming &other);
+
+    // Metric
+    void to_json(json &j) const override;
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
+};
+
+/**
+ * Compact per zone counters for the zones of a ZoneTrie: queries, replies, result codes and (deep sampled)
+ * transaction timing. A zone's block is only allocated once it sees traffic, so quiet zones cost nothing.
+ *
+ * NOTE: intentionally _not_ thread safe; it should be protected by a mutex
+ */
+class ZoneCounters final : public Metric
 {
-protected:
-    mutable std::shared_mutex _mutex;
+public:
+    // smaller than the kll default of 200, trading some accuracy for memory across many zones
+    static constexpr uint16_t XACT_SKETCH_K = 64;
+
+private:
+    struct zone {
+        uint64_t queries{0};
+        uint64_t replies{0};
+        std::array<uint64_t, 16> rcodes{};
+        std::optional<datasketches::kll_sketch<uint64_t>> xact_us;
+
+        void merge(const zone &other);
+    };
+
+    std::shared_ptr<const ZoneTrie> _zones;
+    std::unordered_map<uint32_t, zone> _counts;
 
-    Quantile<uint64_t> _dnsXactFromTimeUs;
-    Quantile<uint64_t> _dnsXactToTimeUs;
+public:
+    ZoneCounters(std::string schema_key, std::initializer_list<std::string> names, std::string desc)
+        : Metric(schema_key, names, std::move(desc))
+    {
+    }
 
-    Cardinality _dns_qnameCard;
+    void update(const std::shared_ptr<const ZoneTrie> &zones, uint32_t zone_id, bool is_response, uint8_t rcode, uint64_t weight = 1);
+    void update_xact(const std::shared_ptr<const ZoneTrie> &zones, uint32_t zone_id, uint64_t time_us);
+    void merge(const ZoneCounters &other);
 
-    TopN<std::string> _dns_topQname2;
-    TopN<std::string> _dns_topQname3;
-    TopN<std::string> _dns_topNX;
-    TopN<std::string> _dns_topREFUSED;
-    TopN<std::string> _dns_topSRVFAIL;
-    TopN<uint16_t> _dns_topUDPPort;
-    TopN<uint16_t> _dns_topQType;
-    TopN<uint16_t> _dns_topRCode;
-    TopN<std::string> _dns_slowXactIn;
-    TopN<std::string> _dns_slowXactOut;
+    // Metric
+    void to_json(json &j) const override;
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
+};
 
+class DnsMetricsBucket final : public visor::AbstractMetricsBucket
+{
+protected:
     struct counters {
         Counter xacts_total;
         Counter xacts_in;
@@ -64,6 +152,9 @@ protected:
         Counter REFUSED;
         Counter SRVFAIL;
         Counter NOERROR;
+        Counter TC;
+        Counter EDNS;
+        Counter EDNS_DO;
         Counter filtered;
         counters()
             : xacts_total("dns", {"xact", "counts", "total"}, "Total DNS transactions (query/reply pairs)")
@@ -82,27 +173,125 @@ protected:
             , REFUSED("dns", {"wire_packets", "refused"}, "Total DNS wire packets flagged as reply with return code REFUSED (ingress and egress)")
             , SRVFAIL("dns", {"wire_packets", "srvfail"}, "Total DNS wire packets flagged as reply with return code SRVFAIL (ingress and egress)")
             , NOERROR("dns", {"wire_packets", "noerror"}, "Total DNS wire packets flagged as reply with return code NOERROR (ingress and egress)")
+            , TC("dns", {"wire_packets", "truncated"}, "Total DNS wire packets flagged as reply with the TC (truncated) bit set (ingress and egress)")
+            , EDNS("dns", {"wire_packets", "edns"}, "Total DNS wire packets carrying an EDNS OPT record (deep sampled)")
+            , EDNS_DO("dns", {"wire_packets", "edns_do"}, "Total DNS wire packets carrying an EDNS OPT record with the DO (DNSSEC OK) bit set (deep sampled)")
             , filtered("dns", {"wire_packets", "filtered"}, "Total DNS wire packets seen that did not match the configured filter(s) (if any)")
         {
         }
     };
-    counters _counters;
+
+    // all metrics of a bucket. ingest accumulates into a shard of these picked by the writing thread, which is folded
+    // into the published copy when the bucket is read or merged, so scrapes never hold up writers for a whole merge
+    struct metrics {
+        Quantile<uint64_t> _dnsXactFromTimeUs;
+        Quantile<uint64_t> _dnsXactToTimeUs;
+        Quantile<uint64_t> _dnsResponseBytes;
+
+        Cardinality _dns_qnameCard;
+        KeyedCardinality _dns_qname2SubdomainCard;
+
+        TopN<std::string> _dns_topQname2;
+        TopN<std::string> _dns_topQname3;
+        TopN<std::string> _dns_topNX;
+        TopN<std::string> _dns_topREFUSED;
+        TopN<std::string> _dns_topSRVFAIL;
+        TopN<uint16_t> _dns_topUDPPort;
+        DenseCounter<uint16_t, 256> _dns_topQType;
+        DenseCounter<uint16_t, 16> _dns_topRCode;
+        TopN<std::string> _dns_slowXactIn;
+        TopN<std::string> _dns_slowXactOut;
+        ServerTiming _dns_xactOutServers;
+        ZoneCounters _dns_zones;
+        TopN<std::string> _dns_topQnameByRespBytes;
+        TopN<uint16_t> _dns_topEdnsUDPSize;
+
+        counters _counters;
+
+        metrics()
+            : _dnsXactFromTimeUs("dns", {"xact", "out", "quantiles_us"}, "Quantiles of transaction timing (query/reply pairs) when host is client, in microseconds")
+            , _dnsXactToTimeUs("dns", {"xact", "in", "quantiles_us"}, "Quantiles of transaction timing (query/reply pairs) when host is server, in microseconds")
+            , _dnsResponseBytes("dns", {"response_bytes"}, "Quantiles of DNS reply message sizes, in bytes")
+            , _dns_qnameCard("dns", {"cardinality", "qname"}, "Cardinality of unique QNAMES, both ingress and egress")
+            , _dns_qname2SubdomainCard("dns", "qname", "entropy", {"cardinality", "top_qname2_subdomains"}, "Cardinality of unique subdomains under the top QNAMES aggregated at a depth of two labels, with mean subdomain entropy")
+            , _dns_topQname2("dns", "qname", {"top_qname2"}, "Top QNAMES, aggregated at a depth of two labels")
+            , _dns_topQname3("dns", "qname", {"top_qname3"}, "Top QNAMES, aggregated at a depth of three labels")
+            , _dns_topNX("dns", "qname", {"top_nxdomain"}, "Top QNAMES with result code NXDOMAIN")
+            , _dns_topREFUSED("dns", "qname", {"top_refused"}, "Top QNAMES with result code REFUSED")
+            , _dns_topSRVFAIL("dns", "qname", {"top_srvfail"}, "Top QNAMES with result code SRVFAIL")
+            , _dns_topUDPPort("dns", "port", {"top_udp_ports"}, "Top UDP source port on the query side of a transaction")
+            , _dns_topQType("dns", "qtype", {"top_qtype"}, "Query types, exact counts for all types seen")
+            , _dns_topRCode("dns", "rcode", {"top_rcode"}, "Result codes, exact counts for all codes seen")
+            , _dns_slowXactIn("dns", "qname", {"xact", "in", "top_slow"}, "Top QNAMES in transactions where host is the server and transaction speed is slower than p90")
+            , _dns_slowXactOut("dns", "qname", {"xact", "out", "top_slow"}, "Top QNAMES in transactions where host is the client and transaction speed is slower than p90")
+            , _dns_xactOutServers("dns", {"xact", "out", "top_servers"}, "Transaction timing (in microseconds) and timeouts per server when host is client, for the busiest servers")
+            , _dns_zones("dns", {"zones"}, "Queries, replies, result codes and transaction timing (in microseconds) per configured zone")
+            , _dns_topQnameByRespBytes("dns", "qname", {"top_qname_by_resp_bytes"}, "Top QNAMES by total reply size, in bytes")
+            , _dns_topEdnsUDPSize("dns", "udp_size", {"top_edns_udp_size"}, "Top EDNS UDP payload sizes advertised in OPT records")
+        {
+        }
+
+        void merge(const metrics &other);
+    };
+
+    static constexpr size_t SHARD_COUNT = 8;
+
+    // each shard keeps a mutex: writers take it uncontended as long as there are no more than SHARD_COUNT input
+    // threads (threads beyond that share a shard), and a fold only holds it for a pointer swap
+    struct shard {
+        std::mutex mutex;
+        // allocated on first write. a fold swaps in the empty spare, so writers never allocate after a scrape
+        std::unique_ptr<metrics> data;
+        bool dirty{false};
+        // zones to count subdomains under, for data allocated by a writer
+        std::shared_ptr<const std::vector<std::string>> subdomain_zones;
+        // only touched with _fold_mutex held
+        std::unique_ptr<metrics> spare;
+    };
+
+    mutable std::shared_mutex _mutex;
+    mutable std::mutex _fold_mutex;
+    mutable metrics _published;
+    mutable std::array<shard, SHARD_COUNT> _shards;
+    // the top qname2 zones of _published as of the last fold, which the shards count subdomains under until the next
+    // one. guarded by _fold_mutex
+    mutable std::shared_ptr<const std::vector<std::string>> _subdomain_zones;
+
+    // have the shards count subdomains under the given zones, with _fold_mutex held
+    void _track_subdomain_zones(std::shared_ptr<const std::vector<std::string>> zones) const;
+
+    // merge everything accumulated in the shards into _published, leaving them empty. once the bucket is read only the
+    // shard storage is released instead of kept for the next writes, so that retained periods hold only _published
+    void _fold_shards() const;
+
+    // the calling thread's shard, locked for write
+    auto _shard_locked()
+    {
+        static std::atomic_size_t next_slot{0};
+        thread_local size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+        auto &s = _shards[slot];
+        std::unique_lock lock(s.mutex);
+        if (!s.data) {
+            s.data = std::make_unique<metrics>();
+            if (s.subdomain_zones) {
+                s.data->_dns_qname2SubdomainCard.track(*s.subdomain_zones);
+            }
+        }
+        s.dirty = true;
+        struct retVals {
+            metrics &m;
+            std::unique_lock<std::mutex> lock;
+        };
+        return retVals{*s.data, std::move(lock)};
+    }
+
+    void on_set_read_only() override
+    {
+        _fold_shards();
+    }
 
 public:
     DnsMetricsBucket()
-        : _dnsXactFromTimeUs("dns", {"xact", "out", "quantiles_us"}, "Quantiles of transaction timing (query/reply pairs) when host is client, in microseconds")
-        , _dnsXactToTimeUs("dns", {"xact", "in", "quantiles_us"}, "Quantiles of transaction timing (query/reply pairs) when host is server, in microseconds")
-        , _dns_qnameCard("dns", {"cardinality", "qname"}, "Cardinality of unique QNAMES, both ingress and egress")
-        , _dns_topQname2("dns", "qname", {"top_qname2"}, "Top QNAMES, aggregated at a depth of two labels")
-        , _dns_topQname3("dns", "qname", {"top_qname3"}, "Top QNAMES, aggregated at a depth of three labels")
-        , _dns_topNX("dns", "qname", {"top_nxdomain"}, "Top QNAMES with result code NXDOMAIN")
-        , _dns_topREFUSED("dns", "qname", {"top_refused"}, "Top QNAMES with result code REFUSED")
-        , _dns_topSRVFAIL("dns", "qname", {"top_srvfail"}, "Top QNAMES with result code SRVFAIL")
-        , _dns_topUDPPort("dns", "port", {"top_udp_ports"}, "Top UDP source port on the query side of a transaction")
-        , _dns_topQType("dns", "qtype", {"top_qtype"}, "Top query types")
-        , _dns_topRCode("dns", "rcode", {"top_rcode"}, "Top result codes")
-        , _dns_slowXactIn("dns", "qname", {"xact", "in", "top_slow"}, "Top QNAMES in transactions where host is the server and transaction speed is slower than p90")
-        , _dns_slowXactOut("dns", "qname", {"xact", "out", "top_slow"}, "Top QNAMES in transactions where host is the client and transaction speed is slower than p90")
     {
         set_event_rate_info("dns", {"rates", "total"}, "Rate of all DNS wire packets (combined ingress and egress) per second");
         set_num_events_info("dns", {"wire_packets", "total"}, "Total DNS wire packets");
@@ -111,26 +300,46 @@ public:
 
     auto get_xact_data_locked() const
     {
+        _fold_shards();
         std::shared_lock lock(_mutex);
         struct retVals {
             const Quantile<uint64_t> &xact_to;
             const Quantile<uint64_t> &xact_from;
             std::shared_lock<std::shared_mutex> lock;
         };
-        return retVals{_dnsXactToTimeUs, _dnsXactFromTimeUs, std::move(lock)};
+        return retVals{_published._dnsXactToTimeUs, _published._dnsXactFromTimeUs, std::move(lock)};
+    }
+
+    void inc_xact_timed_out(const std::vector<DnsTransaction> &timed_out)
+    {
+        auto [m, lock] = _shard_locked();
+        m._counters.xacts_timed_out += timed_out.size();
+        for (const auto &xact : timed_out) {
+            if (xact.server) {
+                m._dns_xactOutServers.timed_out(ServerTiming::key(*xact.server));
+            }
+        }
+    }
+
+    // the zones subdomains are counted under, so that the next period can carry on with them
+    std::shared_ptr<const std::vector<std::string>> subdomain_zones() const
+    {
+        std::unique_lock f_lock(_fold_mutex);
+        return _subdomain_zones;
     }
 
-    void inc_xact_timed_out(uint64_t c)
+    void set_subdomain_zones(std::shared_ptr<const std::vector<std::string>> zones)
     {
-        std::unique_lock lock(_mutex);
-        _counters.xacts_timed_out += c;
+        std::unique_lock f_lock(_fold_mutex);
+        _track_subdomain_zones(std::move(zones));
     }
 
     // get a copy of the counters
     counters counters() const
     {
+        _fold_shards();
         std::shared_lock lock(_mutex);
-        return _counters;
+        return _published._counters;
     }
 
     // visor::AbstractMetricsBucket
@@ -138,9 +347,10 @@ public:
     void to_json(json &j) const override;
     void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
 
-    void process_filtered();
-    void process_dns_layer(bool deep, DnsLayer &payload, bool dnstapped, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint16_t port);
-    void process_dnstap(bool deep, const dnstap::Dnstap &payload);
+    void process_filtered(uint64_t weight = 1);
+    void process_dns_layer(bool deep, DnsLayer &payload, bool dnstapped, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint16_t port, uint64_t weight = 1, size_t wire_size = 0);
+    void process_dnstap(bool deep, float to90th, float from90th, const dnstap::Dnstap &payload, const std::shared_ptr<const ZoneTrie> &zones);
+    void process_zone(const std::shared_ptr<const ZoneTrie> &zones, uint32_t zone, bool deep, DnsLayer &payload, const DnsTransaction *xact, uint64_t weight = 1);
 
     void new_dns_transaction(bool deep, float to90th, float from90th, DnsLayer &dns, PacketDirection dir, DnsTransaction xact);
 };
@@ -151,6 +361,8 @@ class DnsMetricsManager final : public visor::AbstractMetricsManager<DnsMetricsB
     QueryResponsePairMgr _qr_pair_manager;
     float _to90th{0.0};
     float _from90th{0.0};
+    // set once before any packets arrive, read only after
+    std::shared_ptr<const ZoneTrie> _zones;
 
 public:
     DnsMetricsManager(const Configurable *window_config)
@@ -162,9 +374,13 @@ public:
     {
         // DNS transaction support
         auto timed_out = _qr_pair_manager.purge_old_transactions(stamp);
-        if (timed_out) {
+        if (timed_out.size()) {
             live_bucket()->inc_xact_timed_out(timed_out);
         }
+        // keep counting subdomains under the zones which were on top at the end of the last period
+        if (auto zones = bucket(1)->subdomain_zones()) {
+            live_bucket()->set_subdomain_zones(std::move(zones));
+        }
         // collect to/from 90th percentile every period shift to judge slow xacts
         auto [xact_to, xact_from, lock] = bucket(1)->get_xact_data_locked();
         if (xact_from.get_n()) {
@@ -180,9 +396,15 @@ public:
         return _qr_pair_manager.open_transaction_count();
     }
 
-    void process_filtered(timespec stamp);
-    void process_dns_layer(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, uint16_t port, timespec stamp);
+    void set_zones(std::shared_ptr<const ZoneTrie> zones)
+    {
+        _zones = std::move(zones);
+    }
+
+    void process_filtered(timespec stamp, uint64_t weight = 1);
+    void process_dns_layer(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, uint16_t port, const pcpp::IPAddress &dst, timespec stamp);
     void process_dnstap(const dnstap::Dnstap &payload, bool filtered);
+    void process_sflow_dns(DnsLayer &payload, pcpp::ProtocolType l3, uint16_t port, uint64_t weight, size_t wire_size, timespec stamp);
 };
 
 class TcpSessionData final
@@ -226,11 +448,13 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
     PcapInputStream *_pcap_stream{nullptr};
     MockInputStream *_mock_stream{nullptr};
     DnstapInputStream *_dnstap_stream{nullptr};
+    SflowInputStream *_sflow_stream{nullptr};
 
     typedef uint32_t flowKey;
     std::unordered_map<flowKey, TcpFlowData> _tcp_connections;
 
     sigslot::connection _dnstap_connection;
+    sigslot::connection _sflow_connection;
 
     sigslot::connection _pkt_udp_connection;
     sigslot::connection _start_tstamp_connection;
@@ -242,6 +466,7 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
 
     void process_udp_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, uint32_t flowkey, timespec stamp);
     void process_dnstap_cb(const dnstap::Dnstap &);
+    void process_sflow_cb(const SFSample &);
     void tcp_message_ready_cb(int8_t side, const pcpp::TcpStreamData &tcpData);
     void tcp_connection_start_cb(const pcpp::ConnectionData &connectionData);
     void tcp_connection_end_cb(const pcpp::ConnectionData &connectionData, pcpp::TcpReassembly::ConnectionEndReason reason);
@@ -271,7 +496,8 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
     std::vector<std::string> _f_qnames;
     std::bitset<DNSTAP_TYPE_SIZE> _f_dnstap_types;
 
-    bool _filtering(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint16_t port, timespec stamp);
+    // weight is the number of messages this one stands for, e.g. the sampling rate of a sampled message
+    bool _filtering(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint16_t port, timespec stamp, uint64_t weight = 1);
 
 public:
     DnsStreamHandler(const std::string &name, InputStream *stream, const Configurable *window_config, StreamHandler *handler = nullptr);
@@ -3,6 +3,10 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
 #include "dns.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
 
 namespace visor::handler::dns {
 
@@ -40,4 +44,257 @@ AggDomainResult aggregateDomain(const std::string &domain)
     return AggDomainResult(qname2, qname3);
 }
 
-}
\ No newline at end of file
+double nameEntropy(std::string_view name)
+{
+    std::array<uint16_t, 256> freq{};
+    size_t n{0};
+    for (unsigned char c : name) {
+        if (c == '.') {
+            continue;
+        }
+        ++freq[c];
+        ++n;
+    }
+    double entropy{0.0};
+    for (auto f : freq) {
+        if (f) {
+            double p = static_cast<double>(f) / n;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+static inline uint16_t read16(const uint8_t *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+// returns offset past the wire format name starting at offset, or 0 if it runs past len
+static inline size_t skipName(const uint8_t *data, size_t len, size_t offset)
+{
+    while (offset < len) {
+        uint8_t label = data[offset];
+        if (label == 0) {
+            return offset + 1;
+        } else if ((label & 0xC0) == 0xC0) {
+            // compression pointer ends the name
+            return (offset + 2 <= len) ? offset + 2 : 0;
+        }
+        offset += label + 1;
+    }
+    return 0;
+}
+
+bool wireQname(const uint8_t *data, size_t len, std::string &name)
+{
+    const size_t HEADER_SIZE = 12;
+    const size_t MAX_NAME = 255;
+    const int MAX_POINTERS = 8;
+
+    name.clear();
+    if (len < HEADER_SIZE || read16(data + 4) == 0) {
+        return false;
+    }
+
+    size_t offset = HEADER_SIZE;
+    int pointers{0};
+    while (offset < len) {
+        uint8_t label_len = data[offset];
+        if (label_len == 0) {
+            return true;
+        } else if ((label_len & 0xC0) == 0xC0) {
+            // compression pointers only point backwards, the limit guards against loops
+            if (offset + 2 > len || ++pointers > MAX_POINTERS) {
+                return false;
+            }
+            size_t target = ((label_len & 0x3F) << 8) | data[offset + 1];
+            if (target >= offset) {
+                return false;
+            }
+            offset = target;
+            continue;
+        }
+        if (label_len > 63 || offset + 1 + label_len > len || name.size() + label_len + 1 > MAX_NAME) {
+            return false;
+        }
+        if (!name.empty()) {
+            name.push_back('.');
+        }
+        for (size_t i = 0; i < label_len; i++) {
+            name.push_back(static_cast<char>(std::tolower(data[offset + 1 + i])));
+        }
+        offset += label_len + 1;
+    }
+    return false;
+}
+
+bool scanEdns(const uint8_t *data, size_t len, EdnsInfo &edns)
+{
+    const size_t HEADER_SIZE = 12;
+    const size_t RR_FIXED_SIZE = 10;
+    const uint16_t OPT_TYPE = 41;
+
+    if (len < HEADER_SIZE) {
+        return false;
+    }
+
+    uint16_t numQuestions = read16(data + 4);
+    uint32_t numRecords = read16(data + 6) + read16(data + 8);
+    uint16_t numAdditional = read16(data + 10);
+
+    // no OPT RR is possible, skip the walk entirely
+    if (numAdditional == 0) {
+        return false;
+    }
+    // same sanity limit as DnsLayer::parseResources
+    if (numQuestions + numRecords + numAdditional > 100) {
+        return false;
+    }
+
+    size_t offset = HEADER_SIZE;
+    for (uint16_t i = 0; i < numQuestions; i++) {
+        offset = skipName(data, len, offset);
+        if (!offset || offset + 4 > len) {
+            return false;
+        }
+        offset += 4;
+    }
+
+    for (uint32_t i = 0; i < numRecords; i++) {
+        offset = skipName(data, len, offset);
+        if (!offset || offset + RR_FIXED_SIZE > len) {
+            return false;
+        }
+        offset += RR_FIXED_SIZE + read16(data + offset + 8);
+    }
+
+    for (uint16_t i = 0; i < numAdditional; i++) {
+        offset = skipName(data, len, offset);
+        if (!offset || offset + RR_FIXED_SIZE > len) {
+            return false;
+        }
+        if (read16(data + offset) == OPT_TYPE) {
+            // CLASS holds the requestor's UDP payload size, TTL holds extended rcode, version and flags (DO is the high bit)
+            edns.udp_size = read16(data + offset + 2);
+            edns.do_bit = (data[offset + 6] & 0x80) != 0;
+            return true;
+        }
+        offset += RR_FIXED_SIZE + read16(data + offset + 8);
+    }
+
+    return false;
+}
+
+ZoneTrie::ZoneTrie(const std::vector<std::string> &zones)
+{
+    _names.reserve(zones.size());
+    for (const auto &zone : zones) {
+        std::string name{zone};
+        std::transform(name.begin(), name.end(), name.begin(),
+            [](unsigned char c) { return std::tolower(c); });
+        if (!name.empty() && name.back() == '.') {
+            name.pop_back();
+        }
+        if (name.size() > 253) {
+            throw std::invalid_argument("zone name too long: " + zone);
+        }
+        _names.emplace_back(std::move(name));
+    }
+
+    _nodes.emplace_back();
+    for (uint32_t id = 0; id < _names.size(); id++) {
+        std::string_view name{_names[id]};
+        uint32_t current = 0;
+        // walk labels right to left, the root zone is the empty name
+        while (!name.empty()) {
+            auto dot = name.rfind('.');
+            auto label = (dot == std::string_view::npos) ? name : name.substr(dot + 1);
+            if (label.empty() || label.size() > 63) {
+                throw std::invalid_argument("invalid zone name: " + _names[id]);
+            }
+            auto child = _nodes[current].children.find(label);
+            if (child == _nodes[current].children.end()) {
+                _nodes.emplace_back();
+                child = _nodes[current].children.emplace(label, _nodes.size() - 1).first;
+            }
+            current = child->second;
+            name = (dot == std::string_view::npos) ? std::string_view{} : name.substr(0, dot);
+        }
+        if (_nodes[current].zone != NO_ZONE) {
+            throw std::invalid_argument("duplicate zone: " + _names[id]);
+        }
+        _nodes[current].zone = id;
+    }
+}
+
+uint32_t ZoneTrie::_match(const std::vector<std::string_view> &labels) const
+{
+    uint32_t current = 0;
+    uint32_t found = _nodes[0].zone;
+    for (auto label = labels.rbegin(); label != labels.rend(); ++label) {
+        auto child = _nodes[current].children.find(*label);
+        if (child == _nodes[current].children.end()) {
+            break;
+        }
+        current = child->second;
+        if (_nodes[current].zone != NO_ZONE) {
+            found = _nodes[current].zone;
+        }
+    }
+    return found;
+}
+
+uint32_t ZoneTrie::match_wire(const uint8_t *data, size_t len) const
+{
+    const size_t HEADER_SIZE = 12;
+
+    if (len < HEADER_SIZE || read16(data + 4) == 0) {
+        return NO_ZONE;
+    }
+
+    // lower cased copy of the question name, labels are views into it
+    char name[256];
+    size_t name_len{0};
+    thread_local std::vector<std::string_view> labels;
+    labels.clear();
+
+    size_t offset = HEADER_SIZE;
+    while (offset < len) {
+        uint8_t label_len = data[offset];
+        if (label_len == 0) {
+            return _match(labels);
+        }
+        // questions are never compressed in practice, and labels over 63 are not labels
+        if (label_len > 63 || offset + 1 + label_len > len || name_len + label_len > sizeof(name)) {
+            return NO_ZONE;
+        }
+        for (size_t i = 0; i < label_len; i++) {
+            name[name_len + i] = static_cast<char>(std::tolower(data[offset + 1 + i]));
+        }
+        labels.emplace_back(name + name_len, label_len);
+        name_len += label_len;
+        offset += label_len + 1;
+    }
+    return NO_ZONE;
+}
+
+uint32_t ZoneTrie::match(std::string_view name) const
+{
+    std::string name_ci{name};
+    std::transform(name_ci.begin(), name_ci.end(), name_ci.begin(),
+        [](unsigned char c) { return std::tolower(c); });
+    if (!name_ci.empty() && name_ci.back() == '.') {
+        name_ci.pop_back();
+    }
+    std::vector<std::string_view> labels;
+    std::string_view rest{name_ci};
+    while (!rest.empty()) {
+        auto dot = rest.find('.');
+        labels.emplace_back(rest.substr(0, dot));
+        rest = (dot == std::string_view::npos) ? std::string_view{} : rest.substr(dot + 1);
+    }
+    return _match(labels);
+}
+
+}
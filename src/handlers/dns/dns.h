@@ -7,14 +7,101 @@
 #include "DnsLayer.h"
 #include "DnsResource.h"
 #include "DnsResourceData.h"
+#include <limits>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 namespace visor::handler::dns {
 
 typedef std::pair<std::string_view, std::string_view> AggDomainResult;
 AggDomainResult aggregateDomain(const std::string &domain);
 
+/**
+ * Shannon entropy of the characters of a name, in bits per character. Algorithmically generated
+ * (random subdomain) labels score well above dictionary words
+ */
+double nameEntropy(std::string_view name);
+
+struct EdnsInfo {
+    uint16_t udp_size{0};
+    bool do_bit{false};
+};
+
+/**
+ * scan the wire format of a DNS message for an OPT RR, without building resources (see DnsLayer::parseResources)
+ * @param data pointer to the start of the DNS header
+ * @param len length of the DNS message
+ * @param edns filled in with the OPT RR fields, if one was found
+ * @return true if an OPT RR was found in the additional section
+ */
+bool scanEdns(const uint8_t *data, size_t len, EdnsInfo &edns);
+
+/**
+ * read the name of the first question from the wire format of a DNS message, without building resources
+ * @param data pointer to the start of the DNS header
+ * @param len length of the DNS message
+ * @param name filled in with the lower cased, dot separated name (no trailing dot, as DnsQuery::getName)
+ * @return true if a well formed question name was found
+ */
+bool wireQname(const uint8_t *data, size_t len, std::string &name);
+
+/**
+ * A set of zones compiled into a trie on reversed labels, so a query name can be matched against all of them
+ * in one pass over its wire format labels. The longest (most specific) configured zone wins.
+ * Read only once built, so it can be shared between threads.
+ */
+class ZoneTrie
+{
+public:
+    static constexpr uint32_t NO_ZONE = std::numeric_limits<uint32_t>::max();
+
+private:
+    struct node {
+        std::unordered_map<std::string_view, uint32_t> children;
+        uint32_t zone{NO_ZONE};
+    };
+
+    // zone names (lower case, no trailing dot), indexed by zone id. node keys are views into these
+    std::vector<std::string> _names;
+    std::vector<node> _nodes;
+
+    uint32_t _match(const std::vector<std::string_view> &labels) const;
+
+public:
+    /**
+     * @param zones zone names, case insensitive, with or without a trailing dot
+     * @throws std::invalid_argument on a malformed zone name
+     */
+    explicit ZoneTrie(const std::vector<std::string> &zones);
+
+    // node keys are views into _names, a copy would point into the original
+    ZoneTrie(const ZoneTrie &) = delete;
+    ZoneTrie &operator=(const ZoneTrie &) = delete;
+
+    /**
+     * match the first question of a DNS message, without building resources (see DnsLayer::parseResources)
+     * @param data pointer to the start of the DNS header
+     * @param len length of the DNS message
+     * @return id of the matching zone, or NO_ZONE
+     */
+    uint32_t match_wire(const uint8_t *data, size_t len) const;
+
+    // match a dotted name, case insensitive
+    uint32_t match(std::string_view name) const;
+
+    const std::string &name(uint32_t zone) const
+    {
+        return _names.at(zone);
+    }
+
+    size_t size() const
+    {
+        return _names.size();
+    }
+};
+
 enum QR {
     query = 0,
     response = 1
@@ -19,9 +19,9 @@ static inline void timespec_diff(struct timespec *a, struct timespec *b,
 
 namespace visor::handler::dns {
 
-void QueryResponsePairMgr::start_transaction(uint32_t flowKey, uint16_t queryID, timespec stamp)
+void QueryResponsePairMgr::start_transaction(uint32_t flowKey, uint16_t queryID, timespec stamp, std::optional<pcpp::IPAddress> server)
 {
-    _dns_transactions[DnsXactID(flowKey, queryID)] = {stamp, {0, 0}};
+    _dns_transactions[DnsXactID(flowKey, queryID)] = {stamp, {0, 0}, std::move(server)};
 }
 
 std::pair<bool, DnsTransaction> QueryResponsePairMgr::maybe_end_transaction(uint32_t flowKey, uint16_t queryID, timespec stamp)
@@ -33,23 +33,23 @@ std::pair<bool, DnsTransaction> QueryResponsePairMgr::maybe_end_transaction(uint
         _dns_transactions.erase(key);
         return std::pair<bool, DnsTransaction>(true, result);
     } else {
-        return std::pair<bool, DnsTransaction>(false, DnsTransaction{{0, 0}, {0, 0}});
+        return std::pair<bool, DnsTransaction>(false, DnsTransaction{{0, 0}, {0, 0}, std::nullopt});
     }
 }
 
-size_t QueryResponsePairMgr::purge_old_transactions(timespec now)
+std::vector<DnsTransaction> QueryResponsePairMgr::purge_old_transactions(timespec now)
 {
     // TODO this is a simple linear search, can optimize with some better data structures
-    std::vector<DnsXactID> timed_out;
-    for (auto i : _dns_transactions) {
-        if (now.tv_sec - i.second.queryTS.tv_sec >= _ttl_secs) {
-            timed_out.push_back(i.first);
+    std::vector<DnsTransaction> timed_out;
+    for (auto i = _dns_transactions.begin(); i != _dns_transactions.end();) {
+        if (now.tv_sec - i->second.queryTS.tv_sec >= _ttl_secs) {
+            timed_out.push_back(std::move(i->second));
+            i = _dns_transactions.erase(i);
+        } else {
+            ++i;
         }
     }
-    for (auto i : timed_out) {
-        _dns_transactions.erase(i);
-    }
-    return timed_out.size();
+    return timed_out;
 }
 
 }
@@ -4,9 +4,12 @@
 
 #pragma once
 
+#include <IpAddress.h>
 #include <chrono>
 #include <memory>
+#include <optional>
 #include <unordered_map>
+#include <vector>
 
 namespace visor::handler::dns {
 
@@ -26,6 +29,8 @@ struct hash_pair {
 struct DnsTransaction {
     timespec queryTS;
     timespec totalTS;
+    // the server side of a transaction the host initiated, if known
+    std::optional<pcpp::IPAddress> server;
 };
 
 class QueryResponsePairMgr
@@ -43,11 +48,12 @@ public:
     {
     }
 
-    void start_transaction(uint32_t flowKey, uint16_t queryID, timespec stamp);
+    void start_transaction(uint32_t flowKey, uint16_t queryID, timespec stamp, std::optional<pcpp::IPAddress> server = std::nullopt);
 
     std::pair<bool, DnsTransaction> maybe_end_transaction(uint32_t flowKey, uint16_t queryID, timespec stamp);
 
-    size_t purge_old_transactions(timespec now);
+    // returns the transactions which timed out
+    std::vector<DnsTransaction> purge_old_transactions(timespec now);
 
     DnsXactMap::size_type open_transaction_count() const
     {
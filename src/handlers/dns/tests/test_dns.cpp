@@ -73,3 +73,128 @@ TEST_CASE("DNS Utilities", "[dns]")
         CHECK(result.second == "");
     }
 }
+
+TEST_CASE("DNS name entropy", "[dns]")
+{
+    CHECK(nameEntropy("") == 0.0);
+    CHECK(nameEntropy("aaaa") == 0.0);
+    CHECK(nameEntropy("ab") == Approx(1.0));
+    // label separators are not counted
+    CHECK(nameEntropy("a.b.c.d") == Approx(2.0));
+    CHECK(nameEntropy("x7kq2mzp9w") > nameEntropy("wwwwmail"));
+}
+
+TEST_CASE("DNS zone trie", "[dns]")
+{
+    ZoneTrie zones({"example.com", "Sub.Example.COM.", "example.net"});
+    CHECK(zones.size() == 3);
+
+    SECTION("dotted names")
+    {
+        CHECK(zones.match("example.com") == 0);
+        CHECK(zones.match("www.EXAMPLE.com.") == 0);
+        CHECK(zones.match("a.sub.example.com") == 1);
+        CHECK(zones.name(1) == "sub.example.com");
+        CHECK(zones.match("example.net") == 2);
+        CHECK(zones.match("com") == ZoneTrie::NO_ZONE);
+        CHECK(zones.match("notexample.com") == ZoneTrie::NO_ZONE);
+        CHECK(zones.match("example.org") == ZoneTrie::NO_ZONE);
+    }
+
+    SECTION("wire names")
+    {
+        // header with qdcount 1, question www.SUB.example.com A IN
+        std::vector<uint8_t> msg{0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x03, 'w', 'w', 'w', 0x03, 'S', 'U', 'B', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00,
+            0x00, 0x01, 0x00, 0x01};
+        CHECK(zones.match_wire(msg.data(), msg.size()) == 1);
+        // truncated inside the name
+        CHECK(zones.match_wire(msg.data(), 20) == ZoneTrie::NO_ZONE);
+        // no question
+        msg[5] = 0;
+        CHECK(zones.match_wire(msg.data(), msg.size()) == ZoneTrie::NO_ZONE);
+    }
+
+    SECTION("invalid zones")
+    {
+        CHECK_THROWS_AS(ZoneTrie({"example..com"}), std::invalid_argument);
+        CHECK_THROWS_AS(ZoneTrie({"example.com", "EXAMPLE.com."}), std::invalid_argument);
+    }
+}
+
+TEST_CASE("DNS EDNS scan", "[dns]")
+{
+    // header: id, flags, qdcount 1, ancount 0, nscount 0, arcount 1
+    std::vector<uint8_t> msg{0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        // question: a.com A IN
+        0x01, 'a', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01,
+        // OPT: root name, type 41, udp size 1232, ext rcode 0, version 0, DO set, rdlen 0
+        0x00, 0x00, 0x29, 0x04, 0xd0, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00};
+
+    SECTION("OPT found")
+    {
+        EdnsInfo edns;
+        CHECK(scanEdns(msg.data(), msg.size(), edns));
+        CHECK(edns.udp_size == 1232);
+        CHECK(edns.do_bit);
+    }
+
+    SECTION("DO bit clear")
+    {
+        msg[30] = 0x00;
+        EdnsInfo edns;
+        CHECK(scanEdns(msg.data(), msg.size(), edns));
+        CHECK(edns.udp_size == 1232);
+        CHECK(!edns.do_bit);
+    }
+
+    SECTION("no additional records")
+    {
+        msg[11] = 0x00;
+        EdnsInfo edns;
+        CHECK(!scanEdns(msg.data(), msg.size(), edns));
+    }
+
+    SECTION("truncated message")
+    {
+        EdnsInfo edns;
+        CHECK(!scanEdns(msg.data(), 25, edns));
+        CHECK(!scanEdns(msg.data(), 8, edns));
+    }
+}
+
+TEST_CASE("DNS wire qname", "[dns]")
+{
+    // header with qdcount 1, question www.SUB.example.com A IN
+    std::vector<uint8_t> msg{0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x03, 'w', 'w', 'w', 0x03, 'S', 'U', 'B', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00,
+        0x00, 0x01, 0x00, 0x01};
+    std::string name;
+
+    SECTION("lower cased and dotted")
+    {
+        CHECK(wireQname(msg.data(), msg.size(), name));
+        CHECK(name == "www.sub.example.com");
+    }
+
+    SECTION("root name")
+    {
+        std::vector<uint8_t> root{0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x02, 0x00, 0x01};
+        CHECK(wireQname(root.data(), root.size(), name));
+        CHECK(name.empty());
+    }
+
+    SECTION("malformed")
+    {
+        // truncated inside the name
+        CHECK(!wireQname(msg.data(), 20, name));
+        // pointer to itself
+        msg[12] = 0xC0;
+        msg[13] = 12;
+        CHECK(!wireQname(msg.data(), msg.size(), name));
+        // no question
+        msg[5] = 0;
+        CHECK(!wireQname(msg.data(), msg.size(), name));
+    }
+}
@@ -48,6 +48,26 @@ TEST_CASE("Ensure we use only pktvisor DnsLayer", "[pcap][ipv4][dns]")
     delete reader;
 }
 
+TEST_CASE("DnsLayer over borrowed data", "[dns]")
+{
+    // a.com A IN query
+    const std::vector<uint8_t> msg{0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x01, 'a', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01};
+
+    {
+        DnsLayer dns(msg.data(), msg.size());
+        CHECK(dns.getDnsHeader()->transactionID == htobe16(0x1234));
+        REQUIRE(dns.parseResources(true));
+        REQUIRE(dns.getFirstQuery() != nullptr);
+        CHECK(dns.getFirstQuery()->getName() == "a.com");
+        CHECK(dns.getFirstQuery()->getDnsType() == DNS_TYPE_A);
+    }
+
+    // the layer must not have touched the caller's buffer
+    CHECK(msg.size() == 23);
+    CHECK(msg[13] == 'a');
+}
+
 TEST_CASE("Parse DNS UDP IPv4 tests", "[pcap][ipv4][udp][dns]")
 {
 
@@ -253,6 +273,48 @@ TEST_CASE("Parse DNS random UDP/TCP tests", "[pcap][dns]")
     CHECK(j["top_qtype"][6]["estimate"] == 620);
 }
 
+TEST_CASE("DNS response size and EDNS", "[pcap][dns]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_udp_mixed_rcode.pcap");
+    stream.config_set("bpf", "");
+    stream.config_set("host_spec", "192.168.0.0/24");
+    stream.parse_host_spec();
+
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    DnsStreamHandler dns_handler{"dns-test", &stream, &c};
+
+    dns_handler.start();
+    stream.start();
+    stream.stop();
+    dns_handler.stop();
+
+    auto counters = dns_handler.metrics()->bucket(0)->counters();
+
+    CHECK(counters.replies.value() == 12);
+    CHECK(counters.EDNS.value() == 18);
+    CHECK(counters.EDNS_DO.value() == 12);
+    CHECK(counters.TC.value() == 0);
+
+    nlohmann::json j;
+    dns_handler.metrics()->bucket(0)->to_json(j);
+
+    CHECK(j["wire_packets"]["edns"] == 18);
+    CHECK(j["wire_packets"]["edns_do"] == 12);
+    CHECK(j["wire_packets"]["truncated"] == 0);
+
+    CHECK(j["top_edns_udp_size"][0]["name"] == "1232");
+    CHECK(j["top_edns_udp_size"][0]["estimate"] == 11);
+
+    CHECK(j["top_qname_by_resp_bytes"][0]["name"] == "sirius.mwbsys.com");
+    CHECK(j["top_qname_by_resp_bytes"][0]["estimate"] == 701);
+
+    CHECK(j["response_bytes"]["p50"] == 94);
+    CHECK(j["response_bytes"]["p99"] == 311);
+}
+
 TEST_CASE("DNS Filters: exclude_noerror", "[pcap][dns]")
 {
 
@@ -375,3 +437,239 @@ TEST_CASE("DNS Filters: only_qname_suffix", "[pcap][dns]")
     CHECK(counters.NX.value() == 1);
     CHECK(counters.filtered.value() == 14);
 }
+
+TEST_CASE("DNS metrics bucket with concurrent writers", "[dns]")
+{
+    DnsMetricsBucket bucket;
+
+    const int writers = 4;
+    const int per_writer = 10000;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < writers; t++) {
+        threads.emplace_back([&bucket] {
+            for (int i = 0; i < per_writer; i++) {
+                bucket.process_filtered();
+            }
+        });
+    }
+    // reads fold the shards while writers are still running
+    for (int i = 0; i < 10; i++) {
+        nlohmann::json j;
+        bucket.to_json(j);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    CHECK(bucket.counters().filtered.value() == writers * per_writer);
+
+    DnsMetricsBucket merged;
+    merged.merge(bucket);
+    nlohmann::json j;
+    merged.to_json(j);
+    CHECK(j["wire_packets"]["filtered"] == writers * per_writer);
+}
+
+TEST_CASE("DNS per server transaction timing", "[pcap][dns][xact]")
+{
+    ServerTiming servers("dns", {"xact", "out", "top_servers"}, "per server");
+    auto server = [](const std::string &addr) { return ServerTiming::key(pcpp::IPAddress(pcpp::IPv4Address(addr))); };
+
+    SECTION("tracked servers and other")
+    {
+        for (size_t i = 0; i < ServerTiming::MAX_SERVERS; i++) {
+            servers.update(server("192.0.2." + std::to_string(i)), 100);
+        }
+        servers.update(server("192.0.2.0"), 300);
+        servers.timed_out(server("192.0.2.0"));
+        // table is full, a server seen once goes to other
+        servers.update(server("198.51.100.1"), 5000);
+        servers.timed_out(server("198.51.100.2"));
+
+        nlohmann::json j;
+        servers.to_json(j);
+        auto &section = j["xact"]["out"]["top_servers"];
+        CHECK(section.size() == ServerTiming::MAX_SERVERS + 1);
+        CHECK(section[0]["name"] == "192.0.2.0");
+        CHECK(section[0]["total"] == 2);
+        CHECK(section[0]["timed_out"] == 1);
+        CHECK(section[0]["quantiles_us"]["p99"] == 300);
+        CHECK(section[ServerTiming::MAX_SERVERS]["name"] == "other");
+        CHECK(section[ServerTiming::MAX_SERVERS]["total"] == 1);
+        CHECK(section[ServerTiming::MAX_SERVERS]["timed_out"] == 1);
+    }
+
+    SECTION("busy server takes over a tracked slot")
+    {
+        for (size_t i = 0; i < ServerTiming::MAX_SERVERS; i++) {
+            servers.update(server("192.0.2." + std::to_string(i)), 100);
+        }
+        servers.update(server("198.51.100.1"), 200);
+        servers.update(server("198.51.100.1"), 200);
+
+        nlohmann::json j;
+        servers.to_json(j);
+        auto &section = j["xact"]["out"]["top_servers"];
+        CHECK(section.size() == ServerTiming::MAX_SERVERS + 1);
+        CHECK(section[0]["name"] == "198.51.100.1");
+        CHECK(section[0]["total"] == 1);
+        // first sighting and the evicted server are folded into other
+        CHECK(section[ServerTiming::MAX_SERVERS]["total"] == 2);
+    }
+
+    SECTION("IPv6 servers")
+    {
+        servers.update(ServerTiming::key(pcpp::IPAddress(pcpp::IPv6Address("2001:db8::53"))), 100);
+        servers.timed_out(server("192.0.2.53"));
+
+        nlohmann::json j;
+        servers.to_json(j);
+        auto &section = j["xact"]["out"]["top_servers"];
+        CHECK(section.size() == 2);
+        CHECK(section[0]["name"] == "2001:db8::53");
+        CHECK(section[1]["name"] == "192.0.2.53");
+        CHECK(section[1]["timed_out"] == 1);
+    }
+
+    SECTION("purge reports timed out servers")
+    {
+        QueryResponsePairMgr qr(5);
+        qr.start_transaction(1, 1, {100, 0}, pcpp::IPAddress(pcpp::IPv4Address("192.0.2.1")));
+        qr.start_transaction(2, 1, {100, 0});
+        qr.start_transaction(3, 1, {104, 0});
+        auto timed_out = qr.purge_old_transactions({105, 0});
+        CHECK(timed_out.size() == 2);
+        CHECK(qr.open_transaction_count() == 1);
+        size_t with_server{0};
+        for (const auto &xact : timed_out) {
+            if (xact.server) {
+                ++with_server;
+                CHECK(xact.server->toString() == "192.0.2.1");
+            }
+        }
+        CHECK(with_server == 1);
+    }
+}
+
+TEST_CASE("DNS per server timeouts follow deep sampling", "[pcap][dns][xact]")
+{
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 2);
+    c.config_set<uint64_t>("deep_sample_rate", 10);
+    DnsMetricsManager manager{&c};
+    manager.set_start_tstamp({100, 0});
+
+    std::vector<uint8_t> query{0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01};
+    pcpp::IPAddress server(pcpp::IPv4Address("192.0.2.53"));
+    for (uint32_t flow = 1; flow <= 1000; flow++) {
+        DnsLayer layer(query.data(), query.size());
+        manager.process_dns_layer(layer, PacketDirection::fromHost, pcpp::IPv4, pcpp::UDP, flow, 53, server, {100, 0});
+    }
+    uint64_t sampled{0};
+    {
+        auto [num_events, num_samples, event_rate, lock] = manager.bucket(0)->event_data_locked();
+        CHECK(num_events->value() == 1000);
+        sampled = num_samples->value();
+    }
+
+    // nothing answered, the period shift times out every query
+    DnsLayer layer(query.data(), query.size());
+    manager.process_dns_layer(layer, PacketDirection::fromHost, pcpp::IPv4, pcpp::UDP, 1001, 53, server, {200, 0});
+    CHECK(manager.bucket(0)->counters().xacts_timed_out.value() == 1000);
+
+    nlohmann::json j;
+    manager.bucket(0)->to_json(j);
+    uint64_t server_timed_out{0};
+    for (const auto &entry : j["xact"]["out"]["top_servers"]) {
+        server_timed_out += entry["timed_out"].get<uint64_t>();
+    }
+    CHECK(sampled < 1000);
+    CHECK(server_timed_out == sampled);
+}
+
+TEST_CASE("DNS subdomain cardinality follows the top zones", "[dns]")
+{
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    DnsMetricsManager manager{&c};
+
+    pcpp::IPAddress server(pcpp::IPv4Address("192.0.2.53"));
+    uint32_t flow{0};
+    auto query = [&](const std::string &sub, const std::string &zone) {
+        std::vector<uint8_t> msg{0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+        for (const auto &label : {sub, zone, std::string("com")}) {
+            msg.push_back(static_cast<uint8_t>(label.size()));
+            msg.insert(msg.end(), label.begin(), label.end());
+        }
+        msg.insert(msg.end(), {0x00, 0x00, 0x01, 0x00, 0x01});
+        DnsLayer layer(msg.data(), msg.size());
+        manager.process_dns_layer(layer, PacketDirection::fromHost, pcpp::IPv4, pcpp::UDP, ++flow, 53, server, {100, 0});
+    };
+
+    // the first zones seen take all the slots
+    for (size_t z = 0; z < visor::KeyedCardinality::MAX_KEYS; z++) {
+        query("a", "zone" + std::to_string(z));
+    }
+    for (size_t i = 0; i < 20; i++) {
+        query("x" + std::to_string(i), "heavy");
+    }
+    // a scrape publishes the top zones, the shards count under them from then on, across later scrapes
+    json j;
+    manager.bucket(0)->to_json(j);
+    CHECK(j["cardinality"]["top_qname2_subdomains"].size() == visor::KeyedCardinality::MAX_KEYS);
+    for (size_t i = 0; i < 5; i++) {
+        query("y" + std::to_string(i), "heavy");
+    }
+    manager.bucket(0)->to_json(j);
+    for (size_t i = 5; i < 10; i++) {
+        query("y" + std::to_string(i), "heavy");
+    }
+    manager.bucket(0)->to_json(j);
+    CHECK(j["cardinality"]["top_qname2_subdomains"].size() == visor::KeyedCardinality::MAX_KEYS);
+    CHECK(j["cardinality"]["top_qname2_subdomains"][0]["name"] == ".heavy.com");
+    CHECK(j["cardinality"]["top_qname2_subdomains"][0]["estimate"] == 10);
+}
+
+TEST_CASE("DNS per zone counters", "[pcap][dns][zones]")
+{
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    DnsMetricsManager manager{&c};
+    manager.set_zones(std::make_shared<const ZoneTrie>(std::vector<std::string>{"example.com", "example.net"}));
+
+    // www.example.com A IN, as a query and as an NXDOMAIN reply
+    std::vector<uint8_t> query{0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00, 0x00, 0x01, 0x00, 0x01};
+    auto reply = query;
+    reply[2] = 0x81;
+    reply[3] = 0x83;
+    auto other = query;
+    other[25] = 'o';
+    other[26] = 'r';
+    other[27] = 'g';
+
+    pcpp::IPAddress server(pcpp::IPv4Address("192.0.2.53"));
+    {
+        DnsLayer layer(query.data(), query.size());
+        manager.process_dns_layer(layer, PacketDirection::fromHost, pcpp::IPv4, pcpp::UDP, 1, 53, server, {100, 0});
+    }
+    {
+        DnsLayer layer(reply.data(), reply.size());
+        manager.process_dns_layer(layer, PacketDirection::toHost, pcpp::IPv4, pcpp::UDP, 1, 53, server, {100, 2000});
+    }
+    {
+        DnsLayer layer(other.data(), other.size());
+        manager.process_dns_layer(layer, PacketDirection::fromHost, pcpp::IPv4, pcpp::UDP, 2, 53, server, {100, 0});
+    }
+
+    nlohmann::json j;
+    manager.bucket(0)->to_json(j);
+    CHECK(j["zones"].size() == 1);
+    CHECK(j["zones"]["example.com"]["queries"] == 1);
+    CHECK(j["zones"]["example.com"]["replies"] == 1);
+    CHECK(j["zones"]["example.com"]["rcode"]["NXDOMAIN"] == 1);
+    CHECK(j["zones"]["example.com"]["xact"]["quantiles_us"]["p50"] == 2);
+    CHECK(j["xact"]["out"]["top_servers"][0]["name"] == "192.0.2.53");
+}
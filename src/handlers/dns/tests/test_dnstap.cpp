@@ -149,3 +149,50 @@ TEST_CASE("Parse filtered DNSTAP with data", "[dnstap][dns][filter]")
     CHECK(j["top_qtype"][1]["name"] == "HTTPS");
     CHECK(j["top_qtype"][1]["estimate"] == 4);
 }
+
+TEST_CASE("DNSTAP transaction timing from message timestamps", "[dnstap][dns]")
+{
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    DnsMetricsManager manager{&c};
+
+    // a.com A IN, NOERROR reply
+    const std::string reply{"\x12\x34\x81\x80\x00\x01\x00\x00\x00\x00\x00\x00\x01"
+                            "a\x03"
+                            "com\x00\x00\x01\x00\x01",
+        23};
+
+    auto make_response = [&reply](dnstap::Message_Type type, uint64_t q_sec, uint32_t q_nsec, uint64_t r_sec, uint32_t r_nsec) {
+        dnstap::Dnstap d;
+        d.set_type(dnstap::Dnstap_Type_MESSAGE);
+        auto msg = d.mutable_message();
+        msg->set_type(type);
+        msg->set_query_time_sec(q_sec);
+        msg->set_query_time_nsec(q_nsec);
+        msg->set_response_time_sec(r_sec);
+        msg->set_response_time_nsec(r_nsec);
+        msg->set_response_message(reply);
+        return d;
+    };
+
+    // host is the server: 2ms
+    manager.process_dnstap(make_response(dnstap::Message_Type_CLIENT_RESPONSE, 100, 0, 100, 2'000'000), false);
+    // host is the client: 500ms, crossing a second boundary
+    manager.process_dnstap(make_response(dnstap::Message_Type_RESOLVER_RESPONSE, 100, 750'000'000, 101, 250'000'000), false);
+    // no query time, not timed
+    auto untimed = make_response(dnstap::Message_Type_CLIENT_RESPONSE, 100, 0, 100, 0);
+    untimed.mutable_message()->clear_query_time_sec();
+    manager.process_dnstap(untimed, false);
+
+    auto counters = manager.bucket(0)->counters();
+    CHECK(counters.replies.value() == 3);
+    CHECK(counters.xacts_total.value() == 2);
+    CHECK(counters.xacts_in.value() == 1);
+    CHECK(counters.xacts_out.value() == 1);
+    CHECK(manager.num_open_transactions() == 0);
+
+    nlohmann::json j;
+    manager.bucket(0)->to_json(j);
+    CHECK(j["xact"]["in"]["quantiles_us"]["p50"] == 2000);
+    CHECK(j["xact"]["out"]["quantiles_us"]["p50"] == 500000);
+}
@@ -0,0 +1,111 @@
+#include <catch2/catch.hpp>
+
+#include "DnsStreamHandler.h"
+#include "SflowInputStream.h"
+#include "emit_datagram.h"
+
+using namespace visor::handler::dns;
+using namespace visor::input::sflow;
+using namespace nlohmann;
+
+// sflow v5 datagram with three flow samples sampled 1 in 512: a DNS query for www.example.com from 10.0.0.2:40000 to
+// 10.0.0.53:53, an NXDOMAIN response for bad.example.com from 10.0.0.53:53 to 10.0.0.2:40001, a TCP SYN to port 443,
+// and an interface counter sample
+alignas(4) static uint8_t sflow_datagram[] = {
+    0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x03, 0xe8, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x84, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x02, 0x00,
+    0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x5c, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x4f, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x4b, 0x00, 0x11, 0x22, 0x33,
+    0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0x08, 0x00, 0x45, 0x00, 0x00, 0x3d, 0x00, 0x01,
+    0x00, 0x00, 0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x02, 0x0a, 0x00, 0x00, 0x35, 0x9c, 0x40,
+    0x00, 0x35, 0x00, 0x29, 0x00, 0x00, 0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x03, 0x77, 0x77, 0x77, 0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63,
+    0x6f, 0x6d, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x84,
+    0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x04, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x5c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x4f,
+    0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x4b, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0x08, 0x00, 0x45, 0x00, 0x00, 0x3d, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11,
+    0x00, 0x00, 0x0a, 0x00, 0x00, 0x35, 0x0a, 0x00, 0x00, 0x02, 0x00, 0x35, 0x9c, 0x41, 0x00, 0x29,
+    0x00, 0x00, 0x43, 0x21, 0x81, 0x83, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x62,
+    0x61, 0x64, 0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+    0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x70, 0x00, 0x00, 0x00, 0x03,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x48, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3a, 0x00, 0x00, 0x00, 0x04,
+    0x00, 0x00, 0x00, 0x36, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+    0x08, 0x00, 0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0x0a, 0x00,
+    0x00, 0x02, 0x0a, 0x00, 0x00, 0x35, 0x9c, 0x42, 0x01, 0xbb, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x50, 0x02, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x58, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x06,
+    0x00, 0x00, 0x00, 0x00, 0x3b, 0x9a, 0xca, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x39, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x06,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd4, 0x31, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x06,
+};
+
+TEST_CASE("Parse DNS from sflow sampled headers", "[sflow][dns]")
+{
+    SflowInputStream stream{"sflow-test"};
+
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    DnsStreamHandler dns_handler{"dns-test", &stream, &c};
+
+    dns_handler.start();
+    CHECK(stream.decode_flags() == DECODE_FLOW_SAMPLES);
+    emit_datagram(stream, sflow_datagram);
+    dns_handler.stop();
+
+    auto counters = dns_handler.metrics()->bucket(0)->counters();
+    auto event_data = dns_handler.metrics()->bucket(0)->event_data_locked();
+
+    // events and counters are scaled by the sampling rate of each sampled DNS message
+    CHECK(event_data.num_events->value() == 1024);
+    CHECK(counters.UDP.value() == 1024);
+    CHECK(counters.TCP.value() == 0);
+    CHECK(counters.IPv4.value() == 1024);
+    CHECK(counters.queries.value() == 512);
+    CHECK(counters.replies.value() == 512);
+    CHECK(counters.NX.value() == 512);
+    CHECK(counters.xacts_total.value() == 0);
+
+    nlohmann::json j;
+    dns_handler.metrics()->bucket(0)->to_json(j);
+
+    CHECK(j["cardinality"]["qname"] == 2);
+    CHECK(j["top_qname2"][0]["name"] == ".example.com");
+    CHECK(j["top_qname2"][0]["estimate"] == 1024);
+    CHECK(j["top_nxdomain"][0]["name"] == "bad.example.com");
+    CHECK(j["top_nxdomain"][0]["estimate"] == 512);
+    CHECK(j["top_qtype"][0]["name"] == "A");
+    CHECK(j["top_qtype"][0]["estimate"] == 1024);
+}
+
+TEST_CASE("Parse filtered DNS from sflow sampled headers", "[sflow][dns][filter]")
+{
+    SflowInputStream stream{"sflow-test"};
+
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    DnsStreamHandler dns_handler{"dns-test", &stream, &c};
+    dns_handler.config_set<uint64_t>("only_rcode", NXDomain);
+
+    dns_handler.start();
+    emit_datagram(stream, sflow_datagram);
+    dns_handler.stop();
+
+    auto counters = dns_handler.metrics()->bucket(0)->counters();
+    auto event_data = dns_handler.metrics()->bucket(0)->event_data_locked();
+
+    // the filtered query stands for as many messages as the accepted reply
+    CHECK(event_data.num_events->value() == 1024);
+    CHECK(counters.queries.value() == 0);
+    CHECK(counters.replies.value() == 512);
+    CHECK(counters.NX.value() == 512);
+    CHECK(counters.filtered.value() == 512);
+}
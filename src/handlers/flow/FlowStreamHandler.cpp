@@ -0,0 +1,563 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "FlowStreamHandler.h"
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+#pragma GCC diagnostic ignored "-Wpedantic"
+#include <IPv4Layer.h>
+#include <IPv6Layer.h>
+#include <TcpLayer.h>
+#include <UdpLayer.h>
+#pragma GCC diagnostic pop
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <fmt/format.h>
+#include <netinet/in.h>
+#include <unordered_map>
+
+namespace std {
+template <>
+struct hash<visor::handler::flow::FlowKey> {
+    size_t operator()(const visor::handler::flow::FlowKey &key) const
+    {
+        size_t h = key.protocol;
+        for (auto b : key.addr_a) {
+            h = h * 31 + b;
+        }
+        for (auto b : key.addr_b) {
+            h = h * 31 + b;
+        }
+        return (h * 31 + key.port_a) * 31 + key.port_b;
+    }
+};
+}
+
+namespace visor::handler::flow {
+
+FlowKey::FlowKey(uint8_t ip_version, uint8_t protocol, const uint8_t *src, uint16_t src_port, const uint8_t *dst, uint16_t dst_port)
+    : ip_version(ip_version)
+    , protocol(protocol)
+{
+    size_t len = (ip_version == 4) ? 4 : 16;
+    auto cmp = std::memcmp(src, dst, len);
+    if (cmp > 0 || (cmp == 0 && src_port > dst_port)) {
+        std::swap(src, dst);
+        std::swap(src_port, dst_port);
+    }
+    std::memcpy(addr_a.data(), src, len);
+    std::memcpy(addr_b.data(), dst, len);
+    port_a = src_port;
+    port_b = dst_port;
+}
+
+std::string FlowKey::to_string() const
+{
+    char a[INET6_ADDRSTRLEN];
+    char b[INET6_ADDRSTRLEN];
+    auto proto = (protocol == IPPROTO_TCP) ? "tcp" : "udp";
+    if (ip_version == 4) {
+        inet_ntop(AF_INET, addr_a.data(), a, sizeof(a));
+        inet_ntop(AF_INET, addr_b.data(), b, sizeof(b));
+        return fmt::format("{} {}:{} <-> {}:{}", proto, a, port_a, b, port_b);
+    }
+    inet_ntop(AF_INET6, addr_a.data(), a, sizeof(a));
+    inet_ntop(AF_INET6, addr_b.data(), b, sizeof(b));
+    return fmt::format("{} [{}]:{} <-> [{}]:{}", proto, a, port_a, b, port_b);
+}
+
+FlowTable::FlowTable(size_t capacity, uint32_t idle_timeout)
+    : _idle_timeout(idle_timeout)
+{
+    // power of two so the slot is a simple mask of the hash
+    size_t size = MAX_PROBE;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    _entries.resize(size);
+    _mask = size - 1;
+}
+
+FlowTable::Entry *FlowTable::find_or_insert(uint32_t hash, const FlowKey &key, uint32_t now, bool &inserted)
+{
+    inserted = false;
+    Entry *idle{nullptr};
+    size_t slot = hash & _mask;
+    for (size_t probe = 0; probe < MAX_PROBE; ++probe, slot = (slot + 1) & _mask) {
+        auto &entry = _entries[slot];
+        if (!entry.used) {
+            // deletion shifts entries back, so an empty slot ends the search
+            entry.used = true;
+            entry.hash = hash;
+            entry.key = key;
+            entry.packets = entry.bytes = 0;
+            entry.last_seen = now;
+            _size.fetch_add(1, std::memory_order_relaxed);
+            inserted = true;
+            return &entry;
+        }
+        if (entry.hash == hash && entry.key == key) {
+            entry.last_seen = now;
+            return &entry;
+        }
+        if (!idle && _idle(entry, now)) {
+            idle = &entry;
+        }
+    }
+    if (idle) {
+        // the window is full, take over the slot of an idle flow. the slot stays occupied, so no probe chain breaks
+        ++_expired;
+        idle->hash = hash;
+        idle->key = key;
+        idle->packets = idle->bytes = 0;
+        idle->last_seen = now;
+        inserted = true;
+    }
+    return idle;
+}
+
+void FlowTable::_erase(size_t i)
+{
+    // backward shift deletion: move later entries of the same probe chains into the hole. a completely full table has no
+    // empty slot to end the scan, so it also ends once every other slot has been visited
+    size_t j = i;
+    for (size_t visited = 1; visited < _entries.size(); ++visited) {
+        j = (j + 1) & _mask;
+        if (!_entries[j].used) {
+            break;
+        }
+        size_t home = _entries[j].hash & _mask;
+        // the entry at j may move to i only if its home slot is not cyclically within (i, j]
+        bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            _entries[i] = _entries[j];
+            i = j;
+        }
+    }
+    _entries[i].used = false;
+    _size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t FlowTable::expire(uint32_t now)
+{
+    size_t removed{0};
+    for (size_t i = 0; i < _entries.size();) {
+        if (_entries[i].used && _idle(_entries[i], now)) {
+            _erase(i);
+            ++removed;
+            // an entry may have shifted into this slot, check it again
+            continue;
+        }
+        ++i;
+    }
+    _expired += removed;
+    return removed;
+}
+
+std::vector<FlowRecord> FlowTable::top_flows(size_t n)
+{
+    std::vector<FlowRecord> top;
+    auto by_bytes = [](const FlowRecord &a, const FlowRecord &b) { return a.bytes > b.bytes; };
+    for (auto &entry : _entries) {
+        if (!entry.used || !entry.packets) {
+            continue;
+        }
+        // keep a min heap of the n largest
+        if (top.size() < n) {
+            top.push_back({entry.key, entry.packets, entry.bytes});
+            std::push_heap(top.begin(), top.end(), by_bytes);
+        } else if (n && entry.bytes > top.front().bytes) {
+            std::pop_heap(top.begin(), top.end(), by_bytes);
+            top.back() = {entry.key, entry.packets, entry.bytes};
+            std::push_heap(top.begin(), top.end(), by_bytes);
+        }
+        entry.packets = entry.bytes = 0;
+    }
+    std::sort_heap(top.begin(), top.end(), by_bytes);
+    return top;
+}
+
+void TopFlows::update(std::vector<FlowRecord> flows)
+{
+    _flows = std::move(flows);
+}
+
+void TopFlows::merge(const TopFlows &other)
+{
+    if (other._flows.empty()) {
+        return;
+    }
+    std::unordered_map<FlowKey, FlowRecord> combined;
+    for (const auto &f : _flows) {
+        combined[f.key] = f;
+    }
+    for (const auto &f : other._flows) {
+        auto &c = combined[f.key];
+        c.key = f.key;
+        c.packets += f.packets;
+        c.bytes += f.bytes;
+    }
+    _flows.clear();
+    for (const auto &[key, f] : combined) {
+        _flows.push_back(f);
+    }
+    std::sort(_flows.begin(), _flows.end(), [](const FlowRecord &a, const FlowRecord &b) { return a.bytes > b.bytes; });
+    if (_flows.size() > _top_count) {
+        _flows.resize(_top_count);
+    }
+}
+
+void TopFlows::to_json(json &j) const
+{
+    auto section = json::array();
+    for (uint64_t i = 0; i < _flows.size(); i++) {
+        section[i]["name"] = _flows[i].key.to_string();
+        section[i]["bytes"] = _flows[i].bytes;
+        section[i]["packets"] = _flows[i].packets;
+    }
+    name_json_assign(j, section);
+}
+
+void TopFlows::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels) const
+{
+    LabelMap l(add_labels);
+    out << "# HELP " << base_name_snake() << ' ' << _desc << std::endl;
+    out << "# TYPE " << base_name_snake() << " gauge" << std::endl;
+    for (const auto &f : _flows) {
+        l["flow"] = f.key.to_string();
+        out << name_snake({}, l) << ' ' << f.bytes << std::endl;
+    }
+}
+
+FlowStreamHandler::FlowStreamHandler(const std::string &name, InputStream *stream, const Configurable *window_config, StreamHandler *handler)
+    : visor::StreamMetricsHandler<FlowMetricsManager>(name, window_config)
+{
+    if (handler) {
+        throw StreamHandlerException(fmt::format("FlowStreamHandler: unsupported upstream chained stream handler {}", handler->name()));
+    }
+
+    assert(stream);
+    // figure out which input stream we have
+    _pcap_stream = dynamic_cast<PcapInputStream *>(stream);
+    _flow_stream = dynamic_cast<FlowInputStream *>(stream);
+    if (!_pcap_stream && !_flow_stream) {
+        throw StreamHandlerException(fmt::format("FlowStreamHandler: unsupported input stream {}", stream->name()));
+    }
+}
+
+// callback from input module
+void FlowStreamHandler::process_flow_packet_cb(pcpp::Packet &payload, [[maybe_unused]] PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, timespec stamp)
+{
+    _metrics->process_packet(payload, l3, l4, flowkey, stamp);
+}
+
+void FlowStreamHandler::process_netflow_cb(const NetflowDatagram &payload)
+{
+    timespec stamp;
+    // use now()
+    std::timespec_get(&stamp, TIME_UTC);
+    _metrics->process_netflow(payload, stamp);
+}
+
+void FlowStreamHandler::start()
+{
+    if (_running) {
+        return;
+    }
+
+    if (config_exists("recorded_stream")) {
+        _metrics->set_recorded_stream();
+    }
+
+    uint64_t table_size{DEFAULT_TABLE_SIZE};
+    if (config_exists("table_size")) {
+        table_size = config_get<uint64_t>("table_size");
+        if (table_size < FlowTable::MAX_PROBE) {
+            throw ConfigException(fmt::format("table_size must be at least {}", FlowTable::MAX_PROBE));
+        }
+    }
+    uint64_t idle_timeout{DEFAULT_IDLE_TIMEOUT};
+    if (config_exists("idle_timeout")) {
+        idle_timeout = config_get<uint64_t>("idle_timeout");
+        if (idle_timeout < 1) {
+            throw ConfigException("idle_timeout must be at least 1 second");
+        }
+    }
+    _metrics->set_flow_table(table_size, static_cast<uint32_t>(idle_timeout));
+
+    if (_pcap_stream) {
+        _pkt_flow_connection = _pcap_stream->flow_connect(&FlowStreamHandler::process_flow_packet_cb, this);
+        _start_tstamp_connection = _pcap_stream->start_tstamp_signal.connect(&FlowStreamHandler::set_start_tstamp, this);
+        _end_tstamp_connection = _pcap_stream->end_tstamp_signal.connect(&FlowStreamHandler::set_end_tstamp, this);
+    } else if (_flow_stream) {
+        _netflow_connection = _flow_stream->netflow_signal.connect(&FlowStreamHandler::process_netflow_cb, this);
+    }
+
+    _running = true;
+}
+
+void FlowStreamHandler::stop()
+{
+    if (!_running) {
+        return;
+    }
+
+    if (_pcap_stream) {
+        _pcap_stream->flow_disconnect(_pkt_flow_connection);
+        _start_tstamp_connection.disconnect();
+        _end_tstamp_connection.disconnect();
+    } else if (_flow_stream) {
+        _netflow_connection.disconnect();
+        // flow exports carry no end of stream signal, report what the flow table holds into the live period
+        timespec stamp;
+        std::timespec_get(&stamp, TIME_UTC);
+        _metrics->report_live_flows(stamp);
+    }
+
+    _running = false;
+}
+
+void FlowStreamHandler::info_json(json &j) const
+{
+    common_info_json(j);
+    if (auto table = _metrics->flow_table()) {
+        j[schema_key()]["table"]["capacity"] = table->capacity();
+        j[schema_key()]["table"]["size"] = table->size();
+        j[schema_key()]["table"]["idle_timeout"] = table->idle_timeout();
+    }
+}
+
+// callback from input module
+void FlowStreamHandler::set_start_tstamp(timespec stamp)
+{
+    _metrics->set_start_tstamp(stamp);
+}
+void FlowStreamHandler::set_end_tstamp(timespec stamp)
+{
+    _metrics->set_end_tstamp(stamp);
+    // a pcap file has ended, so there is no period shift coming to report the last period's flows
+    _metrics->report_live_flows(stamp);
+}
+
+void FlowMetricsBucket::specialized_merge(const AbstractMetricsBucket &o)
+{
+    // static because caller guarantees only our own bucket type
+    const auto &other = static_cast<const FlowMetricsBucket &>(o);
+
+    std::shared_lock r_lock(other._mutex);
+    std::unique_lock w_lock(_mutex);
+
+    _counters.TCP += other._counters.TCP;
+    _counters.UDP += other._counters.UDP;
+    _counters.bytes += other._counters.bytes;
+    _counters.untracked += other._counters.untracked;
+    _counters.new_flows += other._counters.new_flows;
+    _counters.expired_flows += other._counters.expired_flows;
+
+    _topFlows.merge(other._topFlows);
+}
+
+void FlowMetricsBucket::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels) const
+{
+
+    {
+        auto [num_events, num_samples, event_rate, event_lock] = event_data_locked(); // thread safe
+
+        event_rate->to_prometheus(out, add_labels);
+        num_events->to_prometheus(out, add_labels);
+        num_samples->to_prometheus(out, add_labels);
+    }
+
+    std::shared_lock r_lock(_mutex);
+
+    _counters.TCP.to_prometheus(out, add_labels);
+    _counters.UDP.to_prometheus(out, add_labels);
+    _counters.bytes.to_prometheus(out, add_labels);
+    _counters.untracked.to_prometheus(out, add_labels);
+    _counters.new_flows.to_prometheus(out, add_labels);
+    _counters.expired_flows.to_prometheus(out, add_labels);
+
+    _topFlows.to_prometheus(out, add_labels);
+}
+
+void FlowMetricsBucket::to_json(json &j) const
+{
+
+    bool live_rates = !read_only() && !recorded_stream();
+
+    {
+        auto [num_events, num_samples, event_rate, event_lock] = event_data_locked(); // thread safe
+
+        event_rate->to_json(j, live_rates);
+        num_events->to_json(j);
+        num_samples->to_json(j);
+    }
+
+    std::shared_lock r_lock(_mutex);
+
+    _counters.TCP.to_json(j);
+    _counters.UDP.to_json(j);
+    _counters.bytes.to_json(j);
+    _counters.untracked.to_json(j);
+    _counters.new_flows.to_json(j);
+    _counters.expired_flows.to_json(j);
+
+    _topFlows.to_json(j);
+}
+
+void FlowMetricsBucket::process_packet(pcpp::ProtocolType l4, uint64_t bytes, bool tracked, bool new_flow, uint64_t packets)
+{
+    std::unique_lock lock(_mutex);
+
+    if (l4 == pcpp::TCP) {
+        _counters.TCP += packets;
+    } else {
+        _counters.UDP += packets;
+    }
+    _counters.bytes += bytes;
+    if (!tracked) {
+        _counters.untracked += packets;
+    } else if (new_flow) {
+        ++_counters.new_flows;
+    }
+}
+
+void FlowMetricsBucket::process_flows(std::vector<FlowRecord> top_flows, uint64_t expired)
+{
+    std::unique_lock lock(_mutex);
+    _topFlows.update(std::move(top_flows));
+    _counters.expired_flows += expired;
+}
+
+static bool make_flow_key(pcpp::Packet &payload, pcpp::ProtocolType l3, pcpp::ProtocolType l4, FlowKey &key)
+{
+    uint8_t protocol;
+    uint16_t src_port;
+    uint16_t dst_port;
+    if (l4 == pcpp::TCP) {
+        auto tcpLayer = payload.getLayerOfType<pcpp::TcpLayer>();
+        if (!tcpLayer) {
+            return false;
+        }
+        protocol = IPPROTO_TCP;
+        src_port = ntohs(tcpLayer->getTcpHeader()->portSrc);
+        dst_port = ntohs(tcpLayer->getTcpHeader()->portDst);
+    } else if (l4 == pcpp::UDP) {
+        auto udpLayer = payload.getLayerOfType<pcpp::UdpLayer>();
+        if (!udpLayer) {
+            return false;
+        }
+        protocol = IPPROTO_UDP;
+        src_port = ntohs(udpLayer->getUdpHeader()->portSrc);
+        dst_port = ntohs(udpLayer->getUdpHeader()->portDst);
+    } else {
+        return false;
+    }
+
+    if (l3 == pcpp::IPv4) {
+        auto IP4layer = payload.getLayerOfType<pcpp::IPv4Layer>();
+        if (!IP4layer) {
+            return false;
+        }
+        // network byte order, as stored on the wire
+        uint32_t src = IP4layer->getSrcIPv4Address().toInt();
+        uint32_t dst = IP4layer->getDstIPv4Address().toInt();
+        key = FlowKey(4, protocol, reinterpret_cast<const uint8_t *>(&src), src_port, reinterpret_cast<const uint8_t *>(&dst), dst_port);
+        return true;
+    } else if (l3 == pcpp::IPv6) {
+        auto IP6layer = payload.getLayerOfType<pcpp::IPv6Layer>();
+        if (!IP6layer) {
+            return false;
+        }
+        key = FlowKey(6, protocol, IP6layer->getSrcIPv6Address().toBytes(), src_port, IP6layer->getDstIPv6Address().toBytes(), dst_port);
+        return true;
+    }
+    return false;
+}
+
+void FlowMetricsManager::process_packet(pcpp::Packet &payload, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, timespec stamp)
+{
+    // base event
+    new_event(stamp);
+
+    // flow accounting covers every packet, deep sampling does not apply
+    uint64_t bytes = payload.getRawPacket()->getFrameLength();
+    FlowTable::Entry *entry{nullptr};
+    bool inserted{false};
+    FlowKey key;
+    if (_table && make_flow_key(payload, l3, l4, key)) {
+        entry = _table->find_or_insert(flowkey, key, static_cast<uint32_t>(stamp.tv_sec), inserted);
+        if (entry) {
+            ++entry->packets;
+            entry->bytes += bytes;
+        }
+    }
+    live_bucket()->process_packet(l4, bytes, entry != nullptr, inserted);
+}
+
+void FlowMetricsManager::process_netflow(const NetflowDatagram &payload, timespec stamp)
+{
+    // base event, counting the packets the flow records summarize rather than the datagram
+    uint64_t packets{0};
+    for (const auto &record : payload.records) {
+        packets += record.packets * record.sampling_rate;
+    }
+    new_event(stamp, true, packets);
+
+    for (const auto &record : payload.records) {
+        pcpp::ProtocolType l4;
+        if (record.protocol == IPPROTO_TCP) {
+            l4 = pcpp::TCP;
+        } else if (record.protocol == IPPROTO_UDP) {
+            l4 = pcpp::UDP;
+        } else {
+            continue;
+        }
+        if (record.ip_version != 4 && record.ip_version != 6) {
+            continue;
+        }
+        // the record already summarizes the flow, scaled up again if the exporter sampled it
+        uint64_t packets = record.packets * record.sampling_rate;
+        uint64_t bytes = record.bytes * record.sampling_rate;
+        FlowTable::Entry *entry{nullptr};
+        bool inserted{false};
+        if (_table) {
+            FlowKey key(record.ip_version, record.protocol, record.src_addr.data(), record.src_port, record.dst_addr.data(), record.dst_port);
+            // there is no input stream flow hash for exported records, hash the canonical key instead
+            auto hash = static_cast<uint32_t>(std::hash<FlowKey>{}(key));
+            entry = _table->find_or_insert(hash, key, static_cast<uint32_t>(stamp.tv_sec), inserted);
+            if (entry) {
+                entry->packets += packets;
+                entry->bytes += bytes;
+            }
+        }
+        live_bucket()->process_packet(l4, bytes, entry != nullptr, inserted, packets);
+    }
+}
+
+void FlowMetricsManager::_report_flows(FlowMetricsBucket *bucket, uint32_t now)
+{
+    if (!_table) {
+        return;
+    }
+    auto top_flows = _table->top_flows(FlowMetricsBucket::TOP_FLOWS);
+    _table->expire(now);
+    bucket->process_flows(std::move(top_flows), _table->take_expired());
+}
+
+void FlowMetricsManager::on_period_shift(timespec stamp, [[maybe_unused]] const FlowMetricsBucket *maybe_expiring_bucket)
+{
+    // the period shift happens on the packet thread, the same as all other flow table access
+    _report_flows(writable_bucket(1), static_cast<uint32_t>(stamp.tv_sec));
+}
+
+void FlowMetricsManager::report_live_flows(timespec stamp)
+{
+    _report_flows(live_bucket(), static_cast<uint32_t>(stamp.tv_sec));
+}
+
+}
@@ -0,0 +1,285 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include "AbstractMetricsManager.h"
+#include "FlowInputStream.h"
+#include "PcapInputStream.h"
+#include "StreamHandler.h"
+#include <Corrade/Utility/Debug.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace visor::handler::flow {
+
+using namespace visor::input::pcap;
+using namespace visor::input::flow;
+
+/**
+ * A TCP or UDP 5-tuple. Endpoints are stored in canonical order (lowest address/port first), so both directions of a
+ * conversation map to the same key, matching the direction independent hash5Tuple.
+ */
+struct FlowKey {
+    std::array<uint8_t, 16> addr_a{};
+    std::array<uint8_t, 16> addr_b{};
+    uint16_t port_a{0};
+    uint16_t port_b{0};
+    uint8_t ip_version{0};
+    uint8_t protocol{0};
+
+    FlowKey() = default;
+    FlowKey(uint8_t ip_version, uint8_t protocol, const uint8_t *src, uint16_t src_port, const uint8_t *dst, uint16_t dst_port);
+
+    bool operator==(const FlowKey &other) const
+    {
+        return addr_a == other.addr_a && addr_b == other.addr_b && port_a == other.port_a && port_b == other.port_b
+            && ip_version == other.ip_version && protocol == other.protocol;
+    }
+
+    std::string to_string() const;
+};
+
+struct FlowRecord {
+    FlowKey key;
+    uint64_t packets{0};
+    uint64_t bytes{0};
+};
+
+/**
+ * Fixed capacity open addressing (linear probing) flow table, keyed by the 5-tuple hash computed by the input stream.
+ * Memory is allocated once up front; when a probe window is full of active flows, new flows are not tracked rather
+ * than growing the table, which keeps memory flat under e.g. SYN floods. Idle flows are reclaimed by expire(), and
+ * opportunistically when a new flow needs their slot.
+ *
+ * NOTE: intentionally _not_ thread safe; it is only used from the packet processing thread
+ */
+class FlowTable
+{
+public:
+    static constexpr size_t MAX_PROBE = 32;
+
+    struct Entry {
+        FlowKey key;
+        bool used{false};
+        uint32_t hash{0};
+        uint32_t last_seen{0};
+        // since the last call to top_flows()
+        uint64_t packets{0};
+        uint64_t bytes{0};
+    };
+
+private:
+    std::vector<Entry> _entries;
+    size_t _mask;
+    uint32_t _idle_timeout;
+    std::atomic<size_t> _size{0};
+    uint64_t _expired{0};
+
+    void _erase(size_t i);
+
+    bool _idle(const Entry &entry, uint32_t now) const
+    {
+        // timestamps may go backwards slightly, that is not idle
+        return now > entry.last_seen && now - entry.last_seen >= _idle_timeout;
+    }
+
+public:
+    FlowTable(size_t capacity, uint32_t idle_timeout);
+
+    /**
+     * find the entry for a flow, inserting it if it is new
+     * @return the entry, or nullptr if the flow could not be tracked because its probe window is full
+     */
+    Entry *find_or_insert(uint32_t hash, const FlowKey &key, uint32_t now, bool &inserted);
+
+    // remove flows which have been idle for at least the idle timeout, returns the number removed
+    size_t expire(uint32_t now);
+
+    // the n flows with the most bytes since the last call, resetting the per period packet and byte counts
+    std::vector<FlowRecord> top_flows(size_t n);
+
+    // number of flows expired (by expire() or by slot reuse) since the last call
+    uint64_t take_expired()
+    {
+        auto expired = _expired;
+        _expired = 0;
+        return expired;
+    }
+
+    size_t size() const
+    {
+        return _size.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return _entries.size();
+    }
+
+    uint32_t idle_timeout() const
+    {
+        return _idle_timeout;
+    }
+};
+
+/**
+ * The top flows of a period, ranked by bytes
+ *
+ * NOTE: intentionally _not_ thread safe; it should be protected by a mutex
+ */
+class TopFlows final : public Metric
+{
+    std::vector<FlowRecord> _flows;
+    size_t _top_count;
+
+public:
+    TopFlows(std::string schema_key, std::initializer_list<std::string> names, std::string desc, size_t top_count)
+        : Metric(schema_key, names, std::move(desc))
+        , _top_count(top_count)
+    {
+    }
+
+    void update(std::vector<FlowRecord> flows);
+    void merge(const TopFlows &other);
+
+    // Metric
+    void to_json(json &j) const override;
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
+};
+
+class FlowMetricsBucket final : public visor::AbstractMetricsBucket
+{
+public:
+    static constexpr size_t TOP_FLOWS = 10;
+
+protected:
+    mutable std::shared_mutex _mutex;
+
+    TopFlows _topFlows;
+
+    // total numPackets is tracked in base class num_events
+    struct counters {
+        Counter TCP;
+        Counter UDP;
+        Counter bytes;
+        Counter untracked;
+        Counter new_flows;
+        Counter expired_flows;
+        counters()
+            : TCP("flow", {"packets", "tcp"}, "Count of TCP packets")
+            , UDP("flow", {"packets", "udp"}, "Count of UDP packets")
+            , bytes("flow", {"bytes", "total"}, "Count of total bytes in TCP and UDP packets")
+            , untracked("flow", {"packets", "untracked"}, "Count of packets whose flow could not be tracked because the flow table was full")
+            , new_flows("flow", {"flows", "new"}, "Count of flows added to the flow table")
+            , expired_flows("flow", {"flows", "expired"}, "Count of idle flows removed from the flow table")
+        {
+        }
+    };
+    counters _counters;
+
+public:
+    FlowMetricsBucket()
+        : _topFlows("flow", {"top_flows_bytes"}, "Top flows (5-tuples) by bytes", TOP_FLOWS)
+    {
+        set_event_rate_info("flow", {"rates", "total"}, "Rate of all TCP and UDP packets per second");
+        set_num_events_info("flow", {"packets", "total"}, "Total TCP and UDP packets");
+        set_num_sample_info("flow", {"packets", "deep_samples"}, "Total TCP and UDP packets that were sampled for deep inspection");
+    }
+
+    // get a copy of the counters
+    counters counters() const
+    {
+        std::shared_lock lock(_mutex);
+        return _counters;
+    }
+
+    // visor::AbstractMetricsBucket
+    void specialized_merge(const AbstractMetricsBucket &other) override;
+    void to_json(json &j) const override;
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
+
+    // packets is more than 1 when a flow export record summarizes many packets
+    void process_packet(pcpp::ProtocolType l4, uint64_t bytes, bool tracked, bool new_flow, uint64_t packets = 1);
+    void process_flows(std::vector<FlowRecord> top_flows, uint64_t expired);
+};
+
+class FlowMetricsManager final : public visor::AbstractMetricsManager<FlowMetricsBucket>
+{
+    std::unique_ptr<FlowTable> _table;
+
+    void _report_flows(FlowMetricsBucket *bucket, uint32_t now);
+
+public:
+    FlowMetricsManager(const Configurable *window_config)
+        : visor::AbstractMetricsManager<FlowMetricsBucket>(window_config)
+    {
+    }
+
+    void set_flow_table(size_t capacity, uint32_t idle_timeout)
+    {
+        _table = std::make_unique<FlowTable>(capacity, idle_timeout);
+    }
+
+    const FlowTable *flow_table() const
+    {
+        return _table.get();
+    }
+
+    // the closing period receives its top flows from the flow table
+    void on_period_shift(timespec stamp, [[maybe_unused]] const FlowMetricsBucket *maybe_expiring_bucket) override;
+
+    // report the flows seen so far into the live period, e.g. at the end of a pcap file
+    void report_live_flows(timespec stamp);
+
+    void process_packet(pcpp::Packet &payload, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, timespec stamp);
+    void process_netflow(const NetflowDatagram &payload, timespec stamp);
+};
+
+class FlowStreamHandler final : public visor::StreamMetricsHandler<FlowMetricsManager>
+{
+public:
+    static constexpr uint64_t DEFAULT_TABLE_SIZE = 65536;
+    static constexpr uint64_t DEFAULT_IDLE_TIMEOUT = 120;
+
+private:
+    // the input stream sources we support (only one will be in use at a time)
+    PcapInputStream *_pcap_stream{nullptr};
+    FlowInputStream *_flow_stream{nullptr};
+
+    sigslot::connection _netflow_connection;
+    sigslot::connection _pkt_flow_connection;
+    sigslot::connection _start_tstamp_connection;
+    sigslot::connection _end_tstamp_connection;
+
+    void process_flow_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, timespec stamp);
+    void process_netflow_cb(const NetflowDatagram &payload);
+
+    void set_start_tstamp(timespec stamp);
+    void set_end_tstamp(timespec stamp);
+
+public:
+    FlowStreamHandler(const std::string &name, InputStream *stream, const Configurable *window_config, StreamHandler *handler = nullptr);
+    ~FlowStreamHandler() = default;
+
+    // visor::AbstractModule
+    std::string schema_key() const override
+    {
+        return "flow";
+    }
+
+    size_t consumer_count() const override
+    {
+        return 0;
+    }
+
+    void start() override;
+    void stop() override;
+    void info_json(json &j) const override;
+};
+
+}
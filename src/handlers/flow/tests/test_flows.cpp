@@ -0,0 +1,214 @@
+#include <catch2/catch.hpp>
+
+#include "FlowStreamHandler.h"
+#include "PcapInputStream.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+using namespace visor::handler::flow;
+using namespace visor::input::pcap;
+using namespace visor::input::flow;
+using namespace nlohmann;
+
+static FlowKey make_key(const char *src, uint16_t src_port, const char *dst, uint16_t dst_port)
+{
+    uint8_t s[4], d[4];
+    inet_pton(AF_INET, src, s);
+    inet_pton(AF_INET, dst, d);
+    return FlowKey(4, IPPROTO_UDP, s, src_port, d, dst_port);
+}
+
+TEST_CASE("Flow table", "[flow][table]")
+{
+    SECTION("direction independent keys")
+    {
+        auto a = make_key("10.0.0.1", 53, "10.0.0.2", 40000);
+        auto b = make_key("10.0.0.2", 40000, "10.0.0.1", 53);
+        CHECK(a == b);
+        CHECK(a.to_string() == "udp 10.0.0.1:53 <-> 10.0.0.2:40000");
+        CHECK(!(a == make_key("10.0.0.1", 53, "10.0.0.2", 40001)));
+    }
+
+    SECTION("fixed capacity")
+    {
+        FlowTable table(64, 120);
+        CHECK(table.capacity() == 64);
+        bool inserted;
+        // every flow hashes to the same slot, only a probe window worth can be tracked
+        for (uint16_t port = 1; port <= FlowTable::MAX_PROBE + 10; ++port) {
+            auto entry = table.find_or_insert(7, make_key("10.0.0.1", port, "10.0.0.2", 80), 1000, inserted);
+            if (port <= FlowTable::MAX_PROBE) {
+                CHECK(entry);
+                CHECK(inserted);
+            } else {
+                CHECK(!entry);
+            }
+        }
+        CHECK(table.size() == FlowTable::MAX_PROBE);
+        // existing flows are still found
+        auto entry = table.find_or_insert(7, make_key("10.0.0.2", 80, "10.0.0.1", 5), 1001, inserted);
+        CHECK(entry);
+        CHECK(!inserted);
+        // once idle, a new flow may take over a slot
+        entry = table.find_or_insert(7, make_key("10.0.0.3", 1, "10.0.0.2", 80), 1200, inserted);
+        CHECK(entry);
+        CHECK(inserted);
+        CHECK(table.take_expired() == 1);
+        CHECK(table.size() == FlowTable::MAX_PROBE);
+    }
+
+    SECTION("expire and top flows")
+    {
+        FlowTable table(64, 120);
+        bool inserted;
+        for (uint16_t port = 1; port <= 20; ++port) {
+            // two hash chains which overlap, so that expiring shifts entries back
+            auto entry = table.find_or_insert((port % 2) ? 60 : 62, make_key("10.0.0.1", port, "10.0.0.2", 80), (port <= 10) ? 1000 : 1100, inserted);
+            REQUIRE(entry);
+            entry->packets += port;
+            entry->bytes += port * 100;
+        }
+        auto top = table.top_flows(3);
+        REQUIRE(top.size() == 3);
+        CHECK(top[0].bytes == 2000);
+        CHECK(top[0].packets == 20);
+        CHECK(top[1].bytes == 1900);
+        CHECK(top[2].bytes == 1800);
+        // per period counts were reset
+        CHECK(table.top_flows(3).empty());
+
+        CHECK(table.expire(1150) == 10);
+        CHECK(table.size() == 10);
+        CHECK(table.take_expired() == 10);
+        // the remaining flows are all still reachable
+        for (uint16_t port = 11; port <= 20; ++port) {
+            auto entry = table.find_or_insert((port % 2) ? 60 : 62, make_key("10.0.0.1", port, "10.0.0.2", 80), 1150, inserted);
+            CHECK(entry);
+            CHECK(!inserted);
+        }
+        CHECK(table.size() == 10);
+    }
+
+    SECTION("expire a completely full table")
+    {
+        FlowTable table(FlowTable::MAX_PROBE, 120);
+        REQUIRE(table.capacity() == FlowTable::MAX_PROBE);
+        bool inserted;
+        // chains of four flows per home slot wrap around the whole ring
+        for (uint16_t port = 1; port <= FlowTable::MAX_PROBE; ++port) {
+            auto entry = table.find_or_insert((port % 8) * 4 + 3, make_key("10.0.0.1", port, "10.0.0.2", 80), (port % 2) ? 1000 : 1100, inserted);
+            REQUIRE(entry);
+            CHECK(inserted);
+        }
+        CHECK(table.size() == table.capacity());
+
+        CHECK(table.expire(1150) == FlowTable::MAX_PROBE / 2);
+        CHECK(table.size() == FlowTable::MAX_PROBE / 2);
+        for (uint16_t port = 2; port <= FlowTable::MAX_PROBE; port += 2) {
+            auto entry = table.find_or_insert((port % 8) * 4 + 3, make_key("10.0.0.1", port, "10.0.0.2", 80), 1150, inserted);
+            CHECK(entry);
+            CHECK(!inserted);
+        }
+
+        // refill, then expire everything from a full table
+        for (uint16_t port = 1; port <= FlowTable::MAX_PROBE; port += 2) {
+            REQUIRE(table.find_or_insert((port % 8) * 4 + 3, make_key("10.0.0.1", port, "10.0.0.2", 80), 1150, inserted));
+        }
+        CHECK(table.size() == table.capacity());
+        CHECK(table.expire(2000) == FlowTable::MAX_PROBE);
+        CHECK(table.size() == 0);
+    }
+}
+
+TEST_CASE("Parse flows from pcap", "[pcap][flow]")
+{
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_udp_tcp_random.pcap");
+    stream.config_set("bpf", "");
+    stream.config_set("host_spec", "192.168.0.0/24");
+    stream.parse_host_spec();
+
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    FlowStreamHandler flow_handler{"flow-test", &stream, &c};
+
+    flow_handler.start();
+    stream.start();
+    stream.stop();
+    flow_handler.stop();
+
+    auto counters = flow_handler.metrics()->bucket(0)->counters();
+    auto event_data = flow_handler.metrics()->bucket(0)->event_data_locked();
+
+    CHECK(event_data.num_events->value() == 16147);
+    CHECK(counters.TCP.value() == 13176);
+    CHECK(counters.UDP.value() == 2971);
+    CHECK(counters.untracked.value() == 0);
+    CHECK(counters.new_flows.value() > 0);
+    CHECK(counters.new_flows.value() == flow_handler.metrics()->flow_table()->size() + counters.expired_flows.value());
+
+    json j;
+    flow_handler.metrics()->bucket(0)->to_json(j);
+
+    REQUIRE(j["top_flows_bytes"].size() == FlowMetricsBucket::TOP_FLOWS);
+    CHECK(j["top_flows_bytes"][0]["bytes"] >= j["top_flows_bytes"][1]["bytes"]);
+    CHECK(j["top_flows_bytes"][0]["name"].get<std::string>().find("8.8.8.8:53") != std::string::npos);
+}
+
+TEST_CASE("Flow handler table configuration", "[pcap][flow]")
+{
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_udp_tcp_random.pcap");
+    stream.config_set("bpf", "");
+
+    visor::Config c;
+    FlowStreamHandler flow_handler{"flow-test", &stream, &c};
+    flow_handler.config_set<uint64_t>("table_size", 1000);
+    flow_handler.config_set<uint64_t>("idle_timeout", 30);
+    flow_handler.start();
+    flow_handler.stop();
+
+    CHECK(flow_handler.metrics()->flow_table()->capacity() == 1024);
+    CHECK(flow_handler.metrics()->flow_table()->idle_timeout() == 30);
+
+    FlowStreamHandler bad_handler{"flow-test-bad", &stream, &c};
+    bad_handler.config_set<uint64_t>("table_size", 1);
+    CHECK_THROWS_AS(bad_handler.start(), visor::ConfigException);
+}
+
+TEST_CASE("Parse flows from netflow and IPFIX exports", "[netflow][flow]")
+{
+    FlowInputStream stream{"flow-input-test"};
+    stream.config_set("pcap_file", "tests/fixtures/netflow.pcap");
+
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    FlowStreamHandler flow_handler{"flow-test", &stream, &c};
+
+    flow_handler.start();
+    stream.start();
+    stream.stop();
+    flow_handler.stop();
+
+    auto counters = flow_handler.metrics()->bucket(0)->counters();
+    auto event_data = flow_handler.metrics()->bucket(0)->event_data_locked();
+
+    // events and counters are the packets the records summarize (IPFIX is sampled 1 in 100)
+    CHECK(event_data.num_events->value() == 1014);
+    CHECK(event_data.num_events->value() == counters.TCP.value() + counters.UDP.value());
+    CHECK(counters.TCP.value() == 1010);
+    CHECK(counters.UDP.value() == 4);
+    CHECK(counters.bytes.value() == 855400);
+    // both directions of a conversation are a single flow
+    CHECK(counters.new_flows.value() == 5);
+    CHECK(flow_handler.metrics()->flow_table()->size() == 5);
+
+    json j;
+    flow_handler.metrics()->bucket(0)->to_json(j);
+
+    REQUIRE(j["top_flows_bytes"].size() == 5);
+    CHECK(j["top_flows_bytes"][0]["name"] == "tcp [2001:db8::10]:5000 <-> [2001:db8::20]:443");
+    CHECK(j["top_flows_bytes"][0]["bytes"] == 700000);
+    CHECK(j["top_flows_bytes"][0]["packets"] == 900);
+    CHECK(j["top_flows_bytes"][1]["name"] == "tcp 10.2.2.2:50000 <-> 10.3.3.4:443");
+}
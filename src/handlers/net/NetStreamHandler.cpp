@@ -13,6 +13,7 @@
 #pragma GCC diagnostic ignored "-Wpedantic"
 #include <IPv4Layer.h>
 #include <IPv6Layer.h>
+#include <TcpLayer.h>
 #pragma GCC diagnostic pop
 #include <arpa/inet.h>
 #include <cpc_union.hpp>
@@ -29,7 +30,8 @@ NetStreamHandler::NetStreamHandler(const std::string &name, InputStream *stream,
         _dnstap_stream = dynamic_cast<DnstapInputStream *>(stream);
         _mock_stream = dynamic_cast<MockInputStream *>(stream);
         _sflow_stream = dynamic_cast<SflowInputStream *>(stream);
-        if (!_pcap_stream && !_mock_stream && !_dnstap_stream && !_sflow_stream) {
+        _flow_stream = dynamic_cast<FlowInputStream *>(stream);
+        if (!_pcap_stream && !_mock_stream && !_dnstap_stream && !_sflow_stream && !_flow_stream) {
             throw StreamHandlerException(fmt::format("NetStreamHandler: unsupported input stream {}", stream->name()));
         }
     }
@@ -52,6 +54,23 @@ void NetStreamHandler::start()
         _metrics->set_recorded_stream();
     }
 
+    PrefixLengths prefix;
+    if (config_exists("ipv4_prefix_length")) {
+        auto len = config_get<uint64_t>("ipv4_prefix_length");
+        if (len < 1 || len > 32) {
+            throw ConfigException("ipv4_prefix_length must be between 1 and 32");
+        }
+        prefix.ipv4 = static_cast<uint8_t>(len);
+    }
+    if (config_exists("ipv6_prefix_length")) {
+        auto len = config_get<uint64_t>("ipv6_prefix_length");
+        if (len < 1 || len > 128) {
+            throw ConfigException("ipv6_prefix_length must be between 1 and 128");
+        }
+        prefix.ipv6 = static_cast<uint8_t>(len);
+    }
+    _metrics->set_prefix_lengths(prefix);
+
     if (_pcap_stream) {
         _pkt_connection = _pcap_stream->packet_signal.connect(&NetStreamHandler::process_packet_cb, this);
         _start_tstamp_connection = _pcap_stream->start_tstamp_signal.connect(&NetStreamHandler::set_start_tstamp, this);
@@ -59,7 +78,11 @@ void NetStreamHandler::start()
     } else if (_dnstap_stream) {
         _dnstap_connection = _dnstap_stream->dnstap_signal.connect(&NetStreamHandler::process_dnstap_cb, this);
     } else if (_sflow_stream) {
-        _sflow_connection = _sflow_stream->sflow_signal.connect(&NetStreamHandler::process_sflow_cb, this);
+        // only flow samples are counted, from their sampled header or IPv4/IPv6 struct
+        _sflow_stream->require_decode(this, DECODE_FLOW_SAMPLES);
+        _sflow_connection = _sflow_stream->sflow_connect(&NetStreamHandler::process_sflow_cb, this);
+    } else if (_flow_stream) {
+        _netflow_connection = _flow_stream->netflow_signal.connect(&NetStreamHandler::process_netflow_cb, this);
     } else if (_dns_handler) {
         _pkt_udp_connection = _dns_handler->udp_signal.connect(&NetStreamHandler::process_udp_packet_cb, this);
     }
@@ -80,7 +103,10 @@ void NetStreamHandler::stop()
     } else if (_dnstap_stream) {
         _dnstap_connection.disconnect();
     } else if (_sflow_stream) {
-        _sflow_connection.disconnect();
+        _sflow_stream->sflow_disconnect(_sflow_connection);
+        _sflow_stream->release_decode(this);
+    } else if (_flow_stream) {
+        _netflow_connection.disconnect();
     } else if (_dns_handler) {
         _pkt_udp_connection.disconnect();
     }
@@ -88,6 +114,17 @@ void NetStreamHandler::stop()
     _running = false;
 }
 
+void NetStreamHandler::info_json(json &j) const
+{
+    common_info_json(j);
+    if (geo::GeoIP().enabled()) {
+        geo::GeoIP().info_json(j[schema_key()]["geo"]["city"]);
+    }
+    if (geo::GeoASN().enabled()) {
+        geo::GeoASN().info_json(j[schema_key()]["geo"]["asn"]);
+    }
+}
+
 NetStreamHandler::~NetStreamHandler()
 {
 }
@@ -113,6 +150,11 @@ void NetStreamHandler::process_sflow_cb(const SFSample &payload)
     _metrics->process_sflow(payload);
 }
 
+void NetStreamHandler::process_netflow_cb(const NetflowDatagram &payload)
+{
+    _metrics->process_netflow(payload);
+}
+
 void NetStreamHandler::process_dnstap_cb(const dnstap::Dnstap &payload)
 {
     _metrics->process_dnstap(payload);
@@ -123,6 +165,78 @@ void NetStreamHandler::process_udp_packet_cb(pcpp::Packet &payload, PacketDirect
     _metrics->process_packet(payload, dir, l3, pcpp::UDP, stamp);
 }
 
+static std::string sflow_agent_name(const SFLAddress &addr)
+{
+    switch (addr.type) {
+    case SFLADDRESSTYPE_IP_V4:
+        return pcpp::IPv4Address(addr.address.ip_v4.addr).toString();
+    case SFLADDRESSTYPE_IP_V6:
+        return pcpp::IPv6Address(addr.address.ip_v6.addr).toString();
+    default:
+        return "unknown";
+    }
+}
+
+void AgentCounters::agent::merge(const agent &other)
+{
+    datagrams += other.datagrams;
+    samples += other.samples;
+    packets += other.packets;
+    bytes += other.bytes;
+}
+
+void AgentCounters::update(const std::string &agent_addr, uint64_t samples, uint64_t packets, uint64_t bytes)
+{
+    auto &a = _counts[agent_addr];
+    ++a.datagrams;
+    a.samples += samples;
+    a.packets += packets;
+    a.bytes += bytes;
+}
+
+void AgentCounters::merge(const AgentCounters &other)
+{
+    for (const auto &[name, a] : other._counts) {
+        _counts[name].merge(a);
+    }
+}
+
+void AgentCounters::to_json(json &j) const
+{
+    if (_counts.empty()) {
+        return;
+    }
+    json section;
+    for (const auto &[name, a] : _counts) {
+        auto &entry = section[name];
+        entry["datagrams"] = a.datagrams;
+        entry["flow_samples"] = a.samples;
+        entry["packets"] = a.packets;
+        entry["bytes"] = a.bytes;
+    }
+    name_json_assign(j, section);
+}
+
+void AgentCounters::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels) const
+{
+    if (_counts.empty()) {
+        return;
+    }
+    auto write = [&](const std::string &suffix, const std::string &desc, uint64_t agent::*field) {
+        out << "# HELP " << base_name_snake() << "_" << suffix << ' ' << _desc << " (" << desc << ")" << std::endl;
+        out << "# TYPE " << base_name_snake() << "_" << suffix << " gauge" << std::endl;
+        for (const auto &[name, a] : _counts) {
+            LabelMap l(add_labels);
+            l["agent"] = name;
+            out << name_snake({suffix}, l) << ' ' << a.*field << std::endl;
+        }
+    };
+    write("datagrams", "datagrams", &agent::datagrams);
+    write("flow_samples", "flow samples", &agent::samples);
+    write("packets", "packets, scaled by sampling rate", &agent::packets);
+    write("bytes", "bytes, scaled by sampling rate", &agent::bytes);
+}
+
 void NetworkMetricsBucket::specialized_merge(const AbstractMetricsBucket &o)
 {
     // static because caller guarantees only our own bucket type
@@ -131,6 +245,8 @@ void NetworkMetricsBucket::specialized_merge(const AbstractMetricsBucket &o)
     // rates maintain their own thread safety
     _rate_in.merge(other._rate_in);
     _rate_out.merge(other._rate_out);
+    _rate_bytes_in.merge(other._rate_bytes_in);
+    _rate_bytes_out.merge(other._rate_bytes_out);
 
     std::shared_lock r_lock(other._mutex);
     std::unique_lock w_lock(_mutex);
@@ -138,16 +254,33 @@ void NetworkMetricsBucket::specialized_merge(const AbstractMetricsBucket &o)
     _counters.UDP += other._counters.UDP;
     _counters.TCP += other._counters.TCP;
     _counters.OtherL4 += other._counters.OtherL4;
+    _counters.TCP_SYN += other._counters.TCP_SYN;
+    _counters.TCP_SYNACK += other._counters.TCP_SYNACK;
+    _counters.TCP_RST += other._counters.TCP_RST;
+    _counters.TCP_FIN += other._counters.TCP_FIN;
     _counters.IPv4 += other._counters.IPv4;
     _counters.IPv6 += other._counters.IPv6;
     _counters.total_in += other._counters.total_in;
     _counters.total_out += other._counters.total_out;
+    _counters.bytes_in += other._counters.bytes_in;
+    _counters.bytes_out += other._counters.bytes_out;
+    _counters.bytes_total += other._counters.bytes_total;
+
+    _packetSize.merge(other._packetSize);
+    _sflowAgents.merge(other._sflowAgents);
 
     _srcIPCard.merge(other._srcIPCard);
     _dstIPCard.merge(other._dstIPCard);
+    _srcPrefixCard.merge(other._srcPrefixCard);
 
     _topIPv4.merge(other._topIPv4);
     _topIPv6.merge(other._topIPv6);
+    _topIPv4Prefix.merge(other._topIPv4Prefix);
+    _topIPv4PrefixBytes.merge(other._topIPv4PrefixBytes);
+    _topIPv6Prefix.merge(other._topIPv6Prefix);
+    _topIPv6PrefixBytes.merge(other._topIPv6PrefixBytes);
+    _synIPv4.merge(other._synIPv4);
+    _synIPv6.merge(other._synIPv6);
     _topGeoLoc.merge(other._topGeoLoc);
     _topASN.merge(other._topASN);
 }
@@ -157,6 +290,8 @@ void NetworkMetricsBucket::to_prometheus(std::stringstream &out, Metric::LabelMa
 
     _rate_in.to_prometheus(out, add_labels);
     _rate_out.to_prometheus(out, add_labels);
+    _rate_bytes_in.to_prometheus(out, add_labels);
+    _rate_bytes_out.to_prometheus(out, add_labels);
 
     {
         auto [num_events, num_samples, event_rate, event_lock] = event_data_locked(); // thread safe
@@ -171,18 +306,37 @@ void NetworkMetricsBucket::to_prometheus(std::stringstream &out, Metric::LabelMa
     _counters.UDP.to_prometheus(out, add_labels);
     _counters.TCP.to_prometheus(out, add_labels);
     _counters.OtherL4.to_prometheus(out, add_labels);
+    _counters.TCP_SYN.to_prometheus(out, add_labels);
+    _counters.TCP_SYNACK.to_prometheus(out, add_labels);
+    _counters.TCP_RST.to_prometheus(out, add_labels);
+    _counters.TCP_FIN.to_prometheus(out, add_labels);
     _counters.IPv4.to_prometheus(out, add_labels);
     _counters.IPv6.to_prometheus(out, add_labels);
     _counters.total_in.to_prometheus(out, add_labels);
     _counters.total_out.to_prometheus(out, add_labels);
+    _counters.bytes_in.to_prometheus(out, add_labels);
+    _counters.bytes_out.to_prometheus(out, add_labels);
+    _counters.bytes_total.to_prometheus(out, add_labels);
+
+    _packetSize.to_prometheus(out, add_labels);
+    _sflowAgents.to_prometheus(out, add_labels);
 
     _srcIPCard.to_prometheus(out, add_labels);
     _dstIPCard.to_prometheus(out, add_labels);
+    _srcPrefixCard.to_prometheus(out, add_labels);
 
     _topIPv4.to_prometheus(out, add_labels, [](const uint32_t &val) { return pcpp::IPv4Address(val).toString(); });
     _topIPv6.to_prometheus(out, add_labels);
-    _topGeoLoc.to_prometheus(out, add_labels);
-    _topASN.to_prometheus(out, add_labels);
+    auto ipv4_prefix = [this](const uint32_t &val) { return fmt::format("{}/{}", pcpp::IPv4Address(val).toString(), _prefix_lengths.ipv4); };
+    auto ipv6_prefix = [this](const IPv6Key &val) { return fmt::format("{}/{}", val.to_string(), _prefix_lengths.ipv6); };
+    _topIPv4Prefix.to_prometheus(out, add_labels, ipv4_prefix);
+    _topIPv4PrefixBytes.to_prometheus(out, add_labels, ipv4_prefix);
+    _topIPv6Prefix.to_prometheus(out, add_labels, ipv6_prefix);
+    _topIPv6PrefixBytes.to_prometheus(out, add_labels, ipv6_prefix);
+    _synIPv4.to_prometheus(out, add_labels, [](const uint32_t &val) { return pcpp::IPv4Address(val).toString(); });
+    _synIPv6.to_prometheus(out, add_labels);
+    _topGeoLoc.to_prometheus(out, add_labels, [](const uint32_t &val) { return geo::LookupNames().name(val); });
+    _topASN.to_prometheus(out, add_labels, [](const uint32_t &val) { return geo::LookupNames().name(val); });
 }
 
 void NetworkMetricsBucket::to_json(json &j) const
@@ -192,6 +346,8 @@ void NetworkMetricsBucket::to_json(json &j) const
     bool live_rates = !read_only() && !recorded_stream();
     _rate_in.to_json(j, live_rates);
     _rate_out.to_json(j, live_rates);
+    _rate_bytes_in.to_json(j, live_rates);
+    _rate_bytes_out.to_json(j, live_rates);
 
     {
         auto [num_events, num_samples, event_rate, event_lock] = event_data_locked(); // thread safe
@@ -206,18 +362,99 @@ void NetworkMetricsBucket::to_json(json &j) const
     _counters.UDP.to_json(j);
     _counters.TCP.to_json(j);
     _counters.OtherL4.to_json(j);
+    _counters.TCP_SYN.to_json(j);
+    _counters.TCP_SYNACK.to_json(j);
+    _counters.TCP_RST.to_json(j);
+    _counters.TCP_FIN.to_json(j);
     _counters.IPv4.to_json(j);
     _counters.IPv6.to_json(j);
     _counters.total_in.to_json(j);
     _counters.total_out.to_json(j);
+    _counters.bytes_in.to_json(j);
+    _counters.bytes_out.to_json(j);
+    _counters.bytes_total.to_json(j);
+
+    _packetSize.to_json(j);
+    _sflowAgents.to_json(j);
 
     _srcIPCard.to_json(j);
     _dstIPCard.to_json(j);
+    _srcPrefixCard.to_json(j);
 
     _topIPv4.to_json(j, [](const uint32_t &val) { return pcpp::IPv4Address(val).toString(); });
     _topIPv6.to_json(j);
-    _topGeoLoc.to_json(j);
-    _topASN.to_json(j);
+    auto ipv4_prefix = [this](const uint32_t &val) { return fmt::format("{}/{}", pcpp::IPv4Address(val).toString(), _prefix_lengths.ipv4); };
+    auto ipv6_prefix = [this](const IPv6Key &val) { return fmt::format("{}/{}", val.to_string(), _prefix_lengths.ipv6); };
+    _topIPv4Prefix.to_json(j, ipv4_prefix);
+    _topIPv4PrefixBytes.to_json(j, ipv4_prefix);
+    _topIPv6Prefix.to_json(j, ipv6_prefix);
+    _topIPv6PrefixBytes.to_json(j, ipv6_prefix);
+    _synIPv4.to_json(j, [](const uint32_t &val) { return pcpp::IPv4Address(val).toString(); });
+    _synIPv6.to_json(j);
+    _topGeoLoc.to_json(j, [](const uint32_t &val) { return geo::LookupNames().name(val); });
+    _topASN.to_json(j, [](const uint32_t &val) { return geo::LookupNames().name(val); });
+}
+
+// addr is in network byte order, as returned by pcpp::IPv4Address::toInt()
+void NetworkMetricsBucket::_process_ipv4_prefix(uint32_t addr, bool is_src, uint64_t bytes, uint64_t packets)
+{
+    uint32_t prefix = addr & htonl(~uint32_t(0) << (32 - _prefix_lengths.ipv4));
+    if (is_src) {
+        _srcPrefixCard.update(prefix);
+    }
+    _topIPv4Prefix.update(prefix, packets);
+    if (bytes) {
+        _topIPv4PrefixBytes.update(prefix, bytes);
+    }
+}
+
+void NetworkMetricsBucket::_process_ipv6_prefix(const uint8_t *addr, bool is_src, uint64_t bytes, uint64_t packets)
+{
+    IPv6Key prefix(addr, _prefix_lengths.ipv6);
+    if (is_src) {
+        _srcPrefixCard.update(reinterpret_cast<const void *>(prefix.bytes.data()), prefix.bytes.size());
+    }
+    _topIPv6Prefix.update(prefix, packets);
+    if (bytes) {
+        _topIPv6PrefixBytes.update(prefix, bytes);
+    }
+}
+
+void NetworkMetricsBucket::_process_tcp_flags(uint8_t flags, uint64_t weight)
+{
+    if (flags & TH_SYN) {
+        if (flags & TH_ACK) {
+            _counters.TCP_SYNACK += weight;
+        } else {
+            _counters.TCP_SYN += weight;
+        }
+    }
+    if (flags & TH_RST) {
+        _counters.TCP_RST += weight;
+    }
+    if (flags & TH_FIN) {
+        _counters.TCP_FIN += weight;
+    }
+}
+
+void NetworkMetricsBucket::_process_bytes(PacketDirection dir, uint64_t bytes, uint64_t weight)
+{
+    // the size distribution is of the packets actually seen, volume is scaled up by the weight
+    _packetSize.update(bytes);
+    bytes *= weight;
+    _counters.bytes_total += bytes;
+    switch (dir) {
+    case PacketDirection::fromHost:
+        _counters.bytes_out += bytes;
+        _rate_bytes_out += bytes;
+        break;
+    case PacketDirection::toHost:
+        _counters.bytes_in += bytes;
+        _rate_bytes_in += bytes;
+        break;
+    case PacketDirection::unknown:
+        break;
+    }
 }
 
 // the main bucket analysis
@@ -226,6 +463,9 @@ void NetworkMetricsBucket::process_packet(bool deep, pcpp::Packet &payload, Pack
 
     std::unique_lock lock(_mutex);
 
+    uint64_t bytes = payload.getRawPacket()->getFrameLength();
+    _process_bytes(dir, bytes);
+
     switch (dir) {
     case PacketDirection::fromHost:
         ++_counters.total_out;
@@ -250,12 +490,18 @@ void NetworkMetricsBucket::process_packet(bool deep, pcpp::Packet &payload, Pack
         break;
     }
 
+    uint8_t tcp_flags{0};
     switch (l4) {
     case pcpp::UDP:
         ++_counters.UDP;
         break;
     case pcpp::TCP:
         ++_counters.TCP;
+        if (auto tcp = payload.getLayerOfType<pcpp::TcpLayer>()) {
+            // the flags byte follows the data offset, 13 bytes into the header
+            tcp_flags = tcp->getData()[13];
+            _process_tcp_flags(tcp_flags);
+        }
         break;
     default:
         ++_counters.OtherL4;
@@ -272,57 +518,67 @@ void NetworkMetricsBucket::process_packet(bool deep, pcpp::Packet &payload, Pack
     auto IP4layer = payload.getLayerOfType<pcpp::IPv4Layer>();
     auto IP6layer = payload.getLayerOfType<pcpp::IPv6Layer>();
     if (IP4layer) {
+        if (tcp_flags & TH_SYN) {
+            _synIPv4.update(tcp_flags, IP4layer->getSrcIPv4Address().toInt(), IP4layer->getDstIPv4Address().toInt());
+        }
         if (dir == PacketDirection::toHost) {
             _srcIPCard.update(IP4layer->getSrcIPv4Address().toInt());
             _topIPv4.update(IP4layer->getSrcIPv4Address().toInt());
+            _process_ipv4_prefix(IP4layer->getSrcIPv4Address().toInt(), true, bytes);
             if (geo::enabled()) {
                 if (IPv4tosockaddr(IP4layer->getSrcIPv4Address(), &sa4)) {
                     if (geo::GeoIP().enabled()) {
-                        _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                        _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa4)));
                     }
                     if (geo::GeoASN().enabled()) {
-                        _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                        _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa4)));
                     }
                 }
             }
         } else if (dir == PacketDirection::fromHost) {
             _dstIPCard.update(IP4layer->getDstIPv4Address().toInt());
             _topIPv4.update(IP4layer->getDstIPv4Address().toInt());
+            _process_ipv4_prefix(IP4layer->getDstIPv4Address().toInt(), false, bytes);
             if (geo::enabled()) {
                 if (IPv4tosockaddr(IP4layer->getDstIPv4Address(), &sa4)) {
                     if (geo::GeoIP().enabled()) {
-                        _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                        _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa4)));
                     }
                     if (geo::GeoASN().enabled()) {
-                        _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                        _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa4)));
                     }
                 }
             }
         }
     } else if (IP6layer) {
+        if (tcp_flags & TH_SYN) {
+            _synIPv6.update(tcp_flags, IPv6Key(IP6layer->getSrcIPv6Address().toBytes()), IPv6Key(IP6layer->getDstIPv6Address().toBytes()));
+        }
         if (dir == PacketDirection::toHost) {
             _srcIPCard.update(reinterpret_cast<const void *>(IP6layer->getSrcIPv6Address().toBytes()), 16);
-            _topIPv6.update(IP6layer->getSrcIPv6Address().toString());
+            _topIPv6.update(IPv6Key(IP6layer->getSrcIPv6Address().toBytes()));
+            _process_ipv6_prefix(IP6layer->getSrcIPv6Address().toBytes(), true, bytes);
             if (geo::enabled()) {
                 if (IPv6tosockaddr(IP6layer->getSrcIPv6Address(), &sa6)) {
                     if (geo::GeoIP().enabled()) {
-                        _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                        _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa6)));
                     }
                     if (geo::GeoASN().enabled()) {
-                        _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                        _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa6)));
                     }
                 }
             }
         } else if (dir == PacketDirection::fromHost) {
             _dstIPCard.update(reinterpret_cast<const void *>(IP6layer->getDstIPv6Address().toBytes()), 16);
-            _topIPv6.update(IP6layer->getDstIPv6Address().toString());
+            _topIPv6.update(IPv6Key(IP6layer->getDstIPv6Address().toBytes()));
+            _process_ipv6_prefix(IP6layer->getDstIPv6Address().toBytes(), false, bytes);
             if (geo::enabled()) {
                 if (IPv6tosockaddr(IP6layer->getDstIPv6Address(), &sa6)) {
                     if (geo::GeoIP().enabled()) {
-                        _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                        _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa6)));
                     }
                     if (geo::GeoASN().enabled()) {
-                        _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                        _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa6)));
                     }
                 }
             }
@@ -385,31 +641,36 @@ void NetworkMetricsBucket::process_dnstap(bool deep, const dnstap::Dnstap &paylo
     struct sockaddr_in sa4;
     struct sockaddr_in6 sa6;
 
+    // dnstap carries no link layer frame, so prefix byte counts use the DNS message size
+    uint64_t bytes = payload.message().has_response_message() ? payload.message().response_message().size() : payload.message().query_message().size();
+
     if (!is_ipv6 && payload.message().has_query_address() && payload.message().query_address().size() >= 4) {
         auto ip = pcpp::IPv4Address(reinterpret_cast<const uint8_t *>(payload.message().query_address().data()));
         _srcIPCard.update(ip.toInt());
         _topIPv4.update(ip.toInt());
+        _process_ipv4_prefix(ip.toInt(), true, bytes);
         if (geo::enabled()) {
             if (IPv4tosockaddr(ip, &sa4)) {
                 if (geo::GeoIP().enabled()) {
-                    _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                    _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa4)));
                 }
                 if (geo::GeoASN().enabled()) {
-                    _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                    _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa4)));
                 }
             }
         }
     } else if (is_ipv6 && payload.message().has_query_address() && payload.message().query_address().size() == 16) {
         auto ip = pcpp::IPv6Address(reinterpret_cast<const uint8_t *>(payload.message().query_address().data()));
         _srcIPCard.update(reinterpret_cast<const void *>(ip.toBytes()), 16);
-        _topIPv6.update(ip.toString());
+        _topIPv6.update(IPv6Key(ip.toBytes()));
+        _process_ipv6_prefix(ip.toBytes(), true, bytes);
         if (geo::enabled()) {
             if (IPv6tosockaddr(ip, &sa6)) {
                 if (geo::GeoIP().enabled()) {
-                    _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                    _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa6)));
                 }
                 if (geo::GeoASN().enabled()) {
-                    _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                    _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa6)));
                 }
             }
         }
@@ -419,66 +680,103 @@ void NetworkMetricsBucket::process_dnstap(bool deep, const dnstap::Dnstap &paylo
 void NetworkMetricsBucket::process_sflow(bool deep, const SFSample &payload)
 {
     std::unique_lock lock(_mutex);
+
+    uint64_t agent_samples{0};
+    uint64_t agent_packets{0};
+    uint64_t agent_bytes{0};
+
     for (const auto &sample : payload.elements) {
 
+        // counter samples describe interfaces, not packets
+        switch (sample.sampleType) {
+        case SFLFLOW_SAMPLE:
+        case SFLFLOW_SAMPLE_EXPANDED:
+            break;
+        default:
+            continue;
+        }
+
+        // each flow sample stands for meanSkipCount (the sampling rate) packets
+        uint64_t weight = sample.meanSkipCount ? sample.meanSkipCount : 1;
+        ++agent_samples;
+        agent_packets += weight;
+        agent_bytes += sample.sampledPacketSize * weight;
+
         if (sample.gotIPV4) {
-            ++_counters.IPv4;
+            _counters.IPv4 += weight;
         } else if (sample.gotIPV6) {
-            ++_counters.IPv6;
+            _counters.IPv6 += weight;
         }
 
+        uint8_t tcp_flags{0};
         switch (sample.dcd_ipProtocol) {
         case IP_PROTOCOL::TCP:
-            ++_counters.TCP;
+            _counters.TCP += weight;
+            tcp_flags = static_cast<uint8_t>(sample.dcd_tcpFlags);
+            _process_tcp_flags(tcp_flags, weight);
             break;
         case IP_PROTOCOL::UDP:
-            ++_counters.UDP;
+            _counters.UDP += weight;
             break;
         default:
-            ++_counters.OtherL4;
+            _counters.OtherL4 += weight;
             break;
         }
 
         if (sample.ifCounters.ifDirection == DIRECTION::IN) {
-            ++_counters.total_in;
-            ++_rate_in;
+            _counters.total_in += weight;
+            _rate_in += weight;
+            _process_bytes(PacketDirection::toHost, sample.sampledPacketSize, weight);
         } else if (sample.ifCounters.ifDirection == DIRECTION::OUT) {
-            ++_counters.total_out;
-            ++_rate_out;
+            _counters.total_out += weight;
+            _rate_out += weight;
+            _process_bytes(PacketDirection::fromHost, sample.sampledPacketSize, weight);
+        } else {
+            _process_bytes(PacketDirection::unknown, sample.sampledPacketSize, weight);
         }
 
         if (!deep) {
-            return;
+            continue;
         }
 
         struct sockaddr_in sa4;
         struct sockaddr_in6 sa6;
 
+        if (tcp_flags & TH_SYN) {
+            if (sample.ipsrc.type == SFLADDRESSTYPE_IP_V4 && sample.ipdst.type == SFLADDRESSTYPE_IP_V4) {
+                _synIPv4.update(tcp_flags, pcpp::IPv4Address(sample.ipsrc.address.ip_v4.addr).toInt(), pcpp::IPv4Address(sample.ipdst.address.ip_v4.addr).toInt(), weight);
+            } else if (sample.ipsrc.type == SFLADDRESSTYPE_IP_V6 && sample.ipdst.type == SFLADDRESSTYPE_IP_V6) {
+                _synIPv6.update(tcp_flags, IPv6Key(sample.ipsrc.address.ip_v6.addr), IPv6Key(sample.ipdst.address.ip_v6.addr), weight);
+            }
+        }
+
         if (sample.ipsrc.type == SFLADDRESSTYPE_IP_V4) {
             auto ip = pcpp::IPv4Address(sample.ipsrc.address.ip_v4.addr);
             _srcIPCard.update(ip.toInt());
-            _topIPv4.update(ip.toInt());
+            _topIPv4.update(ip.toInt(), weight);
+            _process_ipv4_prefix(ip.toInt(), true, sample.sampledPacketSize * weight, weight);
             if (geo::enabled()) {
                 if (IPv4tosockaddr(ip, &sa4)) {
                     if (geo::GeoIP().enabled()) {
-                        _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                        _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa4)), weight);
                     }
                     if (geo::GeoASN().enabled()) {
-                        _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                        _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa4)), weight);
                     }
                 }
             }
         } else if (sample.ipsrc.type == SFLADDRESSTYPE_IP_V6) {
             auto ip = pcpp::IPv6Address(sample.ipsrc.address.ip_v6.addr);
             _srcIPCard.update(reinterpret_cast<const void *>(ip.toBytes()), 16);
-            _topIPv6.update(ip.toString());
+            _topIPv6.update(IPv6Key(ip.toBytes()), weight);
+            _process_ipv6_prefix(ip.toBytes(), true, sample.sampledPacketSize * weight, weight);
             if (geo::enabled()) {
                 if (IPv6tosockaddr(ip, &sa6)) {
                     if (geo::GeoIP().enabled()) {
-                        _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                        _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa6)), weight);
                     }
                     if (geo::GeoASN().enabled()) {
-                        _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                        _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa6)), weight);
                     }
                 }
             }
@@ -487,28 +785,136 @@ void NetworkMetricsBucket::process_sflow(bool deep, const SFSample &payload)
         if (sample.ipdst.type == SFLADDRESSTYPE_IP_V4) {
             auto ip = pcpp::IPv4Address(sample.ipdst.address.ip_v4.addr);
             _dstIPCard.update(ip.toInt());
-            _topIPv4.update(ip.toInt());
+            _topIPv4.update(ip.toInt(), weight);
+            _process_ipv4_prefix(ip.toInt(), false, sample.sampledPacketSize * weight, weight);
             if (geo::enabled()) {
                 if (IPv4tosockaddr(ip, &sa4)) {
                     if (geo::GeoIP().enabled()) {
-                        _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                        _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa4)), weight);
                     }
                     if (geo::GeoASN().enabled()) {
-                        _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa4)));
+                        _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa4)), weight);
                     }
                 }
             }
         } else if (sample.ipdst.type == SFLADDRESSTYPE_IP_V6) {
             auto ip = pcpp::IPv6Address(sample.ipdst.address.ip_v6.addr);
             _dstIPCard.update(reinterpret_cast<const void *>(ip.toBytes()), 16);
-            _topIPv6.update(ip.toString());
+            _topIPv6.update(IPv6Key(ip.toBytes()), weight);
+            _process_ipv6_prefix(ip.toBytes(), false, sample.sampledPacketSize * weight, weight);
             if (geo::enabled()) {
                 if (IPv6tosockaddr(ip, &sa6)) {
                     if (geo::GeoIP().enabled()) {
-                        _topGeoLoc.update(geo::GeoIP().getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                        _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa6)), weight);
                     }
                     if (geo::GeoASN().enabled()) {
-                        _topASN.update(geo::GeoASN().getASNString(reinterpret_cast<struct sockaddr *>(&sa6)));
+                        _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa6)), weight);
+                    }
+                }
+            }
+        }
+    }
+
+    _sflowAgents.update(sflow_agent_name(payload.agent_addr), agent_samples, agent_packets, agent_bytes);
+}
+
+void NetworkMetricsBucket::process_netflow(bool deep, const NetflowDatagram &payload)
+{
+    std::unique_lock lock(_mutex);
+
+    for (const auto &record : payload.records) {
+
+        // a record summarizes many packets, scaled up again if the exporter sampled them
+        uint64_t packets = record.packets * record.sampling_rate;
+        uint64_t bytes = record.bytes * record.sampling_rate;
+
+        if (record.ip_version == 4) {
+            _counters.IPv4 += packets;
+        } else if (record.ip_version == 6) {
+            _counters.IPv6 += packets;
+        }
+
+        // the TCP flags of a record are the union over all of its packets, so they are not counted per packet
+        switch (record.protocol) {
+        case IPPROTO_TCP:
+            _counters.TCP += packets;
+            break;
+        case IPPROTO_UDP:
+            _counters.UDP += packets;
+            break;
+        default:
+            _counters.OtherL4 += packets;
+            break;
+        }
+
+        // the size distribution uses the mean packet size of the flow
+        if (record.packets) {
+            _packetSize.update(record.bytes / record.packets);
+        }
+        _counters.bytes_total += bytes;
+        switch (record.direction) {
+        case FlowDirection::ingress:
+            _counters.total_in += packets;
+            _rate_in += packets;
+            _counters.bytes_in += bytes;
+            _rate_bytes_in += bytes;
+            break;
+        case FlowDirection::egress:
+            _counters.total_out += packets;
+            _rate_out += packets;
+            _counters.bytes_out += bytes;
+            _rate_bytes_out += bytes;
+            break;
+        case FlowDirection::unknown:
+            break;
+        }
+
+        if (!deep) {
+            continue;
+        }
+
+        struct sockaddr_in sa4;
+        struct sockaddr_in6 sa6;
+
+        if (record.ip_version == 4) {
+            for (auto [addr, is_src] : {std::make_pair(record.src_addr.data(), true), std::make_pair(record.dst_addr.data(), false)}) {
+                auto ip = pcpp::IPv4Address(addr);
+                if (is_src) {
+                    _srcIPCard.update(ip.toInt());
+                } else {
+                    _dstIPCard.update(ip.toInt());
+                }
+                _topIPv4.update(ip.toInt(), packets);
+                _process_ipv4_prefix(ip.toInt(), is_src, bytes, packets);
+                if (geo::enabled()) {
+                    if (IPv4tosockaddr(ip, &sa4)) {
+                        if (geo::GeoIP().enabled()) {
+                            _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa4)), packets);
+                        }
+                        if (geo::GeoASN().enabled()) {
+                            _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa4)), packets);
+                        }
+                    }
+                }
+            }
+        } else if (record.ip_version == 6) {
+            for (auto [addr, is_src] : {std::make_pair(record.src_addr.data(), true), std::make_pair(record.dst_addr.data(), false)}) {
+                auto ip = pcpp::IPv6Address(addr);
+                if (is_src) {
+                    _srcIPCard.update(reinterpret_cast<const void *>(ip.toBytes()), 16);
+                } else {
+                    _dstIPCard.update(reinterpret_cast<const void *>(ip.toBytes()), 16);
+                }
+                _topIPv6.update(IPv6Key(ip.toBytes()), packets);
+                _process_ipv6_prefix(ip.toBytes(), is_src, bytes, packets);
+                if (geo::enabled()) {
+                    if (IPv6tosockaddr(ip, &sa6)) {
+                        if (geo::GeoIP().enabled()) {
+                            _topGeoLoc.update(geo::GeoIP().getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa6)), packets);
+                        }
+                        if (geo::GeoASN().enabled()) {
+                            _topASN.update(geo::GeoASN().getASNId(reinterpret_cast<struct sockaddr *>(&sa6)), packets);
+                        }
                     }
                 }
             }
@@ -520,9 +926,9 @@ void NetworkMetricsBucket::process_sflow(bool deep, const SFSample &payload)
 void NetworkMetricsManager::process_packet(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, timespec stamp)
 {
     // base event
-    new_event(stamp);
+    auto deep = new_event(stamp);
     // process in the "live" bucket
-    live_bucket()->process_packet(_deep_sampling_now, payload, dir, l3, l4);
+    live_bucket()->process_packet(deep, payload, dir, l3, l4);
 }
 
 void NetworkMetricsManager::process_dnstap(const dnstap::Dnstap &payload)
@@ -553,9 +959,9 @@ void NetworkMetricsManager::process_dnstap(const dnstap::Dnstap &payload)
         std::timespec_get(&stamp, TIME_UTC);
     }
     // base event
-    new_event(stamp);
+    auto deep = new_event(stamp);
     // process in the "live" bucket. this will parse the resources if we are deep sampling
-    live_bucket()->process_dnstap(_deep_sampling_now, payload);
+    live_bucket()->process_dnstap(deep, payload);
 }
 
 void NetworkMetricsManager::process_sflow(const SFSample &payload)
@@ -563,9 +969,30 @@ void NetworkMetricsManager::process_sflow(const SFSample &payload)
     timespec stamp;
     // use now()
     std::timespec_get(&stamp, TIME_UTC);
-    // base event
-    new_event(stamp);
+    // base event, counting the packets the flow samples stand for rather than the datagram
+    uint64_t packets{0};
+    for (const auto &sample : payload.elements) {
+        if (sample.sampleType == SFLFLOW_SAMPLE || sample.sampleType == SFLFLOW_SAMPLE_EXPANDED) {
+            packets += sample.meanSkipCount ? sample.meanSkipCount : 1;
+        }
+    }
+    auto deep = new_event(stamp, true, packets);
     // process in the "live" bucket
-    live_bucket()->process_sflow(_deep_sampling_now, payload);
+    live_bucket()->process_sflow(deep, payload);
+}
+
+void NetworkMetricsManager::process_netflow(const NetflowDatagram &payload)
+{
+    timespec stamp;
+    // use now()
+    std::timespec_get(&stamp, TIME_UTC);
+    // base event, counting the packets the flow records summarize rather than the datagram
+    uint64_t packets{0};
+    for (const auto &record : payload.records) {
+        packets += record.packets * record.sampling_rate;
+    }
+    auto deep = new_event(stamp, true, packets);
+    // process in the "live" bucket
+    live_bucket()->process_netflow(deep, payload);
+}
 }
-}
\ No newline at end of file
@@ -7,12 +7,17 @@
 #include "AbstractMetricsManager.h"
 #include "DnsStreamHandler.h"
 #include "DnstapInputStream.h"
+#include "FlowInputStream.h"
 #include "MockInputStream.h"
 #include "PcapInputStream.h"
 #include "SflowInputStream.h"
 #include "StreamHandler.h"
 #include <Corrade/Utility/Debug.h>
+#include <algorithm>
+#include <map>
+#include <netinet/tcp.h>
 #include <string>
+#include <vector>
 
 namespace visor::handler::net {
 
@@ -20,8 +25,155 @@ using namespace visor::input::pcap;
 using namespace visor::input::dnstap;
 using namespace visor::input::mock;
 using namespace visor::input::sflow;
+using namespace visor::input::flow;
 using namespace visor::handler::dns;
 
+// prefix lengths used to aggregate addresses into top prefix and prefix cardinality metrics
+struct PrefixLengths {
+    uint8_t ipv4{24};
+    uint8_t ipv6{48};
+};
+
+/**
+ * Per exporter agent counters for sFlow input: datagrams and flow samples received, and the packet and byte volume
+ * they represent once scaled by each sample's sampling rate.
+ *
+ * NOTE: intentionally _not_ thread safe; it should be protected by a mutex
+ */
+class AgentCounters final : public Metric
+{
+    struct agent {
+        uint64_t datagrams{0};
+        uint64_t samples{0};
+        uint64_t packets{0};
+        uint64_t bytes{0};
+
+        void merge(const agent &other);
+    };
+
+    std::map<std::string, agent> _counts;
+
+public:
+    AgentCounters(std::string schema_key, std::initializer_list<std::string> names, std::string desc)
+        : Metric(schema_key, names, std::move(desc))
+    {
+    }
+
+    void update(const std::string &agent_addr, uint64_t samples, uint64_t packets, uint64_t bytes);
+    void merge(const AgentCounters &other);
+
+    // Metric
+    void to_json(json &j) const override;
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override;
+};
+
+/**
+ * Top destinations of TCP SYNs which went unanswered. SYNs are counted by destination and SYN-ACKs by their source in
+ * two frequent items (SpaceSaving) sketches, and a destination's estimate is the difference between the two: a server
+ * completing its handshakes drops out of the list, while one receiving a SYN flood rises to the top.
+ *
+ * NOTE: intentionally _not_ thread safe; it should be protected by a mutex
+ */
+template <typename T>
+class UnansweredSyn final : public Metric
+{
+public:
+    // sized as TopN
+    const uint8_t START_FI_MAP_SIZE = 7; // 2^7 = 128
+    const uint8_t MAX_FI_MAP_SIZE = 13;  // 2^13 = 8192
+
+private:
+    datasketches::frequent_items_sketch<T> _syn;
+    datasketches::frequent_items_sketch<T> _syn_ack;
+    size_t _top_count = 10;
+    std::string _item_key;
+
+    std::vector<std::pair<T, uint64_t>> _top() const
+    {
+        std::vector<std::pair<T, uint64_t>> top;
+        for (const auto &item : _syn.get_frequent_items(datasketches::frequent_items_error_type::NO_FALSE_NEGATIVES)) {
+            auto answered = _syn_ack.get_estimate(item.get_item());
+            if (item.get_estimate() > answered) {
+                top.emplace_back(item.get_item(), item.get_estimate() - answered);
+            }
+        }
+        std::stable_sort(top.begin(), top.end(), [](const auto &a, const auto &b) { return a.second > b.second; });
+        if (top.size() > _top_count) {
+            top.resize(_top_count);
+        }
+        return top;
+    }
+
+public:
+    UnansweredSyn(std::string schema_key, std::string item_key, std::initializer_list<std::string> names, std::string desc)
+        : Metric(schema_key, names, std::move(desc))
+        , _syn(MAX_FI_MAP_SIZE, START_FI_MAP_SIZE)
+        , _syn_ack(MAX_FI_MAP_SIZE, START_FI_MAP_SIZE)
+        , _item_key(item_key)
+    {
+    }
+
+    // flags is the TCP flags byte of a segment sent from src to dst
+    void update(uint8_t flags, const T &src, const T &dst, uint64_t weight = 1)
+    {
+        if (!(flags & TH_SYN)) {
+            return;
+        }
+        if (flags & TH_ACK) {
+            _syn_ack.update(src, weight);
+        } else {
+            _syn.update(dst, weight);
+        }
+    }
+
+    void merge(const UnansweredSyn &other)
+    {
+        _syn.merge(other._syn);
+        _syn_ack.merge(other._syn_ack);
+    }
+
+    void to_json(json &j, std::function<std::string(const T &)> formatter) const
+    {
+        auto section = json::array();
+        auto top = _top();
+        for (uint64_t i = 0; i < top.size(); i++) {
+            section[i]["name"] = formatter(top[i].first);
+            section[i]["estimate"] = top[i].second;
+        }
+        name_json_assign(j, section);
+    }
+
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels, std::function<std::string(const T &)> formatter) const
+    {
+        LabelMap l(add_labels);
+        out << "# HELP " << base_name_snake() << ' ' << _desc << std::endl;
+        out << "# TYPE " << base_name_snake() << " gauge" << std::endl;
+        for (const auto &[item, estimate] : _top()) {
+            l[_item_key] = formatter(item);
+            out << name_snake({}, l) << ' ' << estimate << std::endl;
+        }
+    }
+
+    // Metric
+    void to_json(json &j) const override
+    {
+        to_json(j, [](const T &item) {
+            std::stringstream name_text;
+            name_text << item;
+            return name_text.str();
+        });
+    }
+
+    void to_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) const override
+    {
+        to_prometheus(out, add_labels, [](const T &item) {
+            std::stringstream name_text;
+            name_text << item;
+            return name_text.str();
+        });
+    }
+};
+
 class NetworkMetricsBucket final : public visor::AbstractMetricsBucket
 {
 
@@ -30,29 +182,57 @@ protected:
 
     Cardinality _srcIPCard;
     Cardinality _dstIPCard;
+    Cardinality _srcPrefixCard;
 
-    TopN<std::string> _topGeoLoc;
-    TopN<std::string> _topASN;
+    TopN<uint32_t> _topGeoLoc;
+    TopN<uint32_t> _topASN;
     TopN<uint32_t> _topIPv4;
-    TopN<std::string> _topIPv6;
+    TopN<IPv6Key> _topIPv6;
+
+    TopN<uint32_t> _topIPv4Prefix;
+    TopN<uint32_t> _topIPv4PrefixBytes;
+    TopN<IPv6Key> _topIPv6Prefix;
+    TopN<IPv6Key> _topIPv6PrefixBytes;
+    PrefixLengths _prefix_lengths;
+
+    UnansweredSyn<uint32_t> _synIPv4;
+    UnansweredSyn<IPv6Key> _synIPv6;
+
+    Quantile<uint64_t> _packetSize;
+
+    AgentCounters _sflowAgents;
 
     // total numPackets is tracked in base class num_events
     struct counters {
         Counter UDP;
         Counter TCP;
         Counter OtherL4;
+        Counter TCP_SYN;
+        Counter TCP_SYNACK;
+        Counter TCP_RST;
+        Counter TCP_FIN;
         Counter IPv4;
         Counter IPv6;
         Counter total_in;
         Counter total_out;
+        Counter bytes_in;
+        Counter bytes_out;
+        Counter bytes_total;
         counters()
             : UDP("packets", {"udp"}, "Count of UDP packets")
             , TCP("packets", {"tcp"}, "Count of TCP packets")
             , OtherL4("packets", {"other_l4"}, "Count of packets which are not UDP or TCP")
+            , TCP_SYN("packets", {"tcp_syn"}, "Count of TCP packets with SYN set (without ACK)")
+            , TCP_SYNACK("packets", {"tcp_synack"}, "Count of TCP packets with both SYN and ACK set")
+            , TCP_RST("packets", {"tcp_rst"}, "Count of TCP packets with RST set")
+            , TCP_FIN("packets", {"tcp_fin"}, "Count of TCP packets with FIN set")
             , IPv4("packets", {"ipv4"}, "Count of IPv4 packets")
             , IPv6("packets", {"ipv6"}, "Count of IPv6 packets")
             , total_in("packets", {"in"}, "Count of total ingress packets")
             , total_out("packets", {"out"}, "Count of total egress packets")
+            , bytes_in("packets", {"bytes", "in"}, "Count of total ingress bytes")
+            , bytes_out("packets", {"bytes", "out"}, "Count of total egress bytes")
+            , bytes_total("packets", {"bytes", "total"}, "Count of total bytes (combined ingress and egress)")
         {
         }
     };
@@ -60,17 +240,38 @@ protected:
 
     Rate _rate_in;
     Rate _rate_out;
+    Rate _rate_bytes_in;
+    Rate _rate_bytes_out;
+
+    // flags is the TCP flags byte, weight the number of packets the segment represents
+    void _process_tcp_flags(uint8_t flags, uint64_t weight = 1);
+    // weight is the number of packets a (sampled) packet of this size represents
+    void _process_bytes(PacketDirection dir, uint64_t bytes, uint64_t weight = 1);
+    // bytes and packets are the (scaled) volume seen for the address
+    void _process_ipv4_prefix(uint32_t addr, bool is_src, uint64_t bytes, uint64_t packets = 1);
+    void _process_ipv6_prefix(const uint8_t *addr, bool is_src, uint64_t bytes, uint64_t packets = 1);
 
 public:
     NetworkMetricsBucket()
         : _srcIPCard("packets", {"cardinality", "src_ips_in"}, "Source IP cardinality")
         , _dstIPCard("packets", {"cardinality", "dst_ips_out"}, "Destination IP cardinality")
+        , _srcPrefixCard("packets", {"cardinality", "src_prefixes_in"}, "Source IP prefix cardinality")
         , _topGeoLoc("packets", "geo_loc", {"top_geoLoc"}, "Top GeoIP locations")
         , _topASN("packets", "asn", {"top_ASN"}, "Top ASNs by IP")
         , _topIPv4("packets", "ipv4", {"top_ipv4"}, "Top IPv4 IP addresses")
         , _topIPv6("packets", "ipv6", {"top_ipv6"}, "Top IPv6 IP addresses")
+        , _topIPv4Prefix("packets", "prefix", {"top_ipv4_prefix"}, "Top IPv4 prefixes by packets")
+        , _topIPv4PrefixBytes("packets", "prefix", {"top_ipv4_prefix_bytes"}, "Top IPv4 prefixes by bytes")
+        , _topIPv6Prefix("packets", "prefix", {"top_ipv6_prefix"}, "Top IPv6 prefixes by packets")
+        , _topIPv6PrefixBytes("packets", "prefix", {"top_ipv6_prefix_bytes"}, "Top IPv6 prefixes by bytes")
+        , _synIPv4("packets", "ipv4", {"top_ipv4_syn_unanswered"}, "Top IPv4 destinations of unanswered TCP SYNs")
+        , _synIPv6("packets", "ipv6", {"top_ipv6_syn_unanswered"}, "Top IPv6 destinations of unanswered TCP SYNs")
+        , _packetSize("packets", {"size_bytes"}, "Quantiles of packet sizes (frame length), in bytes")
+        , _sflowAgents("packets", {"sflow_agents"}, "sFlow exporter agent counters")
         , _rate_in("packets", {"rates", "pps_in"}, "Rate of ingress in packets per second")
         , _rate_out("packets", {"rates", "pps_out"}, "Rate of egress in packets per second")
+        , _rate_bytes_in("packets", {"rates", "bytes_in"}, "Rate of ingress in bytes per second")
+        , _rate_bytes_out("packets", {"rates", "bytes_out"}, "Rate of egress in bytes per second")
     {
         set_event_rate_info("packets", {"rates", "pps_total"}, "Rate of all packets (combined ingress and egress) in packets per second");
         set_num_events_info("packets", {"total"}, "Total packets processed");
@@ -95,24 +296,49 @@ public:
         // stop rate collection
         _rate_in.cancel();
         _rate_out.cancel();
+        _rate_bytes_in.cancel();
+        _rate_bytes_out.cancel();
+    }
+
+    // prefix lengths are fixed for the life of the bucket: set before it is in use, see NetworkMetricsManager
+    void set_prefix_lengths(PrefixLengths prefix)
+    {
+        _prefix_lengths = prefix;
     }
 
     void process_packet(bool deep, pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4);
     void process_dnstap(bool deep, const dnstap::Dnstap &payload);
     void process_sflow(bool deep, const SFSample &payload);
+    void process_netflow(bool deep, const NetflowDatagram &payload);
 };
 
 class NetworkMetricsManager final : public visor::AbstractMetricsManager<NetworkMetricsBucket>
 {
+    PrefixLengths _prefix_lengths;
+
+protected:
+    void on_new_bucket(NetworkMetricsBucket &bucket) const override
+    {
+        bucket.set_prefix_lengths(_prefix_lengths);
+    }
+
 public:
     NetworkMetricsManager(const Configurable *window_config)
         : visor::AbstractMetricsManager<NetworkMetricsBucket>(window_config)
     {
     }
 
+    // must be called before any packets are processed
+    void set_prefix_lengths(PrefixLengths prefix)
+    {
+        _prefix_lengths = prefix;
+        live_bucket()->set_prefix_lengths(prefix);
+    }
+
     void process_packet(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, timespec stamp);
     void process_dnstap(const dnstap::Dnstap &payload);
     void process_sflow(const SFSample &payload);
+    void process_netflow(const NetflowDatagram &payload);
 };
 
 class NetStreamHandler final : public visor::StreamMetricsHandler<NetworkMetricsManager>
@@ -123,6 +349,7 @@ class NetStreamHandler final : public visor::StreamMetricsHandler<NetworkMetrics
     DnstapInputStream *_dnstap_stream{nullptr};
     MockInputStream *_mock_stream{nullptr};
     SflowInputStream *_sflow_stream{nullptr};
+    FlowInputStream *_flow_stream{nullptr};
 
     // the stream handlers sources we support (only one will be in use at a time)
     DnsStreamHandler *_dns_handler{nullptr};
@@ -131,6 +358,8 @@ class NetStreamHandler final : public visor::StreamMetricsHandler<NetworkMetrics
 
     sigslot::connection _sflow_connection;
 
+    sigslot::connection _netflow_connection;
+
     sigslot::connection _pkt_connection;
     sigslot::connection _start_tstamp_connection;
     sigslot::connection _end_tstamp_connection;
@@ -138,6 +367,7 @@ class NetStreamHandler final : public visor::StreamMetricsHandler<NetworkMetrics
     sigslot::connection _pkt_udp_connection;
 
     void process_sflow_cb(const SFSample &);
+    void process_netflow_cb(const NetflowDatagram &);
     void process_dnstap_cb(const dnstap::Dnstap &);
     void process_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, timespec stamp);
     void process_udp_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, uint32_t flowkey, timespec stamp);
@@ -161,6 +391,7 @@ public:
 
     void start() override;
     void stop() override;
+    void info_json(json &j) const override;
 };
 
 }
@@ -39,6 +39,16 @@ TEST_CASE("Parse net (dns) UDP IPv4 tests", "[pcap][ipv4][udp][net]")
     CHECK(counters.UDP.value() == 140);
     CHECK(counters.IPv4.value() == 140);
     CHECK(counters.IPv6.value() == 0);
+    // no host_spec, so no direction
+    CHECK(counters.bytes_total.value() == 13320);
+    CHECK(counters.bytes_in.value() == 0);
+    CHECK(counters.bytes_out.value() == 0);
+
+    nlohmann::json j;
+    net_handler.metrics()->bucket(0)->to_json(j);
+    // few enough samples for the sketch to be exact
+    CHECK(j["size_bytes"]["p50"] == 95);
+    CHECK(j["size_bytes"]["p99"] == 125);
 }
 
 TEST_CASE("Parse net (dns) TCP IPv4 tests", "[pcap][ipv4][tcp][net]")
@@ -65,6 +75,10 @@ TEST_CASE("Parse net (dns) TCP IPv4 tests", "[pcap][ipv4][tcp][net]")
     CHECK(counters.TCP.value() == 2100);
     CHECK(counters.IPv4.value() == 2100);
     CHECK(counters.IPv6.value() == 0);
+    CHECK(counters.TCP_SYN.value() == 210);
+    CHECK(counters.TCP_SYNACK.value() == 210);
+    CHECK(counters.TCP_FIN.value() == 420);
+    CHECK(counters.TCP_RST.value() == 0);
 }
 
 TEST_CASE("Parse net (dns) UDP IPv6 tests", "[pcap][ipv6][udp][net]")
@@ -119,6 +133,8 @@ TEST_CASE("Parse net (dns) TCP IPv6 tests", "[pcap][ipv6][tcp][net]")
     CHECK(counters.TCP.value() == 1800);
     CHECK(counters.IPv4.value() == 0);
     CHECK(counters.IPv6.value() == 1800);
+    CHECK(counters.TCP_SYN.value() == 180);
+    CHECK(counters.TCP_SYNACK.value() == 180);
 }
 
 TEST_CASE("Parse net (dns) random UDP/TCP tests", "[pcap][net]")
@@ -153,8 +169,15 @@ TEST_CASE("Parse net (dns) random UDP/TCP tests", "[pcap][net]")
     CHECK(counters.IPv4.value() == 16147);
     CHECK(counters.IPv6.value() == 0);
     CHECK(counters.OtherL4.value() == 0);
+    CHECK(counters.TCP_SYN.value() == 1423);
+    CHECK(counters.TCP_SYNACK.value() == 1423);
+    CHECK(counters.TCP_FIN.value() == 2846);
+    CHECK(counters.TCP_RST.value() == 0);
     CHECK(counters.total_in.value() == 6648);
     CHECK(counters.total_out.value() == 9499);
+    CHECK(counters.bytes_total.value() == 1516056);
+    CHECK(counters.bytes_in.value() == 744484);
+    CHECK(counters.bytes_out.value() == 771572);
 
     nlohmann::json j;
     net_handler.metrics()->bucket(0)->to_json(j);
@@ -163,6 +186,15 @@ TEST_CASE("Parse net (dns) random UDP/TCP tests", "[pcap][net]")
     CHECK(j["cardinality"]["src_ips_in"] == 1);
     CHECK(j["top_ipv4"][0]["estimate"] == 16147);
     CHECK(j["top_ipv4"][0]["name"] == "8.8.8.8");
+    CHECK(j["cardinality"]["src_prefixes_in"] == 1);
+    CHECK(j["top_ipv4_prefix"][0]["estimate"] == 16147);
+    CHECK(j["top_ipv4_prefix"][0]["name"] == "8.8.8.0/24");
+    CHECK(j["top_ipv4_prefix_bytes"][0]["name"] == "8.8.8.0/24");
+    CHECK(j["bytes"]["total"] == 1516056);
+    CHECK(j["bytes"]["in"] == 744484);
+    CHECK(j["bytes"]["out"] == 771572);
+    // every handshake was answered
+    CHECK(j["top_ipv4_syn_unanswered"].size() == 0);
 }
 
 TEST_CASE("Parse net (dns) with DNS filter only_qname_suffix", "[pcap][dns][net]")
@@ -209,11 +241,11 @@ TEST_CASE("Parse net (dns) with DNS filter only_qname_suffix", "[pcap][dns][net]
     CHECK(j["top_ipv4"][0]["name"] == "216.239.38.10");
 }
 
-TEST_CASE("Parse net (dns) sflow stream", "[sflow][net]")
+TEST_CASE("Parse net netflow and IPFIX stream", "[netflow][net]")
 {
 
-    SflowInputStream stream{"sflow-test"};
-    stream.config_set("pcap_file", "tests/fixtures/ecmp.pcap");
+    FlowInputStream stream{"flow-test"};
+    stream.config_set("pcap_file", "tests/fixtures/netflow.pcap");
 
     visor::Config c;
     c.config_set<uint64_t>("num_periods", 1);
@@ -227,22 +259,87 @@ TEST_CASE("Parse net (dns) sflow stream", "[sflow][net]")
     auto counters = net_handler.metrics()->bucket(0)->counters();
     auto event_data = net_handler.metrics()->bucket(0)->event_data_locked();
 
-    // confirmed with wireshark
-    CHECK(event_data.num_events->value() == 9279);
-    CHECK(event_data.num_samples->value() == 9279);
-    CHECK(counters.TCP.value() == 52785);
-    CHECK(counters.UDP.value() == 0);
-    CHECK(counters.IPv4.value() == 52785);
-    CHECK(counters.IPv6.value() == 0);
-    CHECK(counters.OtherL4.value() == 3682);
-    CHECK(counters.total_in.value() == 0);
-    CHECK(counters.total_out.value() == 0);
+    // events and counters are the packets the flow records summarize
+    CHECK(event_data.num_events->value() == 1014);
+    CHECK(counters.TCP.value() == 1010);
+    CHECK(counters.UDP.value() == 4);
+    CHECK(counters.OtherL4.value() == 0);
+    CHECK(counters.IPv4.value() == 114);
+    // IPFIX records are sampled 1 in 100
+    CHECK(counters.IPv6.value() == 900);
+    CHECK(counters.total_in.value() == 101);
+    CHECK(counters.total_out.value() == 1);
+    CHECK(counters.bytes_total.value() == 855400);
+    CHECK(counters.bytes_in.value() == 150080);
+    CHECK(counters.bytes_out.value() == 120);
+
+    nlohmann::json j;
+    net_handler.metrics()->bucket(0)->to_json(j);
+
+    CHECK(j["cardinality"]["src_ips_in"] == 7);
+    CHECK(j["cardinality"]["dst_ips_out"] == 5);
+    CHECK(j["top_ipv4"][0]["estimate"] == 112);
+    CHECK(j["top_ipv4"][0]["name"] == "10.2.2.2");
+    CHECK(j["top_ipv6"][0]["estimate"] == 900);
+}
+
+TEST_CASE("Parse net (dns) with configured prefix lengths", "[pcap][net]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_udp_tcp_random.pcap");
+    stream.config_set("bpf", "");
+    stream.config_set("host_spec", "192.168.0.0/24");
+    stream.parse_host_spec();
+
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 2);
+    NetStreamHandler net_handler{"net-test", &stream, &c};
+    net_handler.config_set<uint64_t>("ipv4_prefix_length", 16);
+
+    net_handler.start();
+    stream.start();
+    stream.stop();
+    net_handler.stop();
 
     nlohmann::json j;
     net_handler.metrics()->bucket(0)->to_json(j);
 
-    CHECK(j["cardinality"]["dst_ips_out"] == 4);
-    CHECK(j["cardinality"]["src_ips_in"] == 4);
-    CHECK(j["top_ipv4"][0]["estimate"] == 27054);
-    CHECK(j["top_ipv4"][0]["name"] == "10.4.2.2");
-}
\ No newline at end of file
+    CHECK(j["top_ipv4_prefix"][0]["estimate"] == 16147);
+    CHECK(j["top_ipv4_prefix"][0]["name"] == "8.8.0.0/16");
+
+    // a merged window formats prefixes with the configured length too
+    nlohmann::json merged;
+    net_handler.metrics()->window_merged_json(merged, "packets", 2);
+    CHECK(merged["packets"]["top_ipv4_prefix"][0]["name"] == "8.8.0.0/16");
+
+    NetStreamHandler bad_handler{"net-test-bad", &stream, &c};
+    bad_handler.config_set<uint64_t>("ipv4_prefix_length", 33);
+    CHECK_THROWS_AS(bad_handler.start(), visor::ConfigException);
+}
+
+TEST_CASE("Net unanswered SYN destinations", "[net][tcp]")
+{
+    UnansweredSyn<uint32_t> syn("packets", "ipv4", {"top_ipv4_syn_unanswered"}, "Top IPv4 destinations of unanswered TCP SYNs");
+
+    // a flood against one server, a handshake completing with another, and segments without SYN
+    syn.update(TH_SYN, 1, 10, 500);
+    syn.update(TH_SYN, 2, 20, 40);
+    syn.update(TH_SYN | TH_ACK, 20, 2, 40);
+    syn.update(TH_SYN, 3, 30, 3);
+    syn.update(TH_SYN | TH_ACK, 30, 3, 1);
+    syn.update(TH_ACK, 1, 10, 1000);
+    syn.update(TH_RST, 10, 1, 1000);
+
+    UnansweredSyn<uint32_t> merged("packets", "ipv4", {"top_ipv4_syn_unanswered"}, "Top IPv4 destinations of unanswered TCP SYNs");
+    merged.merge(syn);
+
+    nlohmann::json j;
+    merged.to_json(j, [](const uint32_t &val) { return std::to_string(val); });
+
+    REQUIRE(j["top_ipv4_syn_unanswered"].size() == 2);
+    CHECK(j["top_ipv4_syn_unanswered"][0]["name"] == "10");
+    CHECK(j["top_ipv4_syn_unanswered"][0]["estimate"] == 500);
+    CHECK(j["top_ipv4_syn_unanswered"][1]["name"] == "30");
+    CHECK(j["top_ipv4_syn_unanswered"][1]["estimate"] == 2);
+}
@@ -0,0 +1,86 @@
+#include <catch2/catch.hpp>
+
+#include "NetStreamHandler.h"
+#include "SflowInputStream.h"
+#include "emit_datagram.h"
+
+using namespace visor::handler::net;
+using namespace visor::input::sflow;
+
+// sflow v5 datagram from agent 192.168.0.1 with three flow samples sampled 1 in 512: two DNS UDP packets of 79 bytes
+// between 10.0.0.2 and 10.0.0.53, a 58 byte TCP SYN from 10.0.0.2 to 10.0.0.53:443, and an interface counter sample
+alignas(4) static uint8_t sflow_datagram[] = {
+    0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x03, 0xe8, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x84, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x02, 0x00,
+    0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x5c, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x4f, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x4b, 0x00, 0x11, 0x22, 0x33,
+    0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0x08, 0x00, 0x45, 0x00, 0x00, 0x3d, 0x00, 0x01,
+    0x00, 0x00, 0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x02, 0x0a, 0x00, 0x00, 0x35, 0x9c, 0x40,
+    0x00, 0x35, 0x00, 0x29, 0x00, 0x00, 0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x03, 0x77, 0x77, 0x77, 0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63,
+    0x6f, 0x6d, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x84,
+    0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x04, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x5c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x4f,
+    0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x4b, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xaa, 0xbb, 0x08, 0x00, 0x45, 0x00, 0x00, 0x3d, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11,
+    0x00, 0x00, 0x0a, 0x00, 0x00, 0x35, 0x0a, 0x00, 0x00, 0x02, 0x00, 0x35, 0x9c, 0x41, 0x00, 0x29,
+    0x00, 0x00, 0x43, 0x21, 0x81, 0x83, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x62,
+    0x61, 0x64, 0x07, 0x65, 0x78, 0x61, 0x6d, 0x70, 0x6c, 0x65, 0x03, 0x63, 0x6f, 0x6d, 0x00, 0x00,
+    0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x70, 0x00, 0x00, 0x00, 0x03,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x48, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3a, 0x00, 0x00, 0x00, 0x04,
+    0x00, 0x00, 0x00, 0x36, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+    0x08, 0x00, 0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00, 0x0a, 0x00,
+    0x00, 0x02, 0x0a, 0x00, 0x00, 0x35, 0x9c, 0x42, 0x01, 0xbb, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x50, 0x02, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x00, 0x00, 0x6c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x58, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x06,
+    0x00, 0x00, 0x00, 0x00, 0x3b, 0x9a, 0xca, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x39, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x06,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd4, 0x31, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02,
+    0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x06,
+};
+
+TEST_CASE("Parse net from sflow sampled headers", "[sflow][net]")
+{
+    SflowInputStream stream{"sflow-test"};
+
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    NetStreamHandler net_handler{"net-test", &stream, &c};
+
+    net_handler.start();
+    CHECK(stream.decode_flags() == DECODE_FLOW_SAMPLES);
+    emit_datagram(stream, sflow_datagram);
+    net_handler.stop();
+
+    auto counters = net_handler.metrics()->bucket(0)->counters();
+    auto event_data = net_handler.metrics()->bucket(0)->event_data_locked();
+
+    // events and counters are scaled by the sampling rate of each flow sample, the counter sample adds nothing
+    CHECK(event_data.num_events->value() == 1536);
+    CHECK(event_data.num_samples->value() == 1536);
+    CHECK(counters.UDP.value() == 1024);
+    CHECK(counters.TCP.value() == 512);
+    CHECK(counters.OtherL4.value() == 0);
+    CHECK(counters.IPv4.value() == 1536);
+    CHECK(counters.IPv6.value() == 0);
+    CHECK(counters.TCP_SYN.value() == 512);
+    CHECK(counters.bytes_total.value() == (79 + 79 + 58) * 512);
+
+    nlohmann::json j;
+    net_handler.metrics()->bucket(0)->to_json(j);
+
+    CHECK(j["cardinality"]["src_ips_in"] == 2);
+    CHECK(j["cardinality"]["dst_ips_out"] == 2);
+    CHECK(j["top_ipv4"][0]["estimate"] == 1536);
+    CHECK(j["sflow_agents"]["192.168.0.1"]["datagrams"] == 1);
+    CHECK(j["sflow_agents"]["192.168.0.1"]["flow_samples"] == 3);
+    CHECK(j["sflow_agents"]["192.168.0.1"]["packets"] == 1536);
+    CHECK(j["sflow_agents"]["192.168.0.1"]["bytes"] == (79 + 79 + 58) * 512);
+}
@@ -137,7 +137,7 @@ void PcapMetricsBucket::process_pcap_stats(const pcpp::IPcapDevice::PcapStats &s
 void PcapMetricsManager::process_pcap_tcp_reassembly_error(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, [[maybe_unused]] timespec stamp)
 {
     // process in the "live" bucket
-    live_bucket()->process_pcap_tcp_reassembly_error(_deep_sampling_now, payload, dir, l3);
+    live_bucket()->process_pcap_tcp_reassembly_error(false, payload, dir, l3);
 }
 void PcapMetricsManager::process_pcap_stats(const pcpp::IPcapDevice::PcapStats &stats)
 {
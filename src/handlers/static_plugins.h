@@ -4,6 +4,7 @@ int import_handler_plugins()
     CORRADE_PLUGIN_IMPORT(VisorHandlerNet);
     CORRADE_PLUGIN_IMPORT(VisorHandlerDns);
     CORRADE_PLUGIN_IMPORT(VisorHandlerDhcp);
+    CORRADE_PLUGIN_IMPORT(VisorHandlerFlow);
     CORRADE_PLUGIN_IMPORT(VisorHandlerPcap);
     return 0;
 }
@@ -0,0 +1,178 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "FlowInputStream.h"
+#include "FlowException.h"
+#include <IPv4Layer.h>
+#include <IPv6Layer.h>
+#include <Packet.h>
+#include <PcapFileDevice.h>
+#include <UdpLayer.h>
+
+namespace visor::input::flow {
+
+FlowInputStream::FlowInputStream(const std::string &name)
+    : visor::InputStream(name)
+    , _error_count(0)
+    , _missing_template_count(0)
+    , _template_count(0)
+    , _exporter_count(0)
+    , _evicted_exporter_count(0)
+    , _evicted_template_count(0)
+{
+    _logger = spdlog::get("visor");
+    assert(_logger);
+}
+
+void FlowInputStream::start()
+{
+
+    if (_running) {
+        return;
+    }
+
+    if (config_exists("pcap_file")) {
+        // read flow exports from pcap file. this is a special case from a command line utility
+        _running = true;
+        _read_from_pcap_file();
+        return;
+    } else if (config_exists("port") && config_exists("bind")) {
+        _create_udp_socket();
+    } else {
+        throw FlowException("flow config must specify port and bind");
+    }
+
+    _running = true;
+}
+
+void FlowInputStream::_process_datagram(const std::string &exporter, const uint8_t *data, size_t len)
+{
+    _decoder.decode(exporter, data, len, _datagram);
+    _template_count.store(_decoder.template_count(), std::memory_order_relaxed);
+    _exporter_count.store(_decoder.exporter_count(), std::memory_order_relaxed);
+    _evicted_exporter_count.store(_decoder.evicted_exporters(), std::memory_order_relaxed);
+    _evicted_template_count.store(_decoder.evicted_templates(), std::memory_order_relaxed);
+    if (_datagram.missing_templates) {
+        _missing_template_count += _datagram.missing_templates;
+    }
+    netflow_signal(_datagram);
+}
+
+void FlowInputStream::_read_from_pcap_file()
+{
+    pcpp::IFileReaderDevice *reader = pcpp::IFileReaderDevice::getReader(config_get<std::string>("pcap_file"));
+    reader->open();
+
+    pcpp::RawPacket rawPacket;
+
+    while (reader->getNextPacket(rawPacket)) {
+        pcpp::Packet flow_pkt(&rawPacket);
+        if (flow_pkt.isPacketOfType(pcpp::UDP)) {
+            pcpp::UdpLayer *udpLayer = flow_pkt.getLayerOfType<pcpp::UdpLayer>();
+            // templates are cached by exporter, which is the source address of the export
+            std::string exporter;
+            if (auto ip4 = flow_pkt.getLayerOfType<pcpp::IPv4Layer>()) {
+                exporter = ip4->getSrcIPv4Address().toString();
+            } else if (auto ip6 = flow_pkt.getLayerOfType<pcpp::IPv6Layer>()) {
+                exporter = ip6->getSrcIPv6Address().toString();
+            }
+            try {
+                _process_datagram(exporter, udpLayer->getLayerPayload(), udpLayer->getLayerPayloadSize());
+            } catch (const std::exception &e) {
+                ++_error_count;
+                _logger->error(e.what());
+            }
+        }
+    }
+
+    reader->close();
+    delete reader;
+}
+
+void FlowInputStream::_create_udp_socket()
+{
+    auto bind = config_get<std::string>("bind");
+    auto port = config_get<uint64_t>("port");
+    // main io loop, run in its own thread
+    _io_loop = uvw::Loop::create();
+    if (!_io_loop) {
+        throw FlowException("unable to create io loop");
+    }
+    // AsyncHandle lets us stop the loop from its own thread
+    _async_h = _io_loop->resource<uvw::AsyncHandle>();
+    if (!_async_h) {
+        throw FlowException("unable to initialize AsyncHandle");
+    }
+    _async_h->once<uvw::AsyncEvent>([this](const auto &, auto &handle) {
+        _udp_server_h->stop();
+        _udp_server_h->close();
+        _io_loop->stop();
+        _io_loop->close();
+        handle.close();
+    });
+    _async_h->on<uvw::ErrorEvent>([this](const auto &err, auto &handle) {
+        _logger->error("[{}] AsyncEvent error: {}", _name, err.what());
+        handle.close();
+    });
+
+    // setup server socket
+    _udp_server_h = _io_loop->resource<uvw::UDPHandle>();
+    if (!_udp_server_h) {
+        throw FlowException("unable to initialize server PipeHandle");
+    }
+
+    _udp_server_h->on<uvw::ErrorEvent>([this](const auto &err, auto &) {
+        _logger->error("[{}] socket error: {}", _name, err.what());
+        throw FlowException(err.what());
+    });
+
+    // UDPDataEvent happens on each received datagram
+    _udp_server_h->on<uvw::UDPDataEvent>([this](const uvw::UDPDataEvent &event, uvw::UDPHandle &) {
+        try {
+            _process_datagram(event.sender.ip, reinterpret_cast<const uint8_t *>(event.data.get()), event.length);
+        } catch (const std::exception &e) {
+            ++_error_count;
+        }
+    });
+
+    _logger->info("[{}] binding flow UDP server on {}:{}", _name, bind, port);
+    _udp_server_h->bind(bind, port);
+    _udp_server_h->recv();
+
+    // spawn the loop
+    _io_thread = std::make_unique<std::thread>([this] {
+        _io_loop->run();
+    });
+}
+
+void FlowInputStream::stop()
+{
+    if (!_running) {
+        return;
+    }
+
+    if (_async_h && _io_thread) {
+        // we have to use AsyncHandle to stop the loop from the same thread the loop is running in
+        _async_h->send();
+        // waits for _io_loop->run() to return
+        if (_io_thread->joinable()) {
+            _io_thread->join();
+        }
+    }
+
+    _running = false;
+}
+
+void FlowInputStream::info_json(json &j) const
+{
+    common_info_json(j);
+    j[schema_key()]["packet_errors"] = _error_count.load();
+    j[schema_key()]["missing_templates"] = _missing_template_count.load();
+    j[schema_key()]["templates"] = _template_count.load();
+    j[schema_key()]["exporters"] = _exporter_count.load();
+    j[schema_key()]["evicted_exporters"] = _evicted_exporter_count.load();
+    j[schema_key()]["evicted_templates"] = _evicted_template_count.load();
+}
+
+}
@@ -0,0 +1,62 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include "InputStream.h"
+#include "NetflowData.h"
+#include <sigslot/signal.hpp>
+#include <spdlog/spdlog.h>
+#include <uvw.hpp>
+
+namespace visor::input::flow {
+
+class FlowInputStream : public visor::InputStream
+{
+    std::atomic<uint64_t> _error_count;
+    std::atomic<uint64_t> _missing_template_count;
+    std::atomic<size_t> _template_count;
+    std::atomic<size_t> _exporter_count;
+    std::atomic<uint64_t> _evicted_exporter_count;
+    std::atomic<uint64_t> _evicted_template_count;
+    std::shared_ptr<spdlog::logger> _logger;
+
+    // only used from the thread receiving datagrams
+    NetflowDecoder _decoder;
+    NetflowDatagram _datagram;
+
+    std::unique_ptr<std::thread> _io_thread;
+    std::shared_ptr<uvw::Loop> _io_loop;
+    std::shared_ptr<uvw::AsyncHandle> _async_h;
+
+    std::shared_ptr<uvw::UDPHandle> _udp_server_h;
+
+    void _read_from_pcap_file();
+    void _create_udp_socket();
+    void _process_datagram(const std::string &exporter, const uint8_t *data, size_t len);
+
+public:
+    FlowInputStream(const std::string &name);
+    ~FlowInputStream() = default;
+
+    // visor::AbstractModule
+    std::string schema_key() const override
+    {
+        return "flow";
+    }
+    void start() override;
+    void stop() override;
+    void info_json(json &j) const override;
+    size_t consumer_count() const override
+    {
+        return netflow_signal.slot_count();
+    }
+
+    // handler functionality
+    // IF THIS changes, see consumer_count()
+    // note: these are mutable because consumer_count() calls slot_count() which is not const (unclear if it could/should be)
+    mutable sigslot::signal<const NetflowDatagram &> netflow_signal;
+};
+
+}
@@ -0,0 +1,429 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "NetflowData.h"
+#include <algorithm>
+#include <cstring>
+#include <fmt/format.h>
+#include <stdexcept>
+
+namespace visor::input::flow {
+
+static constexpr size_t V5_HEADER_LEN = 24;
+static constexpr size_t V5_RECORD_LEN = 48;
+static constexpr size_t V9_HEADER_LEN = 20;
+static constexpr size_t IPFIX_HEADER_LEN = 16;
+static constexpr uint16_t VARIABLE_LENGTH = 0xFFFF;
+
+// information element ids, shared by v9 and IPFIX
+enum FieldType : uint16_t {
+    IN_BYTES = 1,
+    IN_PKTS = 2,
+    PROTOCOL = 4,
+    TCP_FLAGS = 6,
+    L4_SRC_PORT = 7,
+    IPV4_SRC_ADDR = 8,
+    INPUT_SNMP = 10,
+    L4_DST_PORT = 11,
+    IPV4_DST_ADDR = 12,
+    OUTPUT_SNMP = 14,
+    IPV6_SRC_ADDR = 27,
+    IPV6_DST_ADDR = 28,
+    SAMPLING_INTERVAL = 34,
+    FLOW_SAMPLER_RANDOM_INTERVAL = 50,
+    DIRECTION = 61,
+    OCTET_TOTAL_COUNT = 85,
+    PACKET_TOTAL_COUNT = 86,
+    SAMPLING_PACKET_INTERVAL = 305
+};
+
+static inline uint16_t read16(const uint8_t *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+// big endian unsigned integer of 1 to 8 bytes (v9 and IPFIX allow reduced size encoding)
+static inline uint64_t read_uint(const uint8_t *p, size_t len)
+{
+    uint64_t value{0};
+    for (size_t i = 0; i < len && i < 8; ++i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+void NetflowDecoder::decode(const std::string &exporter, const uint8_t *data, size_t len, NetflowDatagram &out)
+{
+    if (len < 2) {
+        throw std::out_of_range("netflow datagram too short");
+    }
+
+    out.exporter = exporter;
+    out.missing_templates = 0;
+    out.records.clear();
+    out.version = read16(data);
+
+    switch (out.version) {
+    case 5:
+        _decode_v5(data, len, out);
+        break;
+    case 9:
+        _decode_v9(data, len, out);
+        break;
+    case 10:
+        _decode_ipfix(data, len, out);
+        break;
+    default:
+        throw std::invalid_argument(fmt::format("version: {}. Only support netflow v5, v9 and IPFIX", out.version));
+    }
+}
+
+void NetflowDecoder::_decode_v5(const uint8_t *data, size_t len, NetflowDatagram &out)
+{
+    if (len < V5_HEADER_LEN) {
+        throw std::out_of_range("netflow v5 header truncated");
+    }
+    uint16_t count = read16(data + 2);
+    if (len < V5_HEADER_LEN + count * V5_RECORD_LEN) {
+        throw std::out_of_range(fmt::format("netflow v5 datagram truncated, expected {} records", count));
+    }
+    out.export_time = read32(data + 8);
+    out.sequence = read32(data + 16);
+    out.source_id = read16(data + 20);
+    // top two bits are the sampling mode
+    uint32_t sampling_rate = read16(data + 22) & 0x3FFF;
+    if (!sampling_rate) {
+        sampling_rate = 1;
+    }
+
+    const uint8_t *p = data + V5_HEADER_LEN;
+    for (uint16_t i = 0; i < count; ++i, p += V5_RECORD_LEN) {
+        auto &rec = out.records.emplace_back();
+        rec.ip_version = 4;
+        std::memcpy(rec.src_addr.data(), p, 4);
+        std::memcpy(rec.dst_addr.data(), p + 4, 4);
+        rec.input_if = read16(p + 12);
+        rec.output_if = read16(p + 14);
+        rec.packets = read32(p + 16);
+        rec.bytes = read32(p + 20);
+        rec.sampling_rate = sampling_rate;
+        rec.src_port = read16(p + 32);
+        rec.dst_port = read16(p + 34);
+        rec.tcp_flags = p[37];
+        rec.protocol = p[38];
+    }
+}
+
+void NetflowDecoder::_decode_v9(const uint8_t *data, size_t len, NetflowDatagram &out)
+{
+    if (len < V9_HEADER_LEN) {
+        throw std::out_of_range("netflow v9 header truncated");
+    }
+    out.export_time = read32(data + 8);
+    out.sequence = read32(data + 12);
+    out.source_id = read32(data + 16);
+    _decode_sets(data + V9_HEADER_LEN, len - V9_HEADER_LEN, out, false);
+}
+
+void NetflowDecoder::_decode_ipfix(const uint8_t *data, size_t len, NetflowDatagram &out)
+{
+    if (len < IPFIX_HEADER_LEN) {
+        throw std::out_of_range("IPFIX header truncated");
+    }
+    size_t msg_len = read16(data + 2);
+    if (msg_len < IPFIX_HEADER_LEN || msg_len > len) {
+        throw std::out_of_range(fmt::format("IPFIX message length {} does not match datagram length {}", msg_len, len));
+    }
+    out.export_time = read32(data + 4);
+    out.sequence = read32(data + 8);
+    out.source_id = read32(data + 12);
+    _decode_sets(data + IPFIX_HEADER_LEN, msg_len - IPFIX_HEADER_LEN, out, true);
+}
+
+NetflowDecoder::Exporter &NetflowDecoder::_add_exporter(const std::string &exporter)
+{
+    if (_exporters.size() >= MAX_EXPORTERS) {
+        auto oldest = std::min_element(_exporters.begin(), _exporters.end(), [](const auto &a, const auto &b) { return a.second.last_used < b.second.last_used; });
+        _template_count -= oldest->second.templates.size();
+        _exporters.erase(oldest);
+        ++_evicted_exporters;
+    }
+    auto &entry = _exporters[exporter];
+    entry.last_used = ++_tick;
+    return entry;
+}
+
+// v9 flowsets and IPFIX sets share the same framing, only the template and options template set ids differ
+void NetflowDecoder::_decode_sets(const uint8_t *data, size_t len, NetflowDatagram &out, bool ipfix)
+{
+    const uint16_t template_set = ipfix ? 2 : 0;
+    const uint16_t options_template_set = ipfix ? 3 : 1;
+    // not added until one of its template sets has been parsed
+    Exporter *exporter{nullptr};
+    if (auto it = _exporters.find(out.exporter); it != _exporters.end()) {
+        exporter = &it->second;
+        exporter->last_used = ++_tick;
+    }
+    size_t offset{0};
+    while (offset + 4 <= len) {
+        uint16_t set_id = read16(data + offset);
+        uint16_t set_len = read16(data + offset + 2);
+        if (set_len < 4 || offset + set_len > len) {
+            throw std::out_of_range(fmt::format("flow set {} length {} exceeds datagram", set_id, set_len));
+        }
+        const uint8_t *body = data + offset + 4;
+        size_t body_len = set_len - 4;
+        if (set_id == template_set || set_id == options_template_set) {
+            _read_templates(exporter, body, body_len, out, ipfix, set_id == options_template_set);
+        } else if (set_id >= 256) {
+            if (!exporter) {
+                ++out.missing_templates;
+            } else if (auto tpl = exporter->templates.find((static_cast<uint64_t>(out.source_id) << 16) | set_id); tpl == exporter->templates.end()) {
+                ++out.missing_templates;
+            } else {
+                tpl->second.last_used = _tick;
+                _read_data(*exporter, tpl->second, body, body_len, out);
+            }
+        }
+        offset += set_len;
+    }
+}
+
+void NetflowDecoder::_read_templates(Exporter *&exporter, const uint8_t *data, size_t len, NetflowDatagram &out, bool ipfix, bool options)
+{
+    // the whole set is parsed before any of it is cached, so a truncated set adds nothing
+    std::vector<std::pair<uint64_t, Template>> parsed;
+    size_t offset{0};
+    auto read_field = [&](uint16_t template_id, bool scope) {
+        if (offset + 4 > len) {
+            throw std::out_of_range(fmt::format("template {} truncated", template_id));
+        }
+        Field field{read16(data + offset), read16(data + offset + 2), false, scope};
+        offset += 4;
+        if (ipfix && (field.type & 0x8000)) {
+            // enterprise specific, followed by the enterprise number
+            if (offset + 4 > len) {
+                throw std::out_of_range(fmt::format("template {} truncated", template_id));
+            }
+            field.type &= 0x7FFF;
+            field.enterprise = true;
+            offset += 4;
+        }
+        return field;
+    };
+    while (offset + 4 <= len) {
+        uint16_t template_id = read16(data + offset);
+        uint16_t field_count = read16(data + offset + 2);
+        if (template_id < 256) {
+            // set padding
+            break;
+        }
+        uint64_t key = (static_cast<uint64_t>(out.source_id) << 16) | template_id;
+        uint16_t scope_count{0};
+        if (options && !ipfix) {
+            // v9 options templates give the byte lengths of the scope and option fields
+            if (offset + 6 > len) {
+                throw std::out_of_range(fmt::format("options template {} truncated", template_id));
+            }
+            scope_count = field_count / 4;
+            field_count = scope_count + read16(data + offset + 4) / 4;
+            offset += 6;
+        } else if (options && field_count) {
+            if (offset + 6 > len) {
+                throw std::out_of_range(fmt::format("options template {} truncated", template_id));
+            }
+            scope_count = read16(data + offset + 4);
+            offset += 6;
+        } else {
+            offset += 4;
+        }
+        if (field_count == 0) {
+            // IPFIX template withdrawal
+            parsed.emplace_back(key, Template{});
+            continue;
+        }
+        Template tpl;
+        tpl.options = options;
+        tpl.fields.reserve(field_count);
+        bool variable{false};
+        for (uint16_t i = 0; i < field_count; ++i) {
+            auto field = read_field(template_id, i < scope_count);
+            if (field.length == VARIABLE_LENGTH) {
+                variable = true;
+            } else {
+                tpl.length += field.length;
+            }
+            tpl.fields.push_back(field);
+        }
+        if (variable) {
+            tpl.length = 0;
+        }
+        parsed.emplace_back(key, std::move(tpl));
+    }
+
+    for (auto &[key, tpl] : parsed) {
+        if (tpl.fields.empty()) {
+            if (exporter && exporter->templates.erase(key)) {
+                --_template_count;
+            }
+            continue;
+        }
+        if (!exporter) {
+            exporter = &_add_exporter(out.exporter);
+        }
+        auto &templates = exporter->templates;
+        if (!templates.count(key)) {
+            if (templates.size() >= MAX_TEMPLATES) {
+                auto oldest = std::min_element(templates.begin(), templates.end(), [](const auto &a, const auto &b) { return a.second.last_used < b.second.last_used; });
+                templates.erase(oldest);
+                --_template_count;
+                ++_evicted_templates;
+            }
+            ++_template_count;
+        }
+        tpl.last_used = ++_tick;
+        templates[key] = std::move(tpl);
+    }
+}
+
+void NetflowDecoder::_read_data(Exporter &exporter, const Template &tpl, const uint8_t *data, size_t len, NetflowDatagram &out)
+{
+    size_t offset{0};
+    if (tpl.length) {
+        // anything shorter than a record at the end of the set is padding
+        while (offset + tpl.length <= len) {
+            _read_record(exporter, tpl, data, len, offset, out);
+        }
+    } else {
+        while (offset < len && _read_record(exporter, tpl, data, len, offset, out)) {
+        }
+    }
+}
+
+bool NetflowDecoder::_read_record(Exporter &exporter, const Template &tpl, const uint8_t *data, size_t len, size_t &offset, NetflowDatagram &out)
+{
+    size_t start = offset;
+    uint32_t interval{0};
+    auto &rec = out.records.emplace_back();
+    auto truncated = [&]() {
+        // a truncated record is dropped, as is any padding
+        out.records.pop_back();
+        offset = start;
+        return false;
+    };
+    for (const auto &field : tpl.fields) {
+        size_t flen = field.length;
+        if (flen == VARIABLE_LENGTH) {
+            if (offset + 1 > len) {
+                return truncated();
+            }
+            flen = data[offset++];
+            if (flen == 255) {
+                if (offset + 2 > len) {
+                    return truncated();
+                }
+                flen = read16(data + offset);
+                offset += 2;
+            }
+        }
+        if (offset + flen > len) {
+            return truncated();
+        }
+        const uint8_t *value = data + offset;
+        offset += flen;
+        if (field.enterprise || field.scope) {
+            continue;
+        }
+        switch (field.type) {
+        case IN_BYTES:
+        case OCTET_TOTAL_COUNT:
+            rec.bytes = read_uint(value, flen);
+            break;
+        case IN_PKTS:
+        case PACKET_TOTAL_COUNT:
+            rec.packets = read_uint(value, flen);
+            break;
+        case PROTOCOL:
+            rec.protocol = static_cast<uint8_t>(read_uint(value, flen));
+            break;
+        case TCP_FLAGS:
+            // may be exported as 2 bytes, the flags proper are the low byte
+            rec.tcp_flags = static_cast<uint8_t>(read_uint(value, flen));
+            break;
+        case L4_SRC_PORT:
+            rec.src_port = static_cast<uint16_t>(read_uint(value, flen));
+            break;
+        case L4_DST_PORT:
+            rec.dst_port = static_cast<uint16_t>(read_uint(value, flen));
+            break;
+        case IPV4_SRC_ADDR:
+            if (flen == 4) {
+                rec.ip_version = 4;
+                std::memcpy(rec.src_addr.data(), value, 4);
+            }
+            break;
+        case IPV4_DST_ADDR:
+            if (flen == 4) {
+                rec.ip_version = 4;
+                std::memcpy(rec.dst_addr.data(), value, 4);
+            }
+            break;
+        case IPV6_SRC_ADDR:
+            if (flen == 16) {
+                rec.ip_version = 6;
+                std::memcpy(rec.src_addr.data(), value, 16);
+            }
+            break;
+        case IPV6_DST_ADDR:
+            if (flen == 16) {
+                rec.ip_version = 6;
+                std::memcpy(rec.dst_addr.data(), value, 16);
+            }
+            break;
+        case INPUT_SNMP:
+            rec.input_if = static_cast<uint32_t>(read_uint(value, flen));
+            break;
+        case OUTPUT_SNMP:
+            rec.output_if = static_cast<uint32_t>(read_uint(value, flen));
+            break;
+        case DIRECTION:
+            rec.direction = read_uint(value, flen) ? FlowDirection::egress : FlowDirection::ingress;
+            break;
+        case SAMPLING_INTERVAL:
+        case SAMPLING_PACKET_INTERVAL:
+        case FLOW_SAMPLER_RANDOM_INTERVAL:
+            interval = static_cast<uint32_t>(read_uint(value, flen));
+            break;
+        default:
+            break;
+        }
+    }
+    if (offset == start) {
+        // an empty record would never advance
+        out.records.pop_back();
+        return false;
+    }
+    if (tpl.options) {
+        // options data is not a flow, but may announce the sampling interval of this source
+        out.records.pop_back();
+        auto &rates = exporter.sampling_rates;
+        if (interval && (rates.count(out.source_id) || rates.size() < MAX_TEMPLATES)) {
+            rates[out.source_id] = interval;
+        }
+        return true;
+    }
+    if (!interval) {
+        auto rate = exporter.sampling_rates.find(out.source_id);
+        interval = (rate != exporter.sampling_rates.end()) ? rate->second : 1;
+    }
+    rec.sampling_rate = interval;
+    return true;
+}
+
+}
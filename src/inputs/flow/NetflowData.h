@@ -0,0 +1,151 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace visor::input::flow {
+
+enum class FlowDirection : uint8_t {
+    unknown,
+    ingress,
+    egress
+};
+
+/**
+ * A single flow record, flattened from whichever NetFlow/IPFIX encoding it arrived in.
+ * IPv4 addresses occupy the first 4 bytes of the address arrays, in network byte order.
+ */
+struct NetflowRecord {
+    std::array<uint8_t, 16> src_addr;
+    std::array<uint8_t, 16> dst_addr;
+    uint64_t packets;
+    uint64_t bytes;
+    // packets represented by each counted packet: the record's own sampling interval field, else the interval its
+    // exporter announced in options data, else the v5 header interval; 1 when unsampled
+    uint32_t sampling_rate;
+    uint32_t input_if;
+    uint32_t output_if;
+    uint16_t src_port;
+    uint16_t dst_port;
+    // 4 or 6, 0 if the record carried no addresses
+    uint8_t ip_version;
+    uint8_t protocol;
+    uint8_t tcp_flags;
+    FlowDirection direction;
+};
+
+/**
+ * One export datagram. Decoding into the same NetflowDatagram repeatedly reuses the record storage, so in the steady
+ * state there is no heap allocation per datagram or per record.
+ */
+struct NetflowDatagram {
+    std::string exporter;
+    uint16_t version{0};
+    uint32_t export_time{0};
+    uint32_t sequence{0};
+    // v9 source id, IPFIX observation domain id, v5 engine type and id
+    uint32_t source_id{0};
+    // data sets which could not be decoded yet because their template has not been received
+    uint32_t missing_templates{0};
+    std::vector<NetflowRecord> records;
+};
+
+/**
+ * Decodes NetFlow v5, NetFlow v9 and IPFIX datagrams. v9 and IPFIX data sets are described by templates sent
+ * separately by each exporter, so the decoder keeps a template cache keyed by exporter, source id and template id.
+ * Sampling intervals exporters send in options data are kept per exporter and source id.
+ *
+ * Anyone able to reach the listening port can announce exporters and templates, so the cache is bounded: an exporter
+ * is only added once one of its template sets has been parsed, and the least recently used exporter or template is
+ * evicted when the cache is full.
+ *
+ * NOTE: intentionally _not_ thread safe; it should only be used from a single input thread
+ */
+class NetflowDecoder
+{
+public:
+    static constexpr size_t MAX_EXPORTERS = 1024;
+    // per exporter, also bounds the source ids with a sampling interval
+    static constexpr size_t MAX_TEMPLATES = 256;
+
+    struct Field {
+        uint16_t type;
+        // 0xFFFF is an IPFIX variable length field
+        uint16_t length;
+        bool enterprise;
+        // scope fields of an options template, whose types are not information elements in v9
+        bool scope{false};
+    };
+
+    struct Template {
+        std::vector<Field> fields;
+        // total record length, 0 if any field is variable length
+        size_t length{0};
+        // options template: its records describe the exporter rather than flows
+        bool options{false};
+        uint64_t last_used{0};
+    };
+
+    struct Exporter {
+        // (source id << 16 | template id) -> template
+        std::unordered_map<uint64_t, Template> templates;
+        // source id -> sampling interval announced in options data
+        std::unordered_map<uint32_t, uint32_t> sampling_rates;
+        uint64_t last_used{0};
+    };
+
+private:
+    std::map<std::string, Exporter> _exporters;
+    // orders uses of exporters and templates, for eviction
+    uint64_t _tick{0};
+    size_t _template_count{0};
+    uint64_t _evicted_exporters{0};
+    uint64_t _evicted_templates{0};
+
+    void _decode_v5(const uint8_t *data, size_t len, NetflowDatagram &out);
+    void _decode_v9(const uint8_t *data, size_t len, NetflowDatagram &out);
+    void _decode_ipfix(const uint8_t *data, size_t len, NetflowDatagram &out);
+
+    Exporter &_add_exporter(const std::string &exporter);
+    void _decode_sets(const uint8_t *data, size_t len, NetflowDatagram &out, bool ipfix);
+    void _read_templates(Exporter *&exporter, const uint8_t *data, size_t len, NetflowDatagram &out, bool ipfix, bool options);
+    void _read_data(Exporter &exporter, const Template &tpl, const uint8_t *data, size_t len, NetflowDatagram &out);
+    bool _read_record(Exporter &exporter, const Template &tpl, const uint8_t *data, size_t len, size_t &offset, NetflowDatagram &out);
+
+public:
+    /**
+     * decode a datagram received from exporter into out, replacing its records
+     * @throw std::invalid_argument for unsupported versions, std::out_of_range for truncated datagrams
+     */
+    void decode(const std::string &exporter, const uint8_t *data, size_t len, NetflowDatagram &out);
+
+    size_t template_count() const
+    {
+        return _template_count;
+    }
+
+    size_t exporter_count() const
+    {
+        return _exporters.size();
+    }
+
+    uint64_t evicted_exporters() const
+    {
+        return _evicted_exporters;
+    }
+
+    uint64_t evicted_templates() const
+    {
+        return _evicted_templates;
+    }
+};
+
+}
@@ -0,0 +1,272 @@
+#include "FlowInputStream.h"
+#include <catch2/catch.hpp>
+#include <cstring>
+#include <fmt/format.h>
+
+using namespace visor::input::flow;
+
+TEST_CASE("flow pcap file", "[flow][file]")
+{
+
+    FlowInputStream stream{"flow-test"};
+    stream.config_set("pcap_file", "tests/fixtures/netflow.pcap");
+
+    std::vector<uint16_t> versions;
+    std::vector<NetflowRecord> records;
+    std::vector<uint32_t> sampling_rates;
+    stream.netflow_signal.connect([&](const NetflowDatagram &datagram) {
+        versions.push_back(datagram.version);
+        records.insert(records.end(), datagram.records.begin(), datagram.records.end());
+        for (const auto &record : datagram.records) {
+            sampling_rates.push_back(record.sampling_rate);
+        }
+    });
+
+    CHECK_NOTHROW(stream.start());
+    CHECK_NOTHROW(stream.stop());
+
+    CHECK(stream.schema_key() == "flow");
+    CHECK(stream.consumer_count() == 1);
+
+    // v5, v9 data before its template, v9 template and data, IPFIX template and data
+    CHECK(versions == std::vector<uint16_t>{5, 9, 9, 10});
+    REQUIRE(records.size() == 7);
+    // only the IPFIX records carry a sampling interval
+    CHECK(sampling_rates == std::vector<uint32_t>{1, 1, 1, 1, 1, 100, 100});
+
+    CHECK(records[0].ip_version == 4);
+    CHECK(records[0].protocol == 6);
+    CHECK(records[0].src_port == 1234);
+    CHECK(records[0].dst_port == 80);
+    CHECK(records[0].packets == 10);
+    CHECK(records[0].bytes == 5000);
+    CHECK(records[0].tcp_flags == 0x1b);
+    CHECK(records[0].src_addr[0] == 10);
+
+    CHECK(records[3].direction == FlowDirection::egress);
+    CHECK(records[4].packets == 100);
+    CHECK(records[4].bytes == 150000);
+
+    CHECK(records[5].ip_version == 6);
+    CHECK(records[5].src_addr[0] == 0x20);
+    CHECK(records[5].src_port == 5000);
+    CHECK(records[5].packets == 5);
+    CHECK(records[6].bytes == 4000);
+
+    nlohmann::json j;
+    stream.info_json(j);
+    CHECK(j["flow"]["packet_errors"] == 1);
+    CHECK(j["flow"]["missing_templates"] == 1);
+    CHECK(j["flow"]["templates"] == 2);
+    CHECK(j["flow"]["exporters"] == 2);
+    CHECK(j["flow"]["evicted_exporters"] == 0);
+    CHECK(j["flow"]["evicted_templates"] == 0);
+    CHECK(j["module"]["config"]["pcap_file"] == "tests/fixtures/netflow.pcap");
+}
+
+TEST_CASE("netflow decoder", "[flow][decoder]")
+{
+    NetflowDecoder decoder;
+    NetflowDatagram datagram;
+
+    const uint8_t bad_version[]{0x00, 0x07, 0x00, 0x00};
+    CHECK_THROWS_AS(decoder.decode("127.0.0.1", bad_version, sizeof(bad_version), datagram), std::invalid_argument);
+
+    // a v5 header claiming one record, without the record
+    uint8_t truncated[24]{};
+    truncated[1] = 5;
+    truncated[3] = 1;
+    CHECK_THROWS_AS(decoder.decode("127.0.0.1", truncated, sizeof(truncated), datagram), std::out_of_range);
+
+    // a v5 datagram with a sampling interval
+    uint8_t sampled[24 + 48]{};
+    std::memcpy(sampled, truncated, sizeof(truncated));
+    sampled[22] = 0x40;
+    sampled[23] = 0x0A;
+    CHECK_NOTHROW(decoder.decode("127.0.0.1", sampled, sizeof(sampled), datagram));
+    REQUIRE(datagram.records.size() == 1);
+    CHECK(datagram.records[0].sampling_rate == 10);
+}
+
+namespace {
+
+void push16(std::vector<uint8_t> &out, uint16_t v)
+{
+    out.push_back(v >> 8);
+    out.push_back(v & 0xFF);
+}
+
+void push32(std::vector<uint8_t> &out, uint32_t v)
+{
+    push16(out, v >> 16);
+    push16(out, v & 0xFFFF);
+}
+
+std::vector<uint8_t> v9_set(uint16_t id, const std::vector<uint8_t> &body)
+{
+    std::vector<uint8_t> set;
+    push16(set, id);
+    push16(set, static_cast<uint16_t>(4 + body.size()));
+    set.insert(set.end(), body.begin(), body.end());
+    return set;
+}
+
+std::vector<uint8_t> v9_datagram(uint32_t source_id, const std::vector<std::vector<uint8_t>> &sets)
+{
+    std::vector<uint8_t> out;
+    push16(out, 9);
+    push16(out, static_cast<uint16_t>(sets.size()));
+    push32(out, 0);
+    push32(out, 0);
+    push32(out, 0);
+    push32(out, source_id);
+    for (const auto &set : sets) {
+        out.insert(out.end(), set.begin(), set.end());
+    }
+    return out;
+}
+
+// template id: IN_PKTS (4 bytes), SAMPLING_INTERVAL (4 bytes)
+std::vector<uint8_t> v9_template(uint16_t id)
+{
+    std::vector<uint8_t> body;
+    push16(body, id);
+    push16(body, 2);
+    push16(body, 2);
+    push16(body, 4);
+    push16(body, 34);
+    push16(body, 4);
+    return v9_set(0, body);
+}
+
+}
+
+TEST_CASE("netflow sampling intervals", "[flow][decoder]")
+{
+    NetflowDecoder decoder;
+    NetflowDatagram datagram;
+
+    // an interval in one record does not apply to the records before it
+    std::vector<uint8_t> data;
+    push32(data, 10);
+    push32(data, 0);
+    push32(data, 20);
+    push32(data, 50);
+    push32(data, 30);
+    push32(data, 0);
+    auto dg = v9_datagram(1, {v9_template(256), v9_set(256, data)});
+    decoder.decode("192.0.2.1", dg.data(), dg.size(), datagram);
+    REQUIRE(datagram.records.size() == 3);
+    CHECK(datagram.records[0].sampling_rate == 1);
+    CHECK(datagram.records[1].sampling_rate == 50);
+    CHECK(datagram.records[2].sampling_rate == 1);
+
+    // options template 257: scope system (4 bytes), SAMPLING_INTERVAL (4 bytes)
+    std::vector<uint8_t> options;
+    push16(options, 257);
+    push16(options, 4);
+    push16(options, 4);
+    push16(options, 1);
+    push16(options, 4);
+    push16(options, 34);
+    push16(options, 4);
+    std::vector<uint8_t> options_data;
+    push32(options_data, 0);
+    push32(options_data, 100);
+    dg = v9_datagram(1, {v9_set(1, options), v9_set(257, options_data)});
+    decoder.decode("192.0.2.1", dg.data(), dg.size(), datagram);
+    // options data is not a flow
+    CHECK(datagram.records.empty());
+    CHECK(decoder.template_count() == 2);
+
+    // records without their own interval take the one announced for their source
+    dg = v9_datagram(1, {v9_set(256, data)});
+    decoder.decode("192.0.2.1", dg.data(), dg.size(), datagram);
+    REQUIRE(datagram.records.size() == 3);
+    CHECK(datagram.records[0].sampling_rate == 100);
+    CHECK(datagram.records[1].sampling_rate == 50);
+    CHECK(datagram.records[2].sampling_rate == 100);
+
+    // other sources of the exporter are not affected
+    dg = v9_datagram(2, {v9_template(256), v9_set(256, data)});
+    decoder.decode("192.0.2.1", dg.data(), dg.size(), datagram);
+    REQUIRE(datagram.records.size() == 3);
+    CHECK(datagram.records[0].sampling_rate == 1);
+}
+
+TEST_CASE("netflow template cache is bounded", "[flow][decoder]")
+{
+    NetflowDecoder decoder;
+    NetflowDatagram datagram;
+
+    // data without a template does not add its exporter
+    std::vector<uint8_t> data;
+    push32(data, 10);
+    push32(data, 0);
+    auto dg = v9_datagram(1, {v9_set(256, data)});
+    decoder.decode("192.0.2.1", dg.data(), dg.size(), datagram);
+    CHECK(datagram.missing_templates == 1);
+    CHECK(decoder.exporter_count() == 0);
+
+    dg = v9_datagram(1, {v9_template(256)});
+    for (size_t i = 0; i <= NetflowDecoder::MAX_EXPORTERS; ++i) {
+        decoder.decode(fmt::format("10.0.{}.{}", i >> 8, i & 0xFF), dg.data(), dg.size(), datagram);
+    }
+    CHECK(decoder.exporter_count() == NetflowDecoder::MAX_EXPORTERS);
+    CHECK(decoder.template_count() == NetflowDecoder::MAX_EXPORTERS);
+    CHECK(decoder.evicted_exporters() == 1);
+    // the least recently used exporter went, the latest is decoded
+    auto data_dg = v9_datagram(1, {v9_set(256, data)});
+    decoder.decode("10.0.0.0", data_dg.data(), data_dg.size(), datagram);
+    CHECK(datagram.missing_templates == 1);
+    decoder.decode(fmt::format("10.0.{}.{}", NetflowDecoder::MAX_EXPORTERS >> 8, NetflowDecoder::MAX_EXPORTERS & 0xFF), data_dg.data(), data_dg.size(), datagram);
+    CHECK(datagram.missing_templates == 0);
+    CHECK(datagram.records.size() == 1);
+
+    for (uint16_t id = 256; id <= 256 + NetflowDecoder::MAX_TEMPLATES; ++id) {
+        dg = v9_datagram(1, {v9_template(id)});
+        decoder.decode("10.0.0.1", dg.data(), dg.size(), datagram);
+    }
+    CHECK(decoder.evicted_templates() == 1);
+    CHECK(decoder.template_count() == NetflowDecoder::MAX_EXPORTERS - 1 + NetflowDecoder::MAX_TEMPLATES);
+    // template 256 was the oldest
+    decoder.decode("10.0.0.1", data_dg.data(), data_dg.size(), datagram);
+    CHECK(datagram.missing_templates == 1);
+}
+
+TEST_CASE("flow udp socket", "[flow][udp]")
+{
+
+    std::string bind = "127.0.0.1";
+    uint64_t port = 2055;
+
+    FlowInputStream stream{"flow-test"};
+    stream.config_set("bind", bind);
+    stream.config_set("port", port);
+
+    CHECK_NOTHROW(stream.start());
+
+    auto loop = uvw::Loop::getDefault();
+    auto client = loop->resource<uvw::UDPHandle>();
+    client->once<uvw::SendEvent>([](const uvw::SendEvent &, uvw::UDPHandle &handle) {
+        handle.close();
+    });
+    auto dataSend = std::unique_ptr<char[]>(new char[2]{'b', 'c'});
+    client->send(uvw::Addr{bind, static_cast<unsigned int>(port)}, dataSend.get(), 2);
+    client->send(bind, port, nullptr, 0);
+
+    uv_sleep(100);
+
+    CHECK_NOTHROW(stream.stop());
+
+    nlohmann::json j;
+    stream.info_json(j);
+    CHECK(j["flow"]["packet_errors"] == 1);
+}
+
+TEST_CASE("flow udp socket without bind", "[flow][udp]")
+{
+    FlowInputStream stream{"flow-test"};
+
+    CHECK_THROWS_WITH(stream.start(), "flow config must specify port and bind");
+}
@@ -336,8 +336,19 @@ void PcapInputStream::_generate_mock_traffic()
     pcpp::ProtocolType l4 = pcpp::UDP;
     timespec ts;
     timespec_get(&ts, TIME_UTC);
+    auto flowkey = pcpp::hash5Tuple(&packet);
     packet_signal(packet, dir, l3, l4, ts);
-    udp_signal(packet, dir, l3, pcpp::hash5Tuple(&packet), ts);
+    udp_signal(packet, dir, l3, flowkey, ts);
+    if (_flow_consumers.load(std::memory_order_relaxed)) {
+        flow_signal(packet, dir, l3, l4, flowkey, ts);
+    }
+}
+
+void PcapInputStream::flow_disconnect(sigslot::connection &connection)
+{
+    connection.disconnect();
+    std::unique_lock lock(_flow_mutex);
+    _flow_consumers.store(flow_signal.slot_count() > 0, std::memory_order_relaxed);
 }
 
 void PcapInputStream::process_raw_packet(pcpp::RawPacket *rawPacket)
@@ -382,11 +393,22 @@ void PcapInputStream::process_raw_packet(pcpp::RawPacket *rawPacket)
         }
     }
 
+    // the 5-tuple hash is shared by the udp and flow consumers, so compute it at most once
+    bool flows = _flow_consumers.load(std::memory_order_relaxed);
+    uint32_t flowkey{0};
+    if (l4 == pcpp::UDP || (l4 == pcpp::TCP && flows)) {
+        flowkey = pcpp::hash5Tuple(&packet);
+    }
+
     // interface to handlers
     packet_signal(packet, dir, l3, l4, rawPacket->getPacketTimeStamp());
 
+    if (flows && (l4 == pcpp::UDP || l4 == pcpp::TCP)) {
+        flow_signal(packet, dir, l3, l4, flowkey, rawPacket->getPacketTimeStamp());
+    }
+
     if (l4 == pcpp::UDP) {
-        udp_signal(packet, dir, l3, pcpp::hash5Tuple(&packet), rawPacket->getPacketTimeStamp());
+        udp_signal(packet, dir, l3, flowkey, rawPacket->getPacketTimeStamp());
     } else if (l4 == pcpp::TCP) {
         auto result = _tcp_reassembly.reassemblePacket(packet);
         switch (result) {
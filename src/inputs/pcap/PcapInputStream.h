@@ -13,8 +13,10 @@
 #include <UdpLayer.h>
 #pragma GCC diagnostic pop
 #include "utils.h"
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <sigslot/signal.hpp>
 #include <unordered_map>
 #include <vector>
@@ -62,6 +64,11 @@ private:
 
     pcpp::TcpReassembly _tcp_reassembly;
 
+    // whether flow_signal has consumers, so packets can skip the 5-tuple hash and the emission without taking the
+    // signal's lock
+    std::mutex _flow_mutex;
+    std::atomic<bool> _flow_consumers{false};
+
 protected:
     void _open_pcap(const std::string &fileName, const std::string &bpfFilter);
     void _open_libpcap_iface(const std::string &bpfFilter = "");
@@ -87,7 +94,7 @@ public:
     void info_json(json &j) const override;
     size_t consumer_count() const override
     {
-        return packet_signal.slot_count() + udp_signal.slot_count() + start_tstamp_signal.slot_count() + tcp_message_ready_signal.slot_count() + tcp_connection_start_signal.slot_count() + tcp_connection_end_signal.slot_count() + tcp_reassembly_error_signal.slot_count() + pcap_stats_signal.slot_count();
+        return packet_signal.slot_count() + udp_signal.slot_count() + flow_signal.slot_count() + start_tstamp_signal.slot_count() + tcp_message_ready_signal.slot_count() + tcp_connection_start_signal.slot_count() + tcp_connection_end_signal.slot_count() + tcp_reassembly_error_signal.slot_count() + pcap_stats_signal.slot_count();
     }
 
     // utilities
@@ -100,11 +107,27 @@ public:
     void tcp_connection_start(const pcpp::ConnectionData &connectionData);
     void tcp_connection_end(const pcpp::ConnectionData &connectionData, pcpp::TcpReassembly::ConnectionEndReason reason);
 
+    /**
+     * connect to and disconnect from flow_signal. packets are only hashed and emitted on flow_signal while it has
+     * consumers, so consumers should connect through these rather than to flow_signal directly
+     */
+    template <typename... Args>
+    sigslot::connection flow_connect(Args &&...args)
+    {
+        auto connection = flow_signal.connect(std::forward<Args>(args)...);
+        std::unique_lock lock(_flow_mutex);
+        _flow_consumers.store(flow_signal.slot_count() > 0, std::memory_order_relaxed);
+        return connection;
+    }
+    void flow_disconnect(sigslot::connection &connection);
+
     // handler functionality
     // IF THIS changes, see consumer_count()
     // note: these are mutable because consumer_count() calls slot_count() which is not const (unclear if it could/should be)
     mutable sigslot::signal<pcpp::Packet &, PacketDirection, pcpp::ProtocolType, pcpp::ProtocolType, timespec> packet_signal;
     mutable sigslot::signal<pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec> udp_signal;
+    // TCP and UDP packets along with their (direction independent) 5-tuple hash
+    mutable sigslot::signal<pcpp::Packet &, PacketDirection, pcpp::ProtocolType, pcpp::ProtocolType, uint32_t, timespec> flow_signal;
     mutable sigslot::signal<timespec> start_tstamp_signal;
     mutable sigslot::signal<timespec> end_tstamp_signal;
     mutable sigslot::signal<int8_t, const pcpp::TcpStreamData &> tcp_message_ready_signal;
@@ -9,9 +9,13 @@
 
 #pragma once
 
+#include <cstring>
+#include <fmt/format.h>
 #include <netinet/in.h>
 #include <sflow.h>
 #include <sflow_v2v4.h>
+#include <stdexcept>
+#include <vector>
 
 #define IPX_HDR_LEN 30
 #define IPX_MAX_DATA 546
@@ -90,6 +94,16 @@ struct myicmphdr {
                   /* ignore the rest */
 };
 
+/* which parts of a datagram read_sflow_datagram decodes, so that consumers only pay for the fields they use */
+enum DecodeFlags : uint32_t {
+    DECODE_FLOW_SAMPLES = 1 << 0,
+    DECODE_COUNTER_SAMPLES = 1 << 1,
+    /* flow sample elements other than the sampled header and the IPv4/IPv6 structs: ethernet, tunnels and extended data */
+    DECODE_FLOW_EXTENDED = 1 << 2,
+    DECODE_ALL = DECODE_FLOW_SAMPLES | DECODE_COUNTER_SAMPLES | DECODE_FLOW_EXTENDED
+};
+
+/* a decode context: it may be reused for any number of datagrams, which keeps the elements storage allocated */
 struct SFSample {
     /* the raw pdu */
     uint8_t *rawSample;
@@ -101,6 +115,9 @@ struct SFSample {
     /* decode cursor */
     uint32_t *datap;
 
+    /* DecodeFlags */
+    uint32_t decodeFlags{DECODE_ALL};
+
     /* datagram fields */
     SFLAddress sourceIP;
     SFLAddress agent_addr;
@@ -935,6 +952,12 @@ static void readFlowSample(SFSample *sample, bool expanded)
         length = getData32(sample);
         start = reinterpret_cast<uint8_t *>(sample->datap);
 
+        if (!(sample->decodeFlags & DECODE_FLOW_EXTENDED) && tag != SFLFLOW_HEADER && tag != SFLFLOW_IPV4 && tag != SFLFLOW_IPV6) {
+            skipBytes(sample, length);
+            lengthCheck(sample, "flow_sample_element", start, length);
+            continue;
+        }
+
         switch (tag) {
         case SFLFLOW_HEADER:
             readFlowSample_header(sample);
@@ -1016,6 +1039,8 @@ static void read_sflow_datagram(SFSample *sample)
 {
     sample->datap = reinterpret_cast<uint32_t *>(sample->rawSample);
     sample->endp = reinterpret_cast<uint8_t *>(sample->rawSample + sample->rawSampleLen);
+    sample->agentSubId = 0;
+    sample->elements.clear();
 
     sample->datagramVersion = getData32(sample);
 
@@ -1047,6 +1072,25 @@ static void read_sflow_datagram(SFSample *sample)
         sample->s.sampleType = getData32(sample);
 
         if (sample->datagramVersion >= 5) {
+            /* v5 samples are length prefixed, so the ones nobody asked for are skipped without decoding */
+            bool wanted{true};
+            switch (sample->s.sampleType) {
+            case SFLFLOW_SAMPLE:
+            case SFLFLOW_SAMPLE_EXPANDED:
+                wanted = sample->decodeFlags & DECODE_FLOW_SAMPLES;
+                break;
+            case SFLCOUNTERS_SAMPLE:
+            case SFLCOUNTERS_SAMPLE_EXPANDED:
+                wanted = sample->decodeFlags & DECODE_COUNTER_SAMPLES;
+                break;
+            default:
+                wanted = false;
+                break;
+            }
+            if (!wanted) {
+                skipBytes(sample, getData32(sample));
+                continue;
+            }
             switch (sample->s.sampleType) {
             case SFLFLOW_SAMPLE:
                 readFlowSample(sample, false);
@@ -1060,21 +1104,25 @@ static void read_sflow_datagram(SFSample *sample)
             case SFLCOUNTERS_SAMPLE_EXPANDED:
                 readCountersSample(sample, true);
                 break;
-            default:
-                skipBytes(sample, getData32(sample));
-                break;
             }
         } else {
+            /* v2 and v4 samples have no length, they must be decoded to find the next one */
+            bool wanted{true};
             switch (sample->s.sampleType) {
             case FLOWSAMPLE:
                 readFlowSample_v2v4(sample);
+                wanted = sample->decodeFlags & DECODE_FLOW_SAMPLES;
                 break;
             case COUNTERSSAMPLE:
                 readCountersSample_v2v4(sample);
+                wanted = sample->decodeFlags & DECODE_COUNTER_SAMPLES;
                 break;
             default:
                 throw std::invalid_argument("unexpected sample type");
             }
+            if (!wanted) {
+                continue;
+            }
         }
         sample->elements.push_back(sample->s);
     }
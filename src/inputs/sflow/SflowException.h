@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <stdexcept>
+#include <string>
+
 namespace visor::input::sflow {
 
 class SflowException : public std::runtime_error
@@ -13,6 +16,10 @@ public:
         : std::runtime_error(msg)
     {
     }
+    SflowException(const std::string &msg)
+        : std::runtime_error(msg)
+    {
+    }
 };
 
 }
\ No newline at end of file
@@ -7,6 +7,12 @@
 #include <Packet.h>
 #include <PcapFileDevice.h>
 #include <UdpLayer.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
 namespace visor::input::sflow {
 
 SflowInputStream::SflowInputStream(const std::string &name)
@@ -30,7 +36,11 @@ void SflowInputStream::start()
         _read_from_pcap_file();
         return;
     } else if (config_exists("port") && config_exists("bind")) {
-        _create_frame_stream_udp_socket();
+        if (config_exists("recv_threads")) {
+            _create_reuseport_receivers();
+        } else {
+            _create_frame_stream_udp_socket();
+        }
     } else {
         throw SflowException("sflow config must specify port and bind");
     }
@@ -47,14 +57,14 @@ void SflowInputStream::_read_from_pcap_file()
 
     datasketches::frequent_items_sketch<uint16_t> sketch(3);
 
+    SFSample sample{};
     while (reader->getNextPacket(rawPacket)) {
         pcpp::Packet sflow_pkt(&rawPacket);
         if (sflow_pkt.isPacketOfType(pcpp::UDP)) {
             pcpp::UdpLayer *udpLayer = sflow_pkt.getLayerOfType<pcpp::UdpLayer>();
-            SFSample sample;
-            std::memset(&sample, 0, sizeof(sample));
             sample.rawSample = udpLayer->getLayerPayload();
             sample.rawSampleLen = udpLayer->getLayerPayloadSize();
+            sample.decodeFlags = decode_flags();
             try {
                 read_sflow_datagram(&sample);
                 sflow_signal(sample);
@@ -107,24 +117,21 @@ void SflowInputStream::_create_frame_stream_udp_socket()
 
     // ListenEvent happens on client connection
     _udp_server_h->on<uvw::UDPDataEvent>([this](const uvw::UDPDataEvent &event, uvw::UDPHandle &) {
-        SFSample sample;
-        std::memset(&sample, 0, sizeof(sample));
-        sample.rawSample = reinterpret_cast<uint8_t *>(event.data.get());
-        sample.rawSampleLen = event.length;
-        sample.sourceIP.type = SFLADDRESSTYPE_IP_V4;
-        struct sockaddr_in peer4;
-        inet_pton(AF_INET, event.sender.ip.c_str(), &(peer4.sin_addr));
-        std::memcpy(&sample.sourceIP.address.ip_v4.addr, &peer4.sin_addr, 4);
-        try {
-            read_sflow_datagram(&sample);
-            sflow_signal(sample);
-        } catch (const std::exception &e) {
-            ++_error_count;
+        struct sockaddr_storage peer;
+        std::memset(&peer, 0, sizeof(peer));
+        if (inet_pton(AF_INET, event.sender.ip.c_str(), &reinterpret_cast<struct sockaddr_in *>(&peer)->sin_addr) == 1) {
+            peer.ss_family = AF_INET;
+        } else if (inet_pton(AF_INET6, event.sender.ip.c_str(), &reinterpret_cast<struct sockaddr_in6 *>(&peer)->sin6_addr) == 1) {
+            peer.ss_family = AF_INET6;
         }
+        _process_datagram(_udp_sample, reinterpret_cast<uint8_t *>(event.data.get()), event.length, reinterpret_cast<struct sockaddr *>(&peer));
     });
 
     _logger->info("[{}] binding sflow UDP server on {}:{}", _name, bind, port);
     _udp_server_h->bind(bind, port);
+    if (config_exists("rcvbuf")) {
+        _udp_server_h->recvBufferSize(static_cast<int>(config_get<uint64_t>("rcvbuf")));
+    }
     _udp_server_h->recv();
 
     // spawn the loop
@@ -133,6 +140,205 @@ void SflowInputStream::_create_frame_stream_udp_socket()
     });
 }
 
+void SflowInputStream::require_decode(const void *consumer, uint32_t flags)
+{
+    std::unique_lock lock(_decode_mutex);
+    _decode_consumers[consumer] = flags;
+    _update_decode_flags();
+}
+
+void SflowInputStream::release_decode(const void *consumer)
+{
+    std::unique_lock lock(_decode_mutex);
+    _decode_consumers.erase(consumer);
+    _update_decode_flags();
+}
+
+void SflowInputStream::sflow_disconnect(sigslot::connection &connection)
+{
+    connection.disconnect();
+    std::unique_lock lock(_decode_mutex);
+    _update_decode_flags();
+}
+
+void SflowInputStream::_update_decode_flags()
+{
+    if (_decode_consumers.empty() || _decode_consumers.size() < sflow_signal.slot_count()) {
+        _decode_flags.store(DECODE_ALL, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t flags{0};
+    for (const auto &[consumer, consumer_flags] : _decode_consumers) {
+        flags |= consumer_flags;
+    }
+    _decode_flags.store(flags, std::memory_order_relaxed);
+}
+
+void SflowInputStream::_process_datagram(SFSample &sample, uint8_t *data, size_t len, const struct sockaddr *peer)
+{
+    sample.rawSample = data;
+    sample.rawSampleLen = len;
+    sample.decodeFlags = decode_flags();
+    sample.sourceIP = {};
+    if (peer->sa_family == AF_INET) {
+        sample.sourceIP.type = SFLADDRESSTYPE_IP_V4;
+        std::memcpy(&sample.sourceIP.address.ip_v4.addr, &reinterpret_cast<const struct sockaddr_in *>(peer)->sin_addr, 4);
+    } else if (peer->sa_family == AF_INET6) {
+        sample.sourceIP.type = SFLADDRESSTYPE_IP_V6;
+        std::memcpy(&sample.sourceIP.address.ip_v6.addr, &reinterpret_cast<const struct sockaddr_in6 *>(peer)->sin6_addr, 16);
+    }
+    try {
+        read_sflow_datagram(&sample);
+        sflow_signal(sample);
+    } catch (const std::exception &e) {
+        ++_error_count;
+    }
+}
+
+void SflowInputStream::_create_reuseport_receivers()
+{
+    auto bind = config_get<std::string>("bind");
+    auto port = config_get<uint64_t>("port");
+    auto threads = config_get<uint64_t>("recv_threads");
+    if (threads < 1 || threads > MAX_RECV_THREADS) {
+        throw SflowException(fmt::format("recv_threads must be between 1 and {}", MAX_RECV_THREADS));
+    }
+    uint64_t batch{DEFAULT_RECV_BATCH};
+    if (config_exists("recv_batch")) {
+        batch = config_get<uint64_t>("recv_batch");
+        if (batch < 1 || batch > MAX_RECV_BATCH) {
+            throw SflowException(fmt::format("recv_batch must be between 1 and {}", MAX_RECV_BATCH));
+        }
+    }
+    if (threads * batch * RECV_BUFFER_SIZE > MAX_RECV_POOL_SIZE) {
+        throw SflowException(fmt::format("recv_threads * recv_batch must not exceed {}", MAX_RECV_POOL_SIZE / RECV_BUFFER_SIZE));
+    }
+    int rcvbuf{0};
+    if (config_exists("rcvbuf")) {
+        rcvbuf = static_cast<int>(config_get<uint64_t>("rcvbuf"));
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    std::memset(&addr, 0, sizeof(addr));
+    auto sa4 = reinterpret_cast<struct sockaddr_in *>(&addr);
+    auto sa6 = reinterpret_cast<struct sockaddr_in6 *>(&addr);
+    if (inet_pton(AF_INET, bind.c_str(), &sa4->sin_addr) == 1) {
+        sa4->sin_family = AF_INET;
+        sa4->sin_port = htons(static_cast<uint16_t>(port));
+        addr_len = sizeof(struct sockaddr_in);
+    } else if (inet_pton(AF_INET6, bind.c_str(), &sa6->sin6_addr) == 1) {
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = htons(static_cast<uint16_t>(port));
+        addr_len = sizeof(struct sockaddr_in6);
+    } else {
+        throw SflowException(fmt::format("invalid bind address: {}", bind));
+    }
+
+    _close_receivers();
+    // every socket binds the same address, the kernel spreads datagrams between them by flow hash
+    try {
+        for (uint64_t i = 0; i < threads; ++i) {
+            auto receiver = std::make_unique<Receiver>();
+            receiver->fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (receiver->fd < 0) {
+                throw SflowException(fmt::format("unable to create socket: {}", std::strerror(errno)));
+            }
+            _receivers.push_back(std::move(receiver));
+            int fd = _receivers.back()->fd;
+            int on = 1;
+            if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+                throw SflowException(fmt::format("unable to set SO_REUSEPORT: {}", std::strerror(errno)));
+            }
+            if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0) {
+                _logger->warn("[{}] unable to set SO_RXQ_OVFL, socket drops will not be counted: {}", _name, std::strerror(errno));
+            }
+            // SO_RCVBUFFORCE may exceed net.core.rmem_max, but requires CAP_NET_ADMIN
+            if (rcvbuf && setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0
+                && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+                _logger->warn("[{}] unable to set receive buffer size {}: {}", _name, rcvbuf, std::strerror(errno));
+            }
+            // wake up periodically to notice stop()
+            struct timeval timeout {
+                0, 100000
+            };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            if (::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), addr_len) < 0) {
+                throw SflowException(fmt::format("unable to bind {}:{}: {}", bind, port, std::strerror(errno)));
+            }
+        }
+    } catch (const SflowException &) {
+        _close_receivers();
+        throw;
+    }
+
+    _logger->info("[{}] binding sflow UDP server on {}:{} with {} recvmmsg threads", _name, bind, port, threads);
+    _receivers_stop = false;
+    for (auto &receiver : _receivers) {
+        receiver->thread = std::thread(&SflowInputStream::_receive_loop, this, receiver.get(), batch);
+    }
+}
+
+void SflowInputStream::_close_receivers()
+{
+    for (auto &receiver : _receivers) {
+        if (receiver->fd >= 0) {
+            close(receiver->fd);
+        }
+    }
+    _receivers.clear();
+}
+
+void SflowInputStream::_receive_loop(Receiver *receiver, size_t batch)
+{
+    // the buffer pool is allocated once, each recvmmsg call fills up to batch datagrams
+    std::vector<uint8_t> buffers(batch * RECV_BUFFER_SIZE);
+    std::vector<struct mmsghdr> msgs(batch);
+    std::vector<struct iovec> iovecs(batch);
+    std::vector<struct sockaddr_storage> peers(batch);
+    constexpr size_t control_len = CMSG_SPACE(sizeof(uint32_t));
+    std::vector<uint8_t> controls(batch * control_len);
+    SFSample sample{};
+
+    while (!_receivers_stop.load(std::memory_order_relaxed)) {
+        // the kernel updates the lengths, so they are reset for every call
+        for (size_t i = 0; i < batch; ++i) {
+            iovecs[i].iov_base = &buffers[i * RECV_BUFFER_SIZE];
+            iovecs[i].iov_len = RECV_BUFFER_SIZE;
+            std::memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_name = &peers[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = &controls[i * control_len];
+            msgs[i].msg_hdr.msg_controllen = control_len;
+        }
+        int count = recvmmsg(receiver->fd, msgs.data(), static_cast<unsigned int>(batch), MSG_WAITFORONE, nullptr);
+        if (count < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                continue;
+            }
+            _logger->error("[{}] recvmmsg error: {}", _name, std::strerror(errno));
+            break;
+        }
+        for (int i = 0; i < count; ++i) {
+            auto &hdr = msgs[i].msg_hdr;
+            for (auto cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                    uint32_t drops;
+                    std::memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                    receiver->drops.store(drops, std::memory_order_relaxed);
+                }
+            }
+            if (hdr.msg_flags & MSG_TRUNC) {
+                ++_error_count;
+                continue;
+            }
+            _process_datagram(sample, static_cast<uint8_t *>(iovecs[i].iov_base), msgs[i].msg_len, reinterpret_cast<struct sockaddr *>(&peers[i]));
+        }
+    }
+}
+
 void SflowInputStream::stop()
 {
     if (!_running) {
@@ -148,6 +354,20 @@ void SflowInputStream::stop()
         }
     }
 
+    if (!_receivers.empty()) {
+        _receivers_stop = true;
+        for (auto &receiver : _receivers) {
+            if (receiver->thread.joinable()) {
+                receiver->thread.join();
+            }
+        }
+        // receivers are kept until the next start so their drop counts are still reported
+        for (auto &receiver : _receivers) {
+            close(receiver->fd);
+            receiver->fd = -1;
+        }
+    }
+
     _running = false;
 }
 
@@ -155,6 +375,13 @@ void SflowInputStream::info_json(json &j) const
 {
     common_info_json(j);
     j[schema_key()]["packet_errors"] = _error_count.load();
+    if (!_receivers.empty()) {
+        uint64_t drops{0};
+        for (const auto &receiver : _receivers) {
+            drops += receiver->drops.load(std::memory_order_relaxed);
+        }
+        j[schema_key()]["socket_drops"] = drops;
+    }
 }
 
 }
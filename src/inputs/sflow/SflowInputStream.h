@@ -8,12 +8,37 @@
 #include "SflowData.h"
 #include <sigslot/signal.hpp>
 #include <spdlog/spdlog.h>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <uvw.hpp>
+#include <vector>
 
 namespace visor::input::sflow {
 
 class SflowInputStream : public visor::InputStream
 {
+public:
+    // room for a datagram in a jumbo frame, larger ones are truncated and counted as errors. a multiple of 8 so
+    // every buffer in the receive pool stays aligned for the decoder
+    static constexpr size_t RECV_BUFFER_SIZE = 9216;
+    static constexpr uint64_t DEFAULT_RECV_BATCH = 64;
+    static constexpr uint64_t MAX_RECV_THREADS = 64;
+    static constexpr uint64_t MAX_RECV_BATCH = 1024;
+    // upper bound of recv_threads * recv_batch * RECV_BUFFER_SIZE
+    static constexpr size_t MAX_RECV_POOL_SIZE = 64 * 1024 * 1024;
+
+private:
+    /**
+     * one SO_REUSEPORT socket and the thread reading it with recvmmsg
+     */
+    struct Receiver {
+        int fd{-1};
+        std::thread thread;
+        // SO_RXQ_OVFL, the cumulative count of datagrams the kernel dropped on this socket
+        std::atomic<uint32_t> drops{0};
+    };
+
     std::atomic<uint64_t> _error_count;
     std::shared_ptr<spdlog::logger> _logger;
 
@@ -23,8 +48,28 @@ class SflowInputStream : public visor::InputStream
 
     std::shared_ptr<uvw::UDPHandle> _udp_server_h;
 
+    // decode context of the uvw receive path, only used from the io thread
+    SFSample _udp_sample{};
+
+    // DecodeFlags declared by each consumer, and the flags every datagram is decoded with: their union once every
+    // connected consumer has declared, DECODE_ALL otherwise. recomputed when consumers declare, release, connect or
+    // disconnect, so the receive threads only load the atomic
+    std::mutex _decode_mutex;
+    std::unordered_map<const void *, uint32_t> _decode_consumers;
+    std::atomic<uint32_t> _decode_flags{DECODE_ALL};
+
+    void _update_decode_flags();
+
+    std::vector<std::unique_ptr<Receiver>> _receivers;
+    std::atomic<bool> _receivers_stop{false};
+
     void _read_from_pcap_file();
     void _create_frame_stream_udp_socket();
+    void _create_reuseport_receivers();
+    void _receive_loop(Receiver *receiver, size_t batch);
+    void _process_datagram(SFSample &sample, uint8_t *data, size_t len, const struct sockaddr *peer);
+    void _close_receivers();
+
 public:
     SflowInputStream(const std::string &name);
     ~SflowInputStream() = default;
@@ -42,6 +87,35 @@ public:
         return sflow_signal.slot_count();
     }
 
+    /**
+     * consumers declare which parts of each datagram they use before connecting to sflow_signal, and release the
+     * declaration after disconnecting. samples and elements nobody asked for are skipped rather than decoded. since the
+     * decode is shared, everything is decoded while any connected consumer has not declared.
+     *
+     * @param consumer identifies the declaration, usually the connecting handler
+     * @param flags DecodeFlags
+     */
+    void require_decode(const void *consumer, uint32_t flags);
+    void release_decode(const void *consumer);
+    uint32_t decode_flags() const
+    {
+        return _decode_flags.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * connect to and disconnect from sflow_signal, accounting for consumers which have not declared their DecodeFlags.
+     * consumers should connect through these rather than to sflow_signal directly
+     */
+    template <typename... Args>
+    sigslot::connection sflow_connect(Args &&...args)
+    {
+        auto connection = sflow_signal.connect(std::forward<Args>(args)...);
+        std::unique_lock lock(_decode_mutex);
+        _update_decode_flags();
+        return connection;
+    }
+    void sflow_disconnect(sigslot::connection &connection);
+
     // handler functionality
     // IF THIS changes, see consumer_count()
     // note: these are mutable because consumer_count() calls slot_count() which is not const (unclear if it could/should be)
@@ -0,0 +1,49 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "SflowData.h"
+#include "sflow_datagram.h"
+#include <benchmark/benchmark.h>
+
+using namespace visor::input::sflow;
+
+// the embedded datagram of the unit tests: one counter sample, and one flow sample with a sampled header and two
+// extended elements
+
+static void decode(SFSample &sample, uint32_t flags)
+{
+    sample.rawSample = sflow_datagram;
+    sample.rawSampleLen = sizeof(sflow_datagram);
+    sample.decodeFlags = flags;
+    read_sflow_datagram(&sample);
+}
+
+// a new decode context per datagram, as before contexts were reused
+static void BM_sflowDecodeNewContext(benchmark::State &state)
+{
+    for (auto _ : state) {
+        SFSample sample{};
+        decode(sample, DECODE_ALL);
+        benchmark::DoNotOptimize(sample.elements.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_sflowDecodeNewContext);
+
+static void BM_sflowDecode(benchmark::State &state)
+{
+    SFSample sample{};
+    for (auto _ : state) {
+        decode(sample, static_cast<uint32_t>(state.range(0)));
+        benchmark::DoNotOptimize(sample.elements.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_sflowDecode)
+    ->Arg(DECODE_ALL)
+    ->Arg(DECODE_FLOW_SAMPLES | DECODE_FLOW_EXTENDED)
+    ->Arg(DECODE_FLOW_SAMPLES)
+    ->Arg(DECODE_COUNTER_SAMPLES);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,25 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include "SflowInputStream.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace visor::input::sflow {
+
+// decode an embedded test datagram the way the input does, with the flags its consumers declared, and signal it to them
+template <size_t N>
+void emit_datagram(SflowInputStream &stream, uint8_t (&datagram)[N])
+{
+    SFSample sample{};
+    sample.rawSample = datagram;
+    sample.rawSampleLen = N;
+    sample.decodeFlags = stream.decode_flags();
+    read_sflow_datagram(&sample);
+    stream.sflow_signal(sample);
+}
+
+}
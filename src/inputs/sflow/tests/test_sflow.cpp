@@ -1,5 +1,9 @@
+#include "SflowException.h"
 #include "SflowInputStream.h"
+#include "sflow_datagram.h"
 #include <catch2/catch.hpp>
+#include <cstring>
+#include <mutex>
 
 using namespace visor::input::sflow;
 
@@ -51,9 +55,138 @@ TEST_CASE("sflow udp socket", "[sflow][udp]")
     CHECK(j["sflow"]["packet_errors"] == 1);
 }
 
+TEST_CASE("sflow udp socket with recvmmsg threads", "[sflow][udp]")
+{
+
+    std::string bind = "127.0.0.1";
+    uint64_t port = 6344;
+
+    SflowInputStream stream{"sflow-test"};
+    stream.config_set("bind", bind);
+    stream.config_set("port", port);
+    stream.config_set<uint64_t>("recv_threads", 2);
+    stream.config_set<uint64_t>("recv_batch", 8);
+    stream.config_set<uint64_t>("rcvbuf", 1048576);
+
+    // samples are signalled from the receive threads
+    std::mutex mutex;
+    std::vector<std::pair<uint32_t, size_t>> received;
+    auto connection = stream.sflow_connect([&](const SFSample &sample) {
+        std::lock_guard lock(mutex);
+        received.emplace_back(sample.agent_addr.address.ip_v4.addr, sample.elements.size());
+    });
+
+    CHECK_NOTHROW(stream.start());
+
+    auto loop = uvw::Loop::getDefault();
+    auto client = loop->resource<uvw::UDPHandle>();
+    client->once<uvw::SendEvent>([](const uvw::SendEvent &, uvw::UDPHandle &handle) {
+        handle.close();
+    });
+    auto dataSend = std::unique_ptr<char[]>(new char[2]{'b', 'c'});
+    client->send(uvw::Addr{bind, static_cast<unsigned int>(port)}, dataSend.get(), 2);
+    auto datagram = std::unique_ptr<char[]>(new char[sizeof(sflow_datagram)]);
+    std::memcpy(datagram.get(), sflow_datagram, sizeof(sflow_datagram));
+    client->send(uvw::Addr{bind, static_cast<unsigned int>(port)}, datagram.get(), sizeof(sflow_datagram));
+
+    uv_sleep(200);
+
+    CHECK_NOTHROW(stream.stop());
+    stream.sflow_disconnect(connection);
+
+    {
+        std::lock_guard lock(mutex);
+        REQUIRE(received.size() == 1);
+        CHECK(received[0].first == htonl(0xc0a80001));
+        // a consumer which did not declare gets every sample decoded, one counter and one flow sample here
+        CHECK(received[0].second == 2);
+    }
+
+    nlohmann::json j;
+    stream.info_json(j);
+    CHECK(j["sflow"]["packet_errors"] == 1);
+    CHECK(j["sflow"]["socket_drops"] == 0);
+}
+
+TEST_CASE("sflow udp socket with invalid recv_threads", "[sflow][udp]")
+{
+    SflowInputStream stream{"sflow-test"};
+    stream.config_set("bind", "127.0.0.1");
+    stream.config_set<uint64_t>("port", 6345);
+    stream.config_set<uint64_t>("recv_threads", 0);
+
+    CHECK_THROWS_AS(stream.start(), SflowException);
+}
+
+TEST_CASE("sflow udp socket with oversized receive pool", "[sflow][udp]")
+{
+    SflowInputStream stream{"sflow-test"};
+    stream.config_set("bind", "127.0.0.1");
+    stream.config_set<uint64_t>("port", 6345);
+    stream.config_set<uint64_t>("recv_threads", SflowInputStream::MAX_RECV_THREADS);
+    stream.config_set<uint64_t>("recv_batch", SflowInputStream::MAX_RECV_BATCH);
+
+    CHECK_THROWS_AS(stream.start(), SflowException);
+}
+
 TEST_CASE("sflow udp socket without bind", "[sflow][udp]")
 {
     SflowInputStream stream{"sflow-test"};
 
     CHECK_THROWS_WITH(stream.start(), "sflow config must specify port and bind");
 }
+
+TEST_CASE("sflow decode flags", "[sflow][decode]")
+{
+    SFSample sample{};
+    sample.rawSample = sflow_datagram;
+    sample.rawSampleLen = sizeof(sflow_datagram);
+
+    read_sflow_datagram(&sample);
+    REQUIRE(sample.elements.size() == 2);
+    CHECK(sample.elements[0].sampleType == SFLCOUNTERS_SAMPLE);
+    CHECK(sample.elements[0].ifCounters.ifIndex == 3);
+    CHECK(sample.elements[1].sampleType == SFLFLOW_SAMPLE);
+
+    // the same context is reused, only flow samples and their header fields are decoded
+    sample.decodeFlags = DECODE_FLOW_SAMPLES;
+    read_sflow_datagram(&sample);
+    REQUIRE(sample.elements.size() == 1);
+    const auto &flow = sample.elements[0];
+    CHECK(flow.sampleType == SFLFLOW_SAMPLE);
+    CHECK(flow.meanSkipCount == 1000);
+    CHECK(flow.sampledPacketSize == 1500);
+    CHECK(flow.gotIPV4);
+    CHECK(flow.ipsrc.address.ip_v4.addr == htonl(0x0a000002));
+    CHECK(flow.dcd_ipProtocol == IP_PROTOCOL::TCP);
+    CHECK(flow.dcd_dport == 443);
+    CHECK(sample.agent_addr.address.ip_v4.addr == htonl(0xc0a80001));
+
+    sample.decodeFlags = DECODE_COUNTER_SAMPLES;
+    read_sflow_datagram(&sample);
+    REQUIRE(sample.elements.size() == 1);
+    CHECK(sample.elements[0].sampleType == SFLCOUNTERS_SAMPLE);
+}
+
+TEST_CASE("sflow consumer decode flags", "[sflow][decode]")
+{
+    SflowInputStream stream{"sflow-test"};
+    CHECK(stream.decode_flags() == DECODE_ALL);
+    int flow_consumer, counter_consumer;
+    stream.require_decode(&flow_consumer, DECODE_FLOW_SAMPLES);
+    stream.require_decode(&counter_consumer, DECODE_COUNTER_SAMPLES);
+    CHECK(stream.decode_flags() == (DECODE_FLOW_SAMPLES | DECODE_COUNTER_SAMPLES));
+    stream.release_decode(&counter_consumer);
+    CHECK(stream.decode_flags() == DECODE_FLOW_SAMPLES);
+
+    // a consumer that connects without declaring needs everything
+    auto declared = stream.sflow_connect([](const SFSample &) {});
+    CHECK(stream.decode_flags() == DECODE_FLOW_SAMPLES);
+    auto undeclared = stream.sflow_connect([](const SFSample &) {});
+    CHECK(stream.decode_flags() == DECODE_ALL);
+    stream.sflow_disconnect(undeclared);
+    CHECK(stream.decode_flags() == DECODE_FLOW_SAMPLES);
+    stream.sflow_disconnect(declared);
+    stream.release_decode(&flow_consumer);
+    CHECK(stream.decode_flags() == DECODE_ALL);
+}
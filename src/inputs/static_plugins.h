@@ -5,6 +5,7 @@ int import_input_plugins()
     CORRADE_PLUGIN_IMPORT(VisorInputPcap);
     CORRADE_PLUGIN_IMPORT(VisorInputDnstap);
     CORRADE_PLUGIN_IMPORT(VisorInputSflow);
+    CORRADE_PLUGIN_IMPORT(VisorInputFlow);
     return 0;
 }
 
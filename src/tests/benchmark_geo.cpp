@@ -0,0 +1,83 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "GeoDB.h"
+#include <arpa/inet.h>
+#include <benchmark/benchmark.h>
+#include <vector>
+
+// run from src/, like the unit tests
+static visor::geo::MaxmindDB &cityDB()
+{
+    static visor::geo::MaxmindDB db;
+    if (!db.enabled()) {
+        db.enable("tests/fixtures/GeoIP2-City-Test.mmdb");
+    }
+    return db;
+}
+
+static visor::geo::MaxmindDB &compiledCityDB()
+{
+    static visor::geo::MaxmindDB db;
+    if (!db.enabled()) {
+        db.enable("tests/fixtures/GeoIP2-City-Test.mmdb", true);
+    }
+    return db;
+}
+
+static std::vector<struct sockaddr_in> addresses(uint32_t count)
+{
+    std::vector<struct sockaddr_in> result(count);
+    uint32_t base = ntohl(inet_addr("89.160.0.0"));
+    for (uint32_t i = 0; i < count; i++) {
+        result[i].sin_family = AF_INET;
+        result[i].sin_addr.s_addr = htonl(base + i * 7);
+    }
+    return result;
+}
+
+static void BM_geoLookupString(benchmark::State &state)
+{
+    auto &db = cityDB();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.getGeoLocString("89.160.20.112"));
+    }
+}
+BENCHMARK(BM_geoLookupString);
+
+// a working set of state.range(0) addresses, below and above the cache size
+static void BM_geoLookupSockaddr(benchmark::State &state)
+{
+    auto &db = cityDB();
+    auto sa = addresses(static_cast<uint32_t>(state.range(0)));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.getGeoLocString(reinterpret_cast<struct sockaddr *>(&sa[i])));
+        i = (i + 1) % sa.size();
+    }
+}
+BENCHMARK(BM_geoLookupSockaddr)->Arg(1)->Arg(1000)->Arg(100000);
+
+static void BM_geoLookupCompiled(benchmark::State &state)
+{
+    auto &db = compiledCityDB();
+    auto sa = addresses(static_cast<uint32_t>(state.range(0)));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(db.getGeoLocId(reinterpret_cast<struct sockaddr *>(&sa[i])));
+        i = (i + 1) % sa.size();
+    }
+}
+BENCHMARK(BM_geoLookupCompiled)->Arg(1)->Arg(1000)->Arg(100000);
+
+static void BM_geoCompile(benchmark::State &state)
+{
+    for (auto _ : state) {
+        visor::geo::MaxmindDB db;
+        db.enable("tests/fixtures/GeoIP2-City-Test.mmdb", true);
+    }
+}
+BENCHMARK(BM_geoCompile);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,76 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "Metrics.h"
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <timer.hpp>
+#include <vector>
+
+using namespace visor;
+
+// rates held by each policy's live bucket
+static constexpr size_t RATES_PER_POLICY = 3;
+
+static std::vector<std::unique_ptr<Rate>> make_rates(size_t policies)
+{
+    std::vector<std::unique_ptr<Rate>> rates;
+    for (size_t i = 0; i < policies * RATES_PER_POLICY; ++i) {
+        rates.push_back(std::make_unique<Rate>("bench", std::initializer_list<std::string>{"rate"}, "A benchmark rate"));
+    }
+    return rates;
+}
+
+// the cost of one per second tick over the live rates of all policies
+static void BM_rateTick(benchmark::State &state)
+{
+    auto rates = make_rates(state.range(0));
+    for (auto _ : state) {
+        for (auto &rate : rates) {
+            *rate += 100;
+        }
+        RateTicker::instance().tick();
+    }
+    state.SetItemsProcessed(state.iterations() * rates.size());
+}
+BENCHMARK(BM_rateTick)->Arg(1)->Arg(100)->Arg(1000);
+
+// buckets are recreated for every policy at each period shift, their rates joining the ticker and the rates of
+// the previous bucket leaving it. metric construction itself is left out, as it is the same for both schemes
+static void BM_ratePeriodShift(benchmark::State &state)
+{
+    auto rates = make_rates(state.range(0));
+    for (auto &rate : rates) {
+        rate->cancel();
+    }
+    for (auto _ : state) {
+        for (auto &rate : rates) {
+            RateTicker::instance().add(rate.get());
+        }
+        for (auto &rate : rates) {
+            rate->cancel();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * RATES_PER_POLICY);
+}
+BENCHMARK(BM_ratePeriodShift)->Arg(1)->Arg(100)->Arg(1000);
+
+// for comparison, the previous scheme: one interval job per rate on a shared timer thread
+static void BM_timerJobPeriodShift(benchmark::State &state)
+{
+    static timer timer_thread{100ms};
+    for (auto _ : state) {
+        std::vector<std::shared_ptr<timer::interval_handle>> jobs;
+        for (int64_t i = 0; i < state.range(0) * static_cast<int64_t>(RATES_PER_POLICY); ++i) {
+            jobs.push_back(timer_thread.set_interval(1s, [] {}));
+        }
+        for (auto &job : jobs) {
+            job->cancel();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * RATES_PER_POLICY);
+}
+BENCHMARK(BM_timerJobPeriodShift)->Arg(1)->Arg(100)->Arg(1000);
+
+BENCHMARK_MAIN();
@@ -1,6 +1,8 @@
 #include "GeoDB.h"
 #include <arpa/inet.h>
 #include <catch2/catch.hpp>
+#include <filesystem>
+#include <thread>
 #pragma GCC diagnostic ignored "-Wold-style-cast"
 
 TEST_CASE("GeoIP", "[geoip]")
@@ -62,4 +64,202 @@ TEST_CASE("GeoIP", "[geoip]")
         inet_pton(AF_INET6, "2401:8080::", &sa6.sin6_addr);
         CHECK(visor::geo::GeoASN().getASNString((struct sockaddr *)&sa6) == "237/Merit Network Inc.");
     }
+
+    SECTION("cached lookup, socket")
+    {
+        struct sockaddr_in sa4;
+        sa4.sin_family = AF_INET;
+        inet_pton(AF_INET, "89.160.20.112", &sa4.sin_addr.s_addr);
+        struct sockaddr_in6 sa6;
+        sa6.sin6_family = AF_INET6;
+        inet_pton(AF_INET6, "2401:8080::", &sa6.sin6_addr);
+        for (int i = 0; i < 3; i++) {
+            CHECK(visor::geo::GeoIP().getGeoLocString((struct sockaddr *)&sa4) == "EU/Sweden/E/Linköping");
+            CHECK(visor::geo::GeoASN().getASNString((struct sockaddr *)&sa6) == "237/Merit Network Inc.");
+        }
+        inet_pton(AF_INET, "6.6.6.6", &sa4.sin_addr.s_addr);
+        CHECK(visor::geo::GeoASN().getASNString((struct sockaddr *)&sa4) == "Unknown");
+        CHECK(visor::geo::GeoASN().getASNString((struct sockaddr *)&sa4) == "Unknown");
+    }
+
+    SECTION("lookup ids, socket")
+    {
+        struct sockaddr_in sa4;
+        sa4.sin_family = AF_INET;
+        inet_pton(AF_INET, "89.160.20.112", &sa4.sin_addr.s_addr);
+        auto geo_id = visor::geo::GeoIP().getGeoLocId((struct sockaddr *)&sa4);
+        CHECK(visor::geo::LookupNames().name(geo_id) == "EU/Sweden/E/Linköping");
+        CHECK(visor::geo::GeoIP().getGeoLocId((struct sockaddr *)&sa4) == geo_id);
+        inet_pton(AF_INET, "1.128.0.0", &sa4.sin_addr.s_addr);
+        auto asn_id = visor::geo::GeoASN().getASNId((struct sockaddr *)&sa4);
+        CHECK(visor::geo::LookupNames().name(asn_id) == "1221/Telstra Pty Ltd");
+        CHECK(asn_id != geo_id);
+        inet_pton(AF_INET, "6.6.6.6", &sa4.sin_addr.s_addr);
+        CHECK(visor::geo::GeoASN().getASNId((struct sockaddr *)&sa4) == visor::geo::StringTable::UNKNOWN);
+        visor::geo::MaxmindDB disabled;
+        CHECK(disabled.getASNId((struct sockaddr *)&sa4) == visor::geo::StringTable::EMPTY);
+    }
+
+    SECTION("cache invalidated on reload")
+    {
+        visor::geo::MaxmindDB db;
+        struct sockaddr_in sa4;
+        sa4.sin_family = AF_INET;
+        inet_pton(AF_INET, "89.160.20.112", &sa4.sin_addr.s_addr);
+        CHECK_NOTHROW(db.enable("tests/fixtures/GeoIP2-City-Test.mmdb"));
+        CHECK(db.getGeoLocString((struct sockaddr *)&sa4) == "EU/Sweden/E/Linköping");
+        CHECK_NOTHROW(db.enable("tests/fixtures/GeoIP2-ISP-Test.mmdb"));
+        CHECK(db.getGeoLocString((struct sockaddr *)&sa4) != "EU/Sweden/E/Linköping");
+        CHECK_THROWS(db.enable("nonexistent.mmdb"));
+        CHECK(db.enabled());
+    }
+
+    SECTION("compiled lookup")
+    {
+        visor::geo::MaxmindDB city, asn;
+        CHECK_NOTHROW(city.enable("tests/fixtures/GeoIP2-City-Test.mmdb", true));
+        CHECK_NOTHROW(asn.enable("tests/fixtures/GeoIP2-ISP-Test.mmdb", true));
+        CHECK(city.compiled());
+        struct sockaddr_in sa4;
+        sa4.sin_family = AF_INET;
+        inet_pton(AF_INET, "89.160.20.112", &sa4.sin_addr.s_addr);
+        CHECK(city.getGeoLocString((struct sockaddr *)&sa4) == "EU/Sweden/E/Linköping");
+        inet_pton(AF_INET, "1.128.0.0", &sa4.sin_addr.s_addr);
+        CHECK(asn.getASNString((struct sockaddr *)&sa4) == "1221/Telstra Pty Ltd");
+        inet_pton(AF_INET, "6.6.6.6", &sa4.sin_addr.s_addr);
+        CHECK(asn.getASNString((struct sockaddr *)&sa4) == "Unknown");
+        struct sockaddr_in6 sa6;
+        sa6.sin6_family = AF_INET6;
+        inet_pton(AF_INET6, "2a02:dac0::", &sa6.sin6_addr);
+        CHECK(city.getGeoLocString((struct sockaddr *)&sa6) == "EU/Russia");
+        inet_pton(AF_INET6, "2401:8080::", &sa6.sin6_addr);
+        CHECK(asn.getASNString((struct sockaddr *)&sa6) == "237/Merit Network Inc.");
+        // IPv4 mapped into IPv6 resolves through the IPv4 table
+        inet_pton(AF_INET6, "::ffff:89.160.20.112", &sa6.sin6_addr);
+        CHECK(city.getGeoLocString((struct sockaddr *)&sa6) == "EU/Sweden/E/Linköping");
+        CHECK(city.getGeoLocString((struct sockaddr *)&sa6) == visor::geo::GeoIP().getGeoLocString((struct sockaddr *)&sa6));
+        inet_pton(AF_INET6, "::ffff:1.128.0.0", &sa6.sin6_addr);
+        CHECK(asn.getASNString((struct sockaddr *)&sa6) == "1221/Telstra Pty Ltd");
+
+        // compiled and search tree lookups agree, around networks the fixtures populate
+        uint32_t seed = 1;
+        auto next = [&seed]() {
+            seed = seed * 1664525 + 1013904223;
+            return seed;
+        };
+        for (auto base : {"89.160.20.112", "216.160.83.56", "81.2.69.142", "1.128.0.0", "175.16.199.0"}) {
+            inet_pton(AF_INET, base, &sa4.sin_addr.s_addr);
+            auto prefix = ntohl(sa4.sin_addr.s_addr) & 0xff000000;
+            for (int i = 0; i < 500; i++) {
+                sa4.sin_addr.s_addr = htonl(prefix | (next() >> 8));
+                CHECK(city.getGeoLocString((struct sockaddr *)&sa4) == visor::geo::GeoIP().getGeoLocString((struct sockaddr *)&sa4));
+                CHECK(asn.getASNString((struct sockaddr *)&sa4) == visor::geo::GeoASN().getASNString((struct sockaddr *)&sa4));
+            }
+        }
+        for (auto base : {"2a02:dac0::", "2401:8080::", "2001:218::", "2002:5aa0::", "::ffff:0:0"}) {
+            for (int i = 0; i < 500; i++) {
+                inet_pton(AF_INET6, base, &sa6.sin6_addr);
+                for (size_t b = 2 + i % 4; b < sizeof(sa6.sin6_addr.s6_addr); b++) {
+                    sa6.sin6_addr.s6_addr[b] = static_cast<uint8_t>(next() >> 24);
+                }
+                CHECK(city.getGeoLocString((struct sockaddr *)&sa6) == visor::geo::GeoIP().getGeoLocString((struct sockaddr *)&sa6));
+                CHECK(asn.getASNString((struct sockaddr *)&sa6) == visor::geo::GeoASN().getASNString((struct sockaddr *)&sa6));
+            }
+        }
+
+        visor::geo::json j;
+        city.info_json(j);
+        CHECK(j["compiled"] == true);
+        CHECK(j["table_bytes"] > 0);
+        CHECK(j["table_bytes"] > j["ipv4_table_bytes"]);
+        CHECK(j["ipv6_search_tree_prefixes"] > 0);
+
+        // networks longer than the compiled IPv6 limit are looked up in the search tree
+        for (auto addr : {"100::", "100::1", "100:0:0:ffff::1", "::1:0:0:1"}) {
+            inet_pton(AF_INET6, addr, &sa6.sin6_addr);
+            CHECK(city.getGeoLocString((struct sockaddr *)&sa6) == visor::geo::GeoIP().getGeoLocString((struct sockaddr *)&sa6));
+            CHECK(asn.getASNString((struct sockaddr *)&sa6) == visor::geo::GeoASN().getASNString((struct sockaddr *)&sa6));
+        }
+    }
+
+    SECTION("hot reload")
+    {
+        auto file = std::filesystem::temp_directory_path() / "visor-test-geo-reload.mmdb";
+        std::filesystem::copy_file("tests/fixtures/GeoIP2-City-Test.mmdb", file, std::filesystem::copy_options::overwrite_existing);
+        visor::geo::MaxmindDB db;
+        CHECK(!db.reload(false));
+        CHECK_NOTHROW(db.enable(file.string()));
+        struct sockaddr_in sa4;
+        sa4.sin_family = AF_INET;
+        inet_pton(AF_INET, "89.160.20.112", &sa4.sin_addr.s_addr);
+
+        // lookups carry on while the database is swapped underneath them
+        std::atomic<bool> done{false};
+        std::atomic<uint64_t> mismatches{0};
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 2; i++) {
+            readers.emplace_back([&] {
+                while (!done) {
+                    if (db.getGeoLocString((struct sockaddr *)&sa4) != "EU/Sweden/E/Linköping") {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < 10; i++) {
+            CHECK_NOTHROW(db.enable(file.string(), i % 2));
+            CHECK(db.reload());
+        }
+        done = true;
+        for (auto &t : readers) {
+            t.join();
+        }
+        CHECK(mismatches == 0);
+
+        // unchanged file is not reloaded, an updated one is
+        CHECK(!db.reload(false));
+        std::filesystem::copy_file("tests/fixtures/GeoIP2-ISP-Test.mmdb", file, std::filesystem::copy_options::overwrite_existing);
+        std::filesystem::last_write_time(file, std::filesystem::last_write_time(file) + std::chrono::seconds(10));
+        CHECK(db.reload(false));
+        inet_pton(AF_INET, "1.128.0.0", &sa4.sin_addr.s_addr);
+        CHECK(db.getASNString((struct sockaddr *)&sa4) == "1221/Telstra Pty Ltd");
+        std::filesystem::remove(file);
+        CHECK(!db.reload(false));
+        CHECK(db.enabled());
+    }
+
+    SECTION("watched database is reloaded and outlived by the watch")
+    {
+        auto file = std::filesystem::temp_directory_path() / "visor-test-geo-watch.mmdb";
+        std::filesystem::copy_file("tests/fixtures/GeoIP2-City-Test.mmdb", file, std::filesystem::copy_options::overwrite_existing);
+        uint64_t generation{0};
+        {
+            visor::geo::MaxmindDB db;
+            CHECK_NOTHROW(db.enable(file.string()));
+            visor::geo::json j;
+            db.info_json(j);
+            generation = j["generation"];
+            db.watch(std::chrono::seconds(1));
+            std::filesystem::last_write_time(file, std::filesystem::last_write_time(file) + std::chrono::seconds(10));
+            for (int i = 0; i < 50 && j["generation"] == generation; i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                db.info_json(j);
+            }
+            CHECK(j["generation"] != generation);
+            // destroyed with the watch still scheduled
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        std::filesystem::remove(file);
+    }
+
+    SECTION("interned lookup names")
+    {
+        auto &names = visor::geo::LookupNames();
+        CHECK(names.name(visor::geo::StringTable::EMPTY) == "");
+        CHECK(names.name(visor::geo::StringTable::UNKNOWN) == "Unknown");
+        auto id = names.intern("EU/Sweden");
+        CHECK(names.intern("EU/Sweden") == id);
+        CHECK(names.name(id) == "EU/Sweden");
+        CHECK(names.intern("EU/Russia") != id);
+    }
 }
@@ -1,5 +1,6 @@
 #include "AbstractMetricsManager.h"
 #include <catch2/catch.hpp>
+#include <thread>
 
 using namespace visor;
 
@@ -113,6 +114,66 @@ TEST_CASE("Counter metrics", "[metrics][counter]")
     }
 }
 
+TEST_CASE("ShardedCounter metrics", "[metrics][counter]")
+{
+    Metric::add_static_label("instance", "test instance");
+
+    json j;
+    std::stringstream output;
+    std::string line;
+    ShardedCounter c("root", {"test", "metric"}, "A sharded counter test metric");
+
+    SECTION("ShardedCounter increment")
+    {
+        ++c;
+        c += 4;
+        c.to_json(j["top"]);
+        CHECK(j["top"]["test"]["metric"] == 5);
+    }
+
+    SECTION("ShardedCounter concurrent increment")
+    {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < ShardedCounter::SHARDS + 4; t++) {
+            threads.emplace_back([&c] {
+                for (int i = 0; i < 10000; i++) {
+                    ++c;
+                }
+                c += 5;
+            });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        CHECK(c.value() == (ShardedCounter::SHARDS + 4) * 10005);
+    }
+
+    SECTION("ShardedCounter merge and copy")
+    {
+        ShardedCounter other("root", {"test", "metric"}, "A sharded counter test metric");
+        c += 3;
+        other += 7;
+        c.merge(other);
+        CHECK(c.value() == 10);
+        ShardedCounter copy(c);
+        ++c;
+        CHECK(copy.value() == 10);
+        CHECK(c.value() == 11);
+    }
+
+    SECTION("ShardedCounter prometheus")
+    {
+        ++c;
+        c.to_prometheus(output, {{"policy", "default"}});
+        std::getline(output, line);
+        CHECK(line == "# HELP root_test_metric A sharded counter test metric");
+        std::getline(output, line);
+        CHECK(line == "# TYPE root_test_metric gauge");
+        std::getline(output, line);
+        CHECK(line == R"(root_test_metric{instance="test instance",policy="default"} 1)");
+    }
+}
+
 TEST_CASE("Quantile metrics", "[metrics][quantile]")
 {
     Metric::add_static_label("instance", "test instance");
@@ -234,6 +295,97 @@ TEST_CASE("TopN metrics", "[metrics][topn]")
         std::getline(output, line);
         CHECK(line == R"(root_test_metric{instance="test instance",integer="10",policy="default"} 1)");
     }
+
+    SECTION("TopN IPv6 keys")
+    {
+        TopN<IPv6Key> top_ipv6("root", "ipv6", {"test", "metric"}, "A topn test metric");
+        uint8_t addr[16];
+        inet_pton(AF_INET6, "2001:db8::1", addr);
+        IPv6Key a(addr);
+        inet_pton(AF_INET6, "2001:db8::2", addr);
+        IPv6Key b(addr);
+        CHECK(a == IPv6Key(a.bytes.data()));
+        CHECK(!(a == b));
+        CHECK(std::hash<IPv6Key>{}(a) != std::hash<IPv6Key>{}(b));
+        top_ipv6.update(a);
+        top_ipv6.update(b);
+        top_ipv6.update(a);
+        top_ipv6.to_json(j);
+        CHECK(j["test"]["metric"][0]["name"] == "2001:db8::1");
+        CHECK(j["test"]["metric"][0]["estimate"] == 2);
+        top_ipv6.to_prometheus(output, {{"policy", "default"}});
+        std::getline(output, line);
+        std::getline(output, line);
+        std::getline(output, line);
+        CHECK(line == R"(root_test_metric{instance="test instance",ipv6="2001:db8::1",policy="default"} 2)");
+    }
+
+    SECTION("IPv6 prefix keys")
+    {
+        uint8_t addr[16];
+        inet_pton(AF_INET6, "2001:db8:abcd:ffff::1", addr);
+        CHECK(IPv6Key(addr, 48).to_string() == "2001:db8:abcd::");
+        CHECK(IPv6Key(addr, 52).to_string() == "2001:db8:abcd:f000::");
+        CHECK(IPv6Key(addr, 128) == IPv6Key(addr));
+        inet_pton(AF_INET6, "2001:db8:abcd:1::2", addr);
+        CHECK(IPv6Key(addr, 48) == IPv6Key(addr, 48));
+        CHECK(IPv6Key(addr, 48).to_string() == "2001:db8:abcd::");
+    }
+}
+
+TEST_CASE("DenseCounter metrics", "[metrics][densecounter]")
+{
+    Metric::add_static_label("instance", "test instance");
+
+    json j;
+    std::stringstream output;
+    std::string line;
+    DenseCounter<uint16_t, 16> dense("root", "integer", {"test", "metric"}, "A dense counter test metric");
+
+    SECTION("DenseCounter to json")
+    {
+        dense.update(3);
+        dense.update(0);
+        dense.update(3);
+        dense.update(300);
+        dense.to_json(j["top"]);
+        CHECK(j["top"]["test"]["metric"][0]["name"] == "3");
+        CHECK(j["top"]["test"]["metric"][0]["estimate"] == 2);
+        CHECK(j["top"]["test"]["metric"][1]["name"] == "0");
+        CHECK(j["top"]["test"]["metric"][1]["estimate"] == 1);
+        CHECK(j["top"]["test"]["metric"][2]["name"] == "300");
+        CHECK(j["top"]["test"]["metric"][2]["estimate"] == 1);
+        CHECK(j["top"]["test"]["metric"].size() == 3);
+    }
+
+    SECTION("DenseCounter merge")
+    {
+        DenseCounter<uint16_t, 16> other("root", "integer", {"test", "metric"}, "A dense counter test metric");
+        dense.update(1);
+        other.update(1);
+        other.update(1000);
+        dense.merge(other);
+        CHECK(dense.count(1) == 2);
+        CHECK(dense.count(1000) == 1);
+        CHECK(dense.count(2) == 0);
+    }
+
+    SECTION("DenseCounter prometheus formatter")
+    {
+        dense.update(5);
+        dense.update(10);
+        dense.update(5);
+        dense.to_prometheus(output, {{"policy", "default"}},
+            [](const uint16_t &val) { return "code" + std::to_string(val); });
+        std::getline(output, line);
+        CHECK(line == "# HELP root_test_metric A dense counter test metric");
+        std::getline(output, line);
+        CHECK(line == "# TYPE root_test_metric gauge");
+        std::getline(output, line);
+        CHECK(line == R"(root_test_metric{instance="test instance",integer="code5",policy="default"} 2)");
+        std::getline(output, line);
+        CHECK(line == R"(root_test_metric{instance="test instance",integer="code10",policy="default"} 1)");
+    }
 }
 
 TEST_CASE("Cardinality metrics", "[metrics][cardinality]")
@@ -271,6 +423,101 @@ TEST_CASE("Cardinality metrics", "[metrics][cardinality]")
     }
 }
 
+TEST_CASE("KeyedCardinality metrics", "[metrics][cardinality]")
+{
+    Metric::add_static_label("instance", "test instance");
+
+    json j;
+    std::stringstream output;
+    std::string line;
+    KeyedCardinality kc("root", "key", "score", {"test", "metric"}, "A keyed cardinality test metric");
+
+    auto update = [&](const std::string &key, const std::string &member, double score) {
+        kc.update(key, member, score);
+    };
+
+    SECTION("KeyedCardinality to json")
+    {
+        update("a", "1", 1.0);
+        update("a", "2", 3.0);
+        update("a", "2", 2.0);
+        update("b", "1", 4.0);
+        kc.to_json(j);
+        CHECK(j["test"]["metric"][0]["name"] == "a");
+        CHECK(j["test"]["metric"][0]["estimate"] == 2);
+        CHECK(j["test"]["metric"][0]["score"] == 2.0);
+        CHECK(j["test"]["metric"][1]["name"] == "b");
+        CHECK(j["test"]["metric"][1]["estimate"] == 1);
+        CHECK(j["test"]["metric"][1]["score"] == 4.0);
+    }
+
+    SECTION("KeyedCardinality bounded keys")
+    {
+        for (size_t k = 0; k < kc.MAX_KEYS; k++) {
+            update("key" + std::to_string(k), "1", 0.0);
+        }
+        // once all slots are taken, a new key is only counted after it is tracked
+        update("heavy", "1", 0.0);
+        CHECK(kc.estimate("heavy") == 0.0);
+        kc.track({"heavy"});
+        update("heavy", "2", 0.0);
+        CHECK(kc.estimate("heavy") == Approx(1.0));
+        kc.to_json(j);
+        CHECK(j["test"]["metric"].size() == kc.MAX_KEYS);
+    }
+
+    SECTION("KeyedCardinality tracked keys")
+    {
+        TopN<std::string> top("root", "key", {"test", "top"}, "A top keys test metric");
+        top.update("a", 10);
+        top.update("b", 5);
+        kc.track(top.top_items(kc.MAX_KEYS));
+        // tracked keys which have not counted anything are not reported
+        kc.to_json(j);
+        CHECK(j["test"]["metric"].size() == 0);
+        for (size_t k = 0; k < kc.MAX_KEYS; k++) {
+            update("key" + std::to_string(k), "1", 0.0);
+        }
+        update("b", "1", 0.0);
+        update("b", "2", 0.0);
+        CHECK(kc.estimate("key" + std::to_string(kc.MAX_KEYS - 3)) == Approx(1.0));
+        CHECK(kc.estimate("key" + std::to_string(kc.MAX_KEYS - 2)) == 0.0);
+        kc.to_json(j);
+        CHECK(j["test"]["metric"][0]["name"] == "b");
+        CHECK(j["test"]["metric"][0]["estimate"] == 2);
+        CHECK(j["test"]["metric"].size() == kc.MAX_KEYS - 1);
+    }
+
+    SECTION("KeyedCardinality merge")
+    {
+        KeyedCardinality other("root", "key", "score", {"test", "metric"}, "A keyed cardinality test metric");
+        update("a", "1", 1.0);
+        other.update("a", "2", 3.0);
+        kc.merge(other);
+        kc.to_json(j);
+        CHECK(j["test"]["metric"][0]["estimate"] == 2);
+        CHECK(j["test"]["metric"][0]["score"] == 2.0);
+    }
+
+    SECTION("KeyedCardinality prometheus")
+    {
+        update("a", "1", 1.5);
+        kc.to_prometheus(output, {{"policy", "default"}});
+        std::getline(output, line);
+        CHECK(line == "# HELP root_test_metric A keyed cardinality test metric");
+        std::getline(output, line);
+        CHECK(line == "# TYPE root_test_metric gauge");
+        std::getline(output, line);
+        CHECK(line == R"(root_test_metric{instance="test instance",key="a",policy="default"} 1)");
+        std::getline(output, line);
+        CHECK(line == "# HELP root_test_metric_score A keyed cardinality test metric (mean score)");
+        std::getline(output, line);
+        CHECK(line == "# TYPE root_test_metric_score gauge");
+        std::getline(output, line);
+        CHECK(line == R"(root_test_metric_score{instance="test instance",key="a",policy="default"} 1.5)");
+    }
+}
+
 TEST_CASE("Rate metrics", "[metrics][rate]")
 {
     Metric::add_static_label("instance", "test instance");
@@ -302,4 +549,58 @@ TEST_CASE("Rate metrics", "[metrics][rate]")
     {
         r.to_prometheus(output, {{"policy", "default"}});
     }
+
+    SECTION("rate ticker")
+    {
+        auto live = RateTicker::instance().size();
+        {
+            Rate other("root", {"test", "other"}, "Another rate test metric");
+            CHECK(RateTicker::instance().size() == live + 1);
+            other.cancel();
+            CHECK(RateTicker::instance().size() == live);
+        }
+        CHECK(RateTicker::instance().size() == live);
+
+        // samples short of a full batch are added to the quantiles on cancel
+        r += 10;
+        RateTicker::instance().tick();
+        RateTicker::instance().tick();
+        r.cancel();
+        CHECK(r.rate() == 0);
+        r.to_json(j);
+        CHECK(j["test"]["metric"].contains("p50"));
+    }
+
+    SECTION("rate event time")
+    {
+        auto live = RateTicker::instance().size();
+        r.set_event_time();
+        CHECK(r.event_time());
+        CHECK(RateTicker::instance().size() == live - 1);
+
+        // 5 events in the first second, 10 in the next, none in the third and 20 in the last (partial) second
+        for (int i = 0; i < 5; i++) {
+            r.update({1000, i * 100000000L});
+        }
+        r.update({1001, 0}, 6);
+        r.update({1001, 500000000L}, 4);
+        CHECK(r.rate() == 5);
+        r.update({1003, 0}, 20);
+        CHECK(r.rate() == 10);
+        // late events count towards the current second
+        r.update({1002, 0}, 1);
+        r.cancel();
+
+        r.to_json(j);
+        CHECK(j["test"]["metric"]["p50"] == 10);
+        CHECK(j["test"]["metric"]["p99"] == 21);
+        r.to_prometheus(output, {{"policy", "default"}});
+        std::string count;
+        while (std::getline(output, line)) {
+            if (line.find("root_test_metric_count") == 0) {
+                count = line;
+            }
+        }
+        CHECK(count == R"(root_test_metric_count{instance="test instance",policy="default"} 4)");
+    }
 }